@@ -7,3 +7,8 @@ COMPONENT_SRCDIRS := src src/littlefs
 COMPONENT_ADD_INCLUDEDIRS := include src ../../main ../lowjs/lowjs/src ../lowjs ../duktape/duktape/src-neonious
 
 COMPONENT_SUBMODULES := littlefs
+
+# littlefs_crc.c provides lfs_crc(); littlefs' own is kept as the reference
+src/littlefs/lfs_util.o: CFLAGS += -Dlfs_crc=lfs_crc_reference
+# Lets snapshots keep the allocator off their blocks, see littlefs_hooks.h
+src/littlefs/lfs.o: CFLAGS += -include $(COMPONENT_PATH)/src/littlefs_hooks.h
@@ -20,6 +20,7 @@
 #include "sdkconfig.h"
 
 #include "littlefs/lfs.h"
+#include "esp_littlefs_trace.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,11 @@ enum {
     LITTLEFS_ATTR_MAX
 };
 
+/**
+ * Opaque handle to a point-in-time read-only view of a mounted partition.
+ */
+typedef struct esp_littlefs_snapshot esp_littlefs_snapshot_t;
+
 /**
  *Configuration structure for esp_vfs_littlefs_register.
  */
@@ -38,6 +44,7 @@ typedef struct {
     const char *partition_label;      /**< Label of partition to use. */
     uint8_t format_if_mount_failed:1; /**< Format the file system if it fails to mount. */
     uint8_t dont_mount:1;             /**< Don't attempt to mount or format. Overrides format_if_mount_failed */
+    uint8_t read_only:1;              /**< Reject writes; reads from different tasks don't serialize on the mount lock */
 } esp_vfs_littlefs_conf_t;
 
 /**
@@ -99,6 +106,590 @@ esp_err_t esp_littlefs_format(bool internal_version);
  */
 esp_err_t esp_littlefs_info(const char* partition_label, size_t *total_bytes, size_t *used_bytes);
 
+/**
+ * Where the last mount of a partition spent its time, in microseconds.
+ */
+typedef struct {
+    uint32_t total_us;        /**< All of esp_vfs_littlefs_register() but the VFS registration */
+    uint32_t alloc_us;        /**< Allocating and configuring the context */
+    uint32_t lock_us;         /**< Creating the mount lock */
+    uint32_t buffers_us;      /**< Allocating the littlefs caches */
+    uint32_t mount_us;        /**< lfs_mount(); the last attempt if it was formatted in between */
+    uint32_t superblock_us;   /**< Part of mount_us fetching the superblock pair, blocks 0 and 1 */
+    uint32_t metadata_us;     /**< Rest of mount_us, fetching and validating the other metadata pairs */
+    uint32_t mount_reads;     /**< Flash reads issued by lfs_mount() */
+    uint32_t traverse_us;     /**< First walk of the tree for the block allocator; 0 unless LITTLEFS_MOUNT_TRAVERSE */
+    uint32_t used_blocks;     /**< Blocks in use found by that walk */
+    uint32_t erase_us;        /**< Erasing the partition for a format; 0 if not formatted */
+    uint32_t format_us;       /**< lfs_format(); 0 if not formatted */
+    uint32_t readers_us;      /**< Mounting the readers of a read-only mount */
+} esp_littlefs_mount_timing_t;
+
+/**
+ * Get the timing of the last mount of a partition, or of the last format
+ * for erase_us and format_us.
+ *
+ * @param partition_label  Label of the partition.
+ * @param[out] timing      Phase durations
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ */
+esp_err_t esp_littlefs_mount_timing(const char* partition_label, esp_littlefs_mount_timing_t *timing);
+
+/**
+ * What a block holds, see esp_littlefs_block_map().
+ */
+typedef enum {
+    ESP_LITTLEFS_BLOCK_FREE,  /**< Not in use */
+    ESP_LITTLEFS_BLOCK_META,  /**< Metadata pair: directories, inline files, superblock */
+    ESP_LITTLEFS_BLOCK_DATA,  /**< Part of a file's data */
+} esp_littlefs_block_type_t;
+
+/** Buckets of esp_littlefs_block_map_t::free_runs; bucket n counts runs of [2^n, 2^(n+1)) blocks */
+#define ESP_LITTLEFS_RUN_BUCKETS 12
+
+/**
+ * Callbacks of esp_littlefs_block_map(); either may be NULL.
+ *
+ * They're called with the partition locked, so they must not use it.
+ */
+typedef struct {
+    /** Every block; data blocks first, per file and with its path, then the others in order with path NULL */
+    void (*block)(void *arg, uint32_t block, esp_littlefs_block_type_t type, const char *path);
+    /** Every file; extents is the number of contiguous runs its data blocks form, 0 for inline files */
+    void (*file)(void *arg, const char *path, uint32_t size, uint32_t blocks, uint32_t extents);
+    void *arg;
+} esp_littlefs_block_map_cb_t;
+
+/**
+ * Block usage and fragmentation of a partition.
+ */
+typedef struct {
+    uint32_t block_count;
+    uint32_t free_blocks;
+    uint32_t meta_blocks;
+    uint32_t data_blocks;
+    uint32_t largest_free_run;                        /**< Longest run of free blocks */
+    uint32_t free_runs[ESP_LITTLEFS_RUN_BUCKETS];     /**< Free runs by length, log2 buckets */
+    float    fragmentation;                           /**< 1 - largest_free_run / free_blocks; 0 is all free space in one run */
+    uint32_t files;
+    uint32_t fragmented_files;                        /**< Files whose data is in more than one run */
+    uint32_t data_extents;                            /**< Runs of data blocks, over all files */
+} esp_littlefs_block_map_t;
+
+/**
+ * Classify every block of a mounted partition and measure fragmentation.
+ *
+ * Walks the whole tree with the partition locked; this is a diagnostic,
+ * not something to call on a hot path. Data not yet synced to open files
+ * isn't reflected.
+ *
+ * @param partition_label  Label of the partition.
+ * @param cb               Optional per-block and per-file callbacks.
+ * @param[out] map         Optional summary.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NO_MEM          if the block bitmap could not be allocated
+ *          - ESP_FAIL                if the tree could not be walked
+ */
+esp_err_t esp_littlefs_block_map(const char* partition_label, const esp_littlefs_block_map_cb_t *cb,
+        esp_littlefs_block_map_t *map);
+
+/**
+ * Export the block map as 2 bits per block, an esp_littlefs_block_type_t,
+ * block 0 in the low bits of the first byte. tools/block_map.py renders it.
+ *
+ * @param partition_label  Label of the partition.
+ * @param[out] bitmap      At least (block count + 3) / 4 bytes
+ * @param size             Size of bitmap
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_INVALID_SIZE    if bitmap is too small
+ *          - ESP_FAIL                if the tree could not be walked
+ */
+esp_err_t esp_littlefs_block_bitmap(const char* partition_label, uint8_t *bitmap, size_t size);
+
+/**
+ * Take a point-in-time read-only snapshot of a mounted littlefs partition.
+ *
+ * Blocks referenced by the snapshot are pinned until it is released; writers
+ * keep working but cannot reuse those blocks, so free space shrinks by the
+ * amount of data overwritten or deleted while the snapshot is held.
+ * Only one snapshot per partition may exist at a time, and it must be
+ * released before the partition is unregistered or formatted.
+ *
+ * @param partition_label     Label of the partition to snapshot.
+ * @param[out] snapshot       Handle to the new snapshot
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_NO_MEM          if the snapshot could not be allocated
+ *          - ESP_ERR_INVALID_STATE   if not mounted or a snapshot already exists
+ *          - ESP_ERR_NOT_SUPPORTED   if the littlefs built in doesn't call the allocator
+ *                                    hook of littlefs_hooks.h, so blocks can't be pinned
+ *          - ESP_FAIL                if the snapshot could not be mounted
+ */
+esp_err_t esp_littlefs_snapshot_take(const char* partition_label, esp_littlefs_snapshot_t ** snapshot);
+
+/**
+ * Release a snapshot, unpinning its blocks.
+ *
+ * @param snapshot  Snapshot to release. Files and directories opened on it
+ *                  must be closed first.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_ARG     if snapshot is NULL
+ */
+esp_err_t esp_littlefs_snapshot_release(esp_littlefs_snapshot_t * snapshot);
+
+/**
+ * Read-only accessors for a snapshot. These mirror lfs_stat, lfs_dir_* and
+ * lfs_file_* on the snapshot's tree; paths are relative to the partition
+ * root (no VFS base path) and results are littlefs error codes.
+ */
+int         esp_littlefs_snapshot_stat(esp_littlefs_snapshot_t * snapshot, const char * path, struct lfs_info * info);
+int         esp_littlefs_snapshot_dir_open(esp_littlefs_snapshot_t * snapshot, lfs_dir_t * dir, const char * path);
+int         esp_littlefs_snapshot_dir_read(esp_littlefs_snapshot_t * snapshot, lfs_dir_t * dir, struct lfs_info * info);
+int         esp_littlefs_snapshot_dir_close(esp_littlefs_snapshot_t * snapshot, lfs_dir_t * dir);
+int         esp_littlefs_snapshot_file_open(esp_littlefs_snapshot_t * snapshot, lfs_file_t * file, const char * path);
+lfs_ssize_t esp_littlefs_snapshot_file_read(esp_littlefs_snapshot_t * snapshot, lfs_file_t * file, void * buffer, lfs_size_t size);
+int         esp_littlefs_snapshot_file_close(esp_littlefs_snapshot_t * snapshot, lfs_file_t * file);
+
+/**
+ * littlefs errors counted by esp_littlefs_stats_t.
+ */
+typedef enum {
+    ESP_LITTLEFS_ERR_IO,
+    ESP_LITTLEFS_ERR_CORRUPT,
+    ESP_LITTLEFS_ERR_NOENT,
+    ESP_LITTLEFS_ERR_EXIST,
+    ESP_LITTLEFS_ERR_NOTDIR,
+    ESP_LITTLEFS_ERR_ISDIR,
+    ESP_LITTLEFS_ERR_NOTEMPTY,
+    ESP_LITTLEFS_ERR_BADF,
+    ESP_LITTLEFS_ERR_FBIG,
+    ESP_LITTLEFS_ERR_INVAL,
+    ESP_LITTLEFS_ERR_NOSPC,
+    ESP_LITTLEFS_ERR_NOMEM,
+    ESP_LITTLEFS_ERR_NOATTR,
+    ESP_LITTLEFS_ERR_NAMETOOLONG,
+    ESP_LITTLEFS_ERR_BUSY,        /**< File is open; unlink and rename refuse it */
+    ESP_LITTLEFS_ERR_ROFS,        /**< Write to a read-only mount */
+    ESP_LITTLEFS_ERR_OTHER,
+    ESP_LITTLEFS_ERR_MAX
+} esp_littlefs_err_t;
+
+/**
+ * Operation counters of a mounted partition, see CONFIG_LITTLEFS_STATS.
+ */
+typedef struct {
+    uint32_t ops[ESP_LITTLEFS_OP_MAX];        /**< VFS calls, by esp_littlefs_op_t */
+    uint64_t read_bytes;                      /**< Bytes returned by read() */
+    uint64_t write_bytes;                     /**< Bytes accepted by write() */
+    uint32_t flash_reads;                     /**< Reads issued to flash, i.e. littlefs cache misses */
+    uint32_t flash_progs;                     /**< Programs issued to flash */
+    uint32_t flash_erases;                    /**< Blocks erased */
+    uint64_t flash_read_bytes;                /**< Bytes read from flash */
+    uint64_t flash_prog_bytes;                /**< Bytes programmed to flash */
+    uint64_t flash_erase_bytes;               /**< Bytes erased */
+    uint32_t cache_hits;                      /**< Reads served from the per-file read-ahead buffer */
+    uint32_t cache_misses;                    /**< Reads that had to go to littlefs */
+    uint32_t errors[ESP_LITTLEFS_ERR_MAX];    /**< Failed calls, by esp_littlefs_err_t */
+    uint32_t mount_us;                        /**< Duration of the last mount, see esp_littlefs_mount_timing(); not reset */
+} esp_littlefs_stats_t;
+
+/**
+ * Get the operation counters of a mounted partition since mount or the
+ * last esp_littlefs_stats_reset(). Counters are kept per core and
+ * updated with interrupts briefly masked on that core instead of a lock.
+ *
+ * @param partition_label  Label of the partition.
+ * @param[out] stats       Counters, summed over cores
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_STATS is disabled
+ */
+esp_err_t esp_littlefs_stats(const char* partition_label, esp_littlefs_stats_t *stats);
+
+/**
+ * Zero the operation counters of a mounted partition.
+ *
+ * @param partition_label  Label of the partition.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_STATS is disabled
+ */
+esp_err_t esp_littlefs_stats_reset(const char* partition_label);
+
+/**
+ * What esp_littlefs_latency() can report on: any esp_littlefs_op_t, or one of these.
+ */
+typedef enum {
+    ESP_LITTLEFS_LAT_FLASH_READ = ESP_LITTLEFS_OP_MAX, /**< One littlefs block-device read */
+    ESP_LITTLEFS_LAT_FLASH_PROG,                       /**< One littlefs block-device program; with
+                                                            CONFIG_LITTLEFS_EXTERNAL_XFER, one queued
+                                                            transfer, timed when the transfer task runs it */
+    ESP_LITTLEFS_LAT_FLASH_ERASE,                      /**< One block erase, timed like programs */
+    ESP_LITTLEFS_LAT_LOCK_WAIT,                        /**< Waiting for a mount or file lock */
+    ESP_LITTLEFS_LAT_MAX
+} esp_littlefs_lat_t;
+
+/**
+ * Number of histogram buckets. Bucket 0 holds 0us; bucket n holds
+ * [2^(n-1), 2^n) us; the last one holds everything slower.
+ */
+#define ESP_LITTLEFS_LAT_BUCKETS 22
+
+/**
+ * Latency distribution of one operation, see CONFIG_LITTLEFS_LATENCY.
+ * Percentiles are the upper bound of the bucket they fall in, so they
+ * overestimate by less than a factor of two; max is exact.
+ */
+typedef struct {
+    uint32_t count;                             /**< Timed calls */
+    uint32_t p50;                               /**< Median in microseconds */
+    uint32_t p90;                               /**< 90th percentile in microseconds */
+    uint32_t p99;                               /**< 99th percentile in microseconds */
+    uint32_t max;                               /**< Slowest call in microseconds */
+    uint32_t buckets[ESP_LITTLEFS_LAT_BUCKETS]; /**< Raw histogram */
+} esp_littlefs_latency_t;
+
+/**
+ * Get the latency distribution of an operation on a mounted partition.
+ *
+ * VFS calls are timed end to end, including any lock wait and flash time
+ * they incur; ESP_LITTLEFS_LAT_LOCK_WAIT and the flash entries break that
+ * down.
+ *
+ * @param partition_label  Label of the partition.
+ * @param[in] which        An esp_littlefs_op_t or esp_littlefs_lat_t.
+ * @param[out] latency     Distribution since mount or the last reset.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_ARG     if which is out of range
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_LATENCY is disabled
+ */
+esp_err_t esp_littlefs_latency(const char* partition_label, int which, esp_littlefs_latency_t *latency);
+
+/**
+ * Clear the latency histograms of a mounted partition.
+ *
+ * @param partition_label  Label of the partition.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_LATENCY is disabled
+ */
+esp_err_t esp_littlefs_latency_reset(const char* partition_label);
+
+/** Files tracked by the amplification meter */
+#define ESP_LITTLEFS_AMP_FILES 16
+
+/**
+ * Flash traffic caused by one file.
+ */
+typedef struct {
+    uint32_t hash;          /**< DJB2 hash of the path relative to the mount point, as in traces */
+    uint64_t user_bytes;    /**< Bytes written to it through the VFS */
+    uint64_t prog_bytes;    /**< Flash bytes programmed by calls on it, metadata included */
+    uint64_t erase_bytes;   /**< Flash bytes erased by calls on it */
+    float    write_amp;     /**< prog_bytes / user_bytes; 0 if nothing was written */
+    float    erase_amp;     /**< erase_bytes / user_bytes; 0 if nothing was written */
+} esp_littlefs_amp_file_t;
+
+/**
+ * Write and erase amplification of a mounted partition, see CONFIG_LITTLEFS_AMP.
+ *
+ * Flash writes are charged to the file the VFS call that caused them was
+ * on, including compactions and block relocations that call triggered.
+ * Removes, renames and mkdir/rmdir are charged to their path, which shows
+ * as traffic with no user bytes.
+ */
+typedef struct {
+    uint64_t user_bytes;        /**< Bytes written through the VFS */
+    uint64_t prog_bytes;        /**< Flash bytes programmed */
+    uint64_t erase_bytes;       /**< Flash bytes erased */
+    uint64_t other_prog_bytes;  /**< Part of prog_bytes not caused by a file call (format, mount, API calls) */
+    uint64_t other_erase_bytes; /**< Part of erase_bytes not caused by a file call */
+    float    write_amp;         /**< prog_bytes / user_bytes */
+    float    erase_amp;         /**< erase_bytes / user_bytes */
+    esp_littlefs_amp_file_t files[ESP_LITTLEFS_AMP_FILES]; /**< Most programmed first */
+    uint8_t  file_count;
+    uint32_t evicted;           /**< Files dropped from the table to make room for others, least recently charged first */
+} esp_littlefs_amp_t;
+
+/**
+ * Get the write and erase amplification of a mounted partition.
+ *
+ * @param partition_label  Label of the partition.
+ * @param[out] amp         Amplification since mount or the last reset.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_AMP is disabled
+ */
+esp_err_t esp_littlefs_amp(const char* partition_label, esp_littlefs_amp_t *amp);
+
+/**
+ * Clear the amplification counters of a mounted partition.
+ *
+ * @param partition_label  Label of the partition.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_AMP is disabled
+ */
+esp_err_t esp_littlefs_amp_reset(const char* partition_label);
+
+/** Tasks tracked by the per-task I/O accounting */
+#define ESP_LITTLEFS_IO_TASKS 8
+
+/**
+ * I/O of one task on a mount.
+ */
+typedef struct {
+    char     task[16];          /**< Task name, possibly truncated */
+    uint32_t ops;               /**< VFS calls */
+    uint64_t read_bytes;        /**< Bytes returned by read() */
+    uint64_t write_bytes;       /**< Bytes accepted by write() */
+    uint64_t flash_read_bytes;  /**< Bytes read from flash on its behalf */
+    uint64_t flash_prog_bytes;  /**< Bytes programmed on its behalf */
+    uint64_t flash_erase_bytes; /**< Bytes erased on its behalf */
+    uint64_t flash_us;          /**< Time spent in flash operations */
+    uint32_t throttled;         /**< Calls delayed for exceeding the I/O budget */
+    uint64_t throttled_us;      /**< Time those calls were delayed */
+} esp_littlefs_task_io_t;
+
+/**
+ * Per-task I/O of a mounted partition, see CONFIG_LITTLEFS_TASK_IO.
+ */
+typedef struct {
+    esp_littlefs_task_io_t tasks[ESP_LITTLEFS_IO_TASKS]; /**< Most flash time first */
+    uint8_t  task_count;
+    uint32_t evicted;           /**< Tasks dropped from the table to make room for others */
+    uint32_t untracked;         /**< Calls not charged, as every task in the table still owed flash time */
+    uint32_t budget_us;         /**< Flash time each task may use per second; 0 if unlimited */
+} esp_littlefs_top_t;
+
+/**
+ * Get the I/O of the tasks using a mounted partition, heaviest first.
+ * Flash operations are charged to the task that was running littlefs when
+ * they happened, or with CONFIG_LITTLEFS_EXTERNAL_XFER, to the task that
+ * queued them, once they finish. When the table is full, the task charged
+ * least recently makes room; tasks over their budget are never dropped.
+ *
+ * @param partition_label  Label of the partition.
+ * @param[out] top         I/O since mount or the last reset.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_TASK_IO is disabled
+ */
+esp_err_t esp_littlefs_top(const char* partition_label, esp_littlefs_top_t *top);
+
+/**
+ * Clear the per-task I/O of a mounted partition. The budget is kept.
+ *
+ * @param partition_label  Label of the partition.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_TASK_IO is disabled
+ */
+esp_err_t esp_littlefs_top_reset(const char* partition_label);
+
+/**
+ * Limit the flash time each task may use on a mounted partition. A task
+ * that has used more than its share is delayed on entry to its next VFS
+ * call, before it takes any lock, until it is back within budget. This
+ * does not depend on CONFIG_LITTLEFS_STATS or the other meters. Up to one second of
+ * budget can be saved up for bursts.
+ *
+ * @param partition_label  Label of the partition.
+ * @param us_per_sec       Flash microseconds per second per task; 0 for unlimited.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_INVALID_ARG     if us_per_sec is over 1000000
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_TASK_IO is disabled
+ */
+esp_err_t esp_littlefs_io_budget(const char* partition_label, uint32_t us_per_sec);
+
+/** Tasks tracked by the lock profiler; acquisitions by others are only counted */
+#define ESP_LITTLEFS_LOCK_TASKS  8
+/** Longest lock holds kept by the lock profiler */
+#define ESP_LITTLEFS_LOCK_EVENTS 8
+
+/**
+ * How one task used a mount lock.
+ */
+typedef struct {
+    char     task[16];      /**< Task name, possibly truncated */
+    uint32_t acquisitions;
+    uint32_t contended;     /**< Acquisitions that had to wait */
+    uint64_t wait_us;       /**< Total time spent waiting */
+    uint32_t max_wait_us;
+    uint64_t hold_us;       /**< Total time the lock was held */
+    uint32_t max_hold_us;
+} esp_littlefs_lock_task_t;
+
+/**
+ * One long hold of a mount lock.
+ */
+typedef struct {
+    char     task[16];      /**< Task name, possibly truncated */
+    uint8_t  op;            /**< VFS call of the holder, ESP_LITTLEFS_OP_MAX for other API calls */
+    uint32_t key;           /**< Path hash of path calls, fd of fd calls, as in traces */
+    uint32_t hold_us;
+    uint32_t time;          /**< Release, esp_timer microseconds (low 32 bits) */
+} esp_littlefs_lock_event_t;
+
+/**
+ * Contention on the lock of a mounted partition, see CONFIG_LITTLEFS_LOCK_PROFILE.
+ * Arrays indexed by esp_littlefs_op_t have an extra entry, at
+ * ESP_LITTLEFS_OP_MAX, for API calls that aren't VFS calls.
+ */
+typedef struct {
+    uint64_t wait_us[ESP_LITTLEFS_OP_MAX + 1];  /**< Time spent waiting, per call */
+    uint64_t hold_us[ESP_LITTLEFS_OP_MAX + 1];  /**< Time the lock was held, per call */
+    esp_littlefs_lock_task_t tasks[ESP_LITTLEFS_LOCK_TASKS]; /**< Most waiting first */
+    uint8_t  task_count;
+    uint32_t untracked;                         /**< Acquisitions by tasks beyond ESP_LITTLEFS_LOCK_TASKS */
+    esp_littlefs_lock_event_t worst[ESP_LITTLEFS_LOCK_EVENTS]; /**< Longest first; hold_us 0 if unused */
+} esp_littlefs_lock_profile_t;
+
+/**
+ * Get the contention profile of the lock of a mounted partition.
+ *
+ * @param partition_label  Label of the partition.
+ * @param[out] profile     Profile since mount or the last reset.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_LOCK_PROFILE is disabled
+ */
+esp_err_t esp_littlefs_lock_profile(const char* partition_label, esp_littlefs_lock_profile_t *profile);
+
+/**
+ * Clear the contention profile of a mounted partition.
+ *
+ * @param partition_label  Label of the partition.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_LOCK_PROFILE is disabled
+ */
+esp_err_t esp_littlefs_lock_profile_reset(const char* partition_label);
+
+/**
+ * Start recording every VFS and block-device call of a mounted partition
+ * into the trace ring (CONFIG_LITTLEFS_TRACE_ENTRIES records), discarding
+ * anything recorded before. One partition is traced at a time; when the
+ * ring is full the oldest records are overwritten.
+ *
+ * @param partition_label  Label of the partition.
+ *
+ * @return
+ *          - ESP_OK                  if success
+ *          - ESP_ERR_INVALID_STATE   if not mounted
+ *          - ESP_ERR_NOT_SUPPORTED   if CONFIG_LITTLEFS_TRACE is disabled
+ */
+esp_err_t esp_littlefs_trace_start(const char* partition_label);
+
+/**
+ * Stop recording. Records already in the ring can still be read.
+ */
+void esp_littlefs_trace_stop(void);
+
+/**
+ * Get the header of the current trace. Write it, then the records from
+ * esp_littlefs_trace_read(), to export the trace as a stream.
+ *
+ * @param[out] hdr  Trace header
+ */
+void esp_littlefs_trace_header(esp_littlefs_trace_hdr_t *hdr);
+
+/**
+ * Take the oldest records out of the trace ring.
+ *
+ * @param[out] recs  Where to copy the records
+ * @param max        Capacity of recs, in records
+ *
+ * @return Number of records copied; 0 once the ring is empty.
+ */
+size_t esp_littlefs_trace_read(esp_littlefs_trace_rec_t *recs, size_t max);
+
+/**
+ * RAM used by esp_littlefs buffers, across all mounts.
+ */
+typedef struct {
+    size_t budget;        /**< Limit on total; 0 if unlimited */
+    size_t total;         /**< Bytes currently allocated */
+    size_t peak;          /**< Highest total seen */
+    size_t spiram;        /**< Part of total placed in PSRAM */
+    size_t mount_caches;  /**< Read, prog and lookahead buffers of mounted instances */
+    size_t file_caches;   /**< littlefs caches of open files */
+    size_t file_buffers;  /**< Read-ahead buffers of open files; these can be reclaimed */
+} esp_littlefs_mem_usage_t;
+
+/**
+ * Set the limit on RAM used by esp_littlefs buffers, see LITTLEFS_MEM_BUDGET.
+ *
+ * If more than that is in use, per-file read-ahead buffers are evicted. Buffers
+ * that can't be evicted stay; the budget then applies to new allocations.
+ *
+ * @param bytes  New budget; 0 for unlimited.
+ *
+ * @return
+ *          - ESP_OK                  if usage is within the new budget
+ *          - ESP_ERR_NO_MEM          if usage could not be brought below it
+ */
+esp_err_t esp_littlefs_mem_set_budget(size_t bytes);
+
+/**
+ * Get the RAM currently used by esp_littlefs buffers.
+ *
+ * @param[out] usage  Current usage
+ */
+void esp_littlefs_mem_usage(esp_littlefs_mem_usage_t *usage);
+
+/**
+ * Free per-file read-ahead buffers, for heap-pressure callbacks.
+ * esp_littlefs calls this itself when one of its own allocations fails;
+ * to have other allocations reclaim these buffers, call it from a
+ * heap_caps failed-alloc callback.
+ *
+ * Doesn't wait for locks; files busy in another task are skipped. Evicted
+ * buffers are reallocated on the next read if memory allows, otherwise
+ * reads go straight to littlefs.
+ *
+ * @param bytes  How much to free; stops once at least that much is freed.
+ *
+ * @return Bytes freed
+ */
+size_t esp_littlefs_mem_reclaim(size_t bytes);
+
 #if CONFIG_LITTLEFS_HUMAN_READABLE
 /**
  * @brief converts an enumerated lfs error into a string.
@@ -0,0 +1,105 @@
+/**
+ * @file esp_littlefs_trace.h
+ * @brief Format of esp_littlefs operation traces.
+ *
+ * Plain C with no ESP-IDF dependencies, so host tools can read traces
+ * (see tools/trace_replay.c). All fields are little-endian.
+ */
+
+#ifndef ESP_LITTLEFS_TRACE_H__
+#define ESP_LITTLEFS_TRACE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * VFS calls, as counted by esp_littlefs_stats_t and recorded in traces.
+ */
+typedef enum {
+    ESP_LITTLEFS_OP_OPEN,
+    ESP_LITTLEFS_OP_CLOSE,
+    ESP_LITTLEFS_OP_READ,
+    ESP_LITTLEFS_OP_WRITE,
+    ESP_LITTLEFS_OP_LSEEK,
+    ESP_LITTLEFS_OP_FSYNC,
+    ESP_LITTLEFS_OP_FSTAT,
+    ESP_LITTLEFS_OP_STAT,
+    ESP_LITTLEFS_OP_UNLINK,
+    ESP_LITTLEFS_OP_RENAME,
+    ESP_LITTLEFS_OP_OPENDIR,
+    ESP_LITTLEFS_OP_READDIR,
+    ESP_LITTLEFS_OP_SEEKDIR,
+    ESP_LITTLEFS_OP_CLOSEDIR,
+    ESP_LITTLEFS_OP_MKDIR,
+    ESP_LITTLEFS_OP_RMDIR,
+    ESP_LITTLEFS_OP_TELLDIR,
+    ESP_LITTLEFS_OP_UTIME,
+    ESP_LITTLEFS_OP_MAX
+} esp_littlefs_op_t;
+
+#define ESP_LITTLEFS_TRACE_MAGIC   0x5254464c /**< "LFTR" */
+#define ESP_LITTLEFS_TRACE_VERSION 1
+
+/**
+ * Kind of a trace record.
+ */
+typedef enum {
+    ESP_LITTLEFS_TRACE_VFS,   /**< A VFS call */
+    ESP_LITTLEFS_TRACE_READ,  /**< A block-device read */
+    ESP_LITTLEFS_TRACE_PROG,  /**< A block-device program */
+    ESP_LITTLEFS_TRACE_ERASE, /**< A block erase */
+} esp_littlefs_trace_type_t;
+
+/**
+ * Start of a trace stream; the records follow it.
+ *
+ * The geometry and cache sizes are those of the traced mount, as a
+ * baseline for replaying with a different configuration.
+ */
+typedef struct {
+    uint32_t magic;           /**< ESP_LITTLEFS_TRACE_MAGIC */
+    uint16_t version;         /**< ESP_LITTLEFS_TRACE_VERSION */
+    uint16_t rec_size;        /**< sizeof(esp_littlefs_trace_rec_t) */
+    uint32_t read_size;
+    uint32_t prog_size;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t cache_size;
+    uint32_t lookahead_size;
+    int32_t  block_cycles;
+    uint32_t dropped;         /**< Records overwritten before they were read */
+} esp_littlefs_trace_hdr_t;
+
+/**
+ * One traced call.
+ *
+ * | type  | arg0                 | arg1                         | arg2             |
+ * |-------|----------------------|------------------------------|------------------|
+ * | READ  | block                | offset                       | size             |
+ * | PROG  | block                | offset                       | size             |
+ * | ERASE | block                | 0                            | block size       |
+ * | VFS   | fd, or hash of path  | size, lfs open flags, offset | return value     |
+ *
+ * VFS calls on a path (open, stat, unlink, rename, opendir, mkdir, rmdir, utime)
+ * carry the DJB2 hash of the path relative to the mount point; rename puts
+ * the destination's hash in arg1. Directory handle calls carry 0.
+ */
+typedef struct {
+    uint32_t time;            /**< Start, esp_timer microseconds (low 32 bits) */
+    uint8_t  type;            /**< esp_littlefs_trace_type_t */
+    uint8_t  op;              /**< esp_littlefs_op_t of VFS records */
+    uint16_t reserved;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint32_t arg2;
+    uint32_t duration;        /**< Microseconds */
+} esp_littlefs_trace_rec_t;
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -31,12 +31,15 @@
 
 static const char TAG[] = "esp_littlefs";
 
-#define CONFIG_LITTLEFS_BLOCK_SIZE 4096 /* ESP32 can only operate at 4kb */
-
 /* File Descriptor Caching Params */
 #define CONFIG_LITTLEFS_FD_CACHE_REALLOC_FACTOR 2  /* Amount to resize FD cache by */
 #define CONFIG_LITTLEFS_FD_CACHE_MIN_SIZE 4  /* Minimum size of FD cache */
 #define CONFIG_LITTLEFS_FD_CACHE_HYST 4  /* When shrinking, leave this many trailing FD slots available */
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+#define CONFIG_LITTLEFS_FD_CACHE_INIT_SIZE CONFIG_LITTLEFS_STATIC_MAX_FILES  /* Static FD caches can't grow */
+#else
+#define CONFIG_LITTLEFS_FD_CACHE_INIT_SIZE CONFIG_LITTLEFS_FD_CACHE_MIN_SIZE  /* Initial size of FD cache; resized on demand */
+#endif
 
 /**
  * @brief littlefs DIR structure
@@ -46,9 +49,35 @@ typedef struct {
     lfs_dir_t d;        /*!< littlefs DIR struct */
     struct dirent e;    /*!< Last open dirent */
     long offset;        /*!< Offset of the current dirent */
-    char *path;         /*!< Requested directory name */
+    char *path;         /*!< Requested directory name; stored after the struct */
+#if CONFIG_LITTLEFS_INTROSPECT
+    bool virt;          /*!< Lists ESP_LITTLEFS_VDIR; d is unused */
+#endif
 } vfs_littlefs_dir_t;
 
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+#ifdef CONFIG_LITTLEFS_USE_ONLY_HASH
+#define ESP_LITTLEFS_FD_PATH_LEN 0
+#else
+#define ESP_LITTLEFS_FD_PATH_LEN CONFIG_LITTLEFS_OBJ_NAME_LEN
+#endif
+ESP_LITTLEFS_POOL_DEFINE(fd_pool, sizeof(vfs_littlefs_file_t) + ESP_LITTLEFS_FD_PATH_LEN,
+        CONFIG_LITTLEFS_STATIC_MAX_FILES);
+ESP_LITTLEFS_POOL_DEFINE(shared_pool, sizeof(vfs_littlefs_shared_t),
+        CONFIG_LITTLEFS_STATIC_MAX_FILES);
+ESP_LITTLEFS_POOL_DEFINE(dir_pool, sizeof(vfs_littlefs_dir_t) + CONFIG_LITTLEFS_OBJ_NAME_LEN,
+        CONFIG_LITTLEFS_STATIC_MAX_DIRS);
+ESP_LITTLEFS_POOL_DEFINE(fd_cache_pool, CONFIG_LITTLEFS_FD_CACHE_INIT_SIZE * sizeof(vfs_littlefs_file_t *),
+        CONFIG_LITTLEFS_MAX_PARTITIONS);
+
+/* Objects the hot path needs come from the pools above, never the heap */
+#define esp_littlefs_obj_alloc(pool, size) esp_littlefs_pool_alloc(&pool, size)
+#define esp_littlefs_obj_free(pool, p)     esp_littlefs_pool_free(&pool, p)
+#else
+#define esp_littlefs_obj_alloc(pool, size) low_calloc(1, size)
+#define esp_littlefs_obj_free(pool, p)     free(p)
+#endif
+
 static int     vfs_littlefs_open(void* ctx, const char * path, int flags, int mode);
 static ssize_t vfs_littlefs_write(void* ctx, int fd, const void * data, size_t size);
 static ssize_t vfs_littlefs_read(void* ctx, int fd, void * dst, size_t size);
@@ -69,14 +98,23 @@ static int     vfs_littlefs_rmdir(void* ctx, const char* name);
 static int     vfs_littlefs_fsync(void* ctx, int fd);
 
 static esp_err_t esp_littlefs_init(const esp_vfs_littlefs_conf_t* conf);
+static esp_err_t esp_littlefs_mount_readers(esp_littlefs_t *efs);
 static esp_err_t esp_littlefs_by_label(const char* label, int * index);
 static esp_err_t esp_littlefs_get_empty(int *index);
 static void      esp_littlefs_free(esp_littlefs_t ** efs);
 static void      esp_littlefs_dir_free(vfs_littlefs_dir_t *dir);
+static void      esp_littlefs_snapshot_free(esp_littlefs_snapshot_t *snap);
+static int       esp_littlefs_snapshot_pin(void *data, lfs_block_t block);
 static int       esp_littlefs_flags_conv(int m);
+static uint32_t  compute_hash(const char * path);
+static esp_err_t esp_littlefs_cfg_alloc_buffers(struct lfs_config *cfg);
+static void      esp_littlefs_cfg_free_buffers(struct lfs_config *cfg);
+static bool      esp_littlefs_try_take(SemaphoreHandle_t lock, bool *taken);
+static int       esp_littlefs_map_blocks(esp_littlefs_t *efs, uint8_t *bitmap,
+                                         const esp_littlefs_block_map_cb_t *cb, esp_littlefs_block_map_t *map);
 #if CONFIG_LITTLEFS_USE_MTIME
 static int       vfs_littlefs_utime(void *ctx, const char *path, const struct utimbuf *times);
-static void      vfs_littlefs_update_mtime(esp_littlefs_t *efs, const char *path);
+static int       vfs_littlefs_update_mtime(esp_littlefs_t *efs, const char *path);
 static int       vfs_littlefs_update_mtime_value(esp_littlefs_t *efs, const char *path, time_t t);
 static time_t    vfs_littlefs_get_mtime(esp_littlefs_t *efs, const char *path);
 #endif
@@ -89,6 +127,112 @@ static int     vfs_littlefs_fstat(void* ctx, int fd, struct stat * st);
 
 static int sem_take(esp_littlefs_t *efs);
 static int sem_give(esp_littlefs_t *efs);
+static bool esp_littlefs_take(esp_littlefs_t *efs, SemaphoreHandle_t lock);
+static vfs_littlefs_file_t * esp_littlefs_get_file(esp_littlefs_t *efs, int fd);
+#if CONFIG_LITTLEFS_INTROSPECT
+static const char * esp_littlefs_vpath(const char *path);
+static int       esp_littlefs_vfile_open(esp_littlefs_t *efs, const char *path, const char *name, int flags);
+#endif
+static void      esp_littlefs_fs_take(esp_littlefs_t *efs, vfs_littlefs_file_t *file);
+static void      esp_littlefs_fs_give(esp_littlefs_t *efs, vfs_littlefs_file_t *file);
+
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+static void esp_littlefs_prof_op(esp_littlefs_t *efs, uint8_t op, uint32_t key);
+static void esp_littlefs_prof_acquired(esp_littlefs_t *efs, int64_t t0, bool contended);
+static void esp_littlefs_prof_released(esp_littlefs_t *efs);
+static void esp_littlefs_prof_end(esp_littlefs_t *efs);
+#define ESP_LITTLEFS_PROF_OP(efs, op, key) esp_littlefs_prof_op(efs, ESP_LITTLEFS_OP_##op, key)
+#define ESP_LITTLEFS_PROF_END(efs)         esp_littlefs_prof_end(efs)
+#else
+#define ESP_LITTLEFS_PROF_OP(efs, op, key) ((void)0)
+#define ESP_LITTLEFS_PROF_END(efs)         ((void)0)
+#endif
+
+#if CONFIG_LITTLEFS_STATS
+static esp_littlefs_err_t esp_littlefs_stats_err(int lfs_err);
+#define ESP_LITTLEFS_STATS_OP(efs, op)     ESP_LITTLEFS_STATS_ADD(efs, ops[ESP_LITTLEFS_OP_##op], 1)
+#define ESP_LITTLEFS_STATS_ERROR(efs, err) ESP_LITTLEFS_STATS_ADD(efs, errors[esp_littlefs_stats_err(err)], 1)
+#else
+#define ESP_LITTLEFS_STATS_OP(efs, op)     ((void)0)
+#define ESP_LITTLEFS_STATS_ERROR(efs, err) ((void)0)
+#endif
+
+#if CONFIG_LITTLEFS_LATENCY || CONFIG_LITTLEFS_TRACE || CONFIG_LITTLEFS_LOCK_PROFILE || CONFIG_LITTLEFS_TASK_IO
+/* Hooks are timed and traced end to end by these wrappers, so nested
+ * calls (readdir -> readdir_r) are only counted once. arg0 and arg1 are
+ * only evaluated while the mount is being traced. On return, locks the
+ * task takes are no longer charged to the call.
+ *
+ * A task over its I/O budget is held back here, before the hook takes any
+ * lock; this is the only place it is. */
+#define ESP_LITTLEFS_TIMED_HOOK(op, ret, hook, params, args, arg0, arg1)                 \
+    static ret hook##_timed params {                                                     \
+        int64_t t0 = ESP_LITTLEFS_LAT_NOW();                                             \
+        ESP_LITTLEFS_IO_OP((esp_littlefs_t *)ctx);                                       \
+        ret res = hook args;                                                             \
+        ESP_LITTLEFS_PROF_END((esp_littlefs_t *)ctx);                                    \
+        ESP_LITTLEFS_LAT_RECORD((esp_littlefs_t *)ctx, ESP_LITTLEFS_OP_##op, t0);        \
+        ESP_LITTLEFS_TRACE((esp_littlefs_t *)ctx, ESP_LITTLEFS_TRACE_VFS,                \
+                ESP_LITTLEFS_OP_##op, t0, arg0, arg1, (uint32_t)(intptr_t)res);          \
+        return res;                                                                      \
+    }
+
+ESP_LITTLEFS_TIMED_HOOK(OPEN, int, vfs_littlefs_open, (void* ctx, const char * path, int flags, int mode),
+        (ctx, path, flags, mode), compute_hash(path), esp_littlefs_flags_conv(flags))
+ESP_LITTLEFS_TIMED_HOOK(WRITE, ssize_t, vfs_littlefs_write, (void* ctx, int fd, const void * data, size_t size),
+        (ctx, fd, data, size), fd, size)
+ESP_LITTLEFS_TIMED_HOOK(READ, ssize_t, vfs_littlefs_read, (void* ctx, int fd, void * dst, size_t size),
+        (ctx, fd, dst, size), fd, size)
+ESP_LITTLEFS_TIMED_HOOK(CLOSE, int, vfs_littlefs_close, (void* ctx, int fd),
+        (ctx, fd), fd, 0)
+ESP_LITTLEFS_TIMED_HOOK(LSEEK, off_t, vfs_littlefs_lseek, (void* ctx, int fd, off_t offset, int mode),
+        (ctx, fd, offset, mode), fd, offset)
+ESP_LITTLEFS_TIMED_HOOK(FSYNC, int, vfs_littlefs_fsync, (void* ctx, int fd),
+        (ctx, fd), fd, 0)
+#ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
+ESP_LITTLEFS_TIMED_HOOK(FSTAT, int, vfs_littlefs_fstat, (void* ctx, int fd, struct stat * st),
+        (ctx, fd, st), fd, 0)
+#endif
+ESP_LITTLEFS_TIMED_HOOK(STAT, int, vfs_littlefs_stat, (void* ctx, const char * path, struct stat * st),
+        (ctx, path, st), compute_hash(path), 0)
+ESP_LITTLEFS_TIMED_HOOK(UNLINK, int, vfs_littlefs_unlink, (void* ctx, const char *path),
+        (ctx, path), compute_hash(path), 0)
+ESP_LITTLEFS_TIMED_HOOK(RENAME, int, vfs_littlefs_rename, (void* ctx, const char *src, const char *dst),
+        (ctx, src, dst), compute_hash(src), compute_hash(dst))
+ESP_LITTLEFS_TIMED_HOOK(OPENDIR, DIR*, vfs_littlefs_opendir, (void* ctx, const char* name),
+        (ctx, name), compute_hash(name), 0)
+ESP_LITTLEFS_TIMED_HOOK(CLOSEDIR, int, vfs_littlefs_closedir, (void* ctx, DIR* pdir),
+        (ctx, pdir), 0, 0)
+ESP_LITTLEFS_TIMED_HOOK(READDIR, struct dirent*, vfs_littlefs_readdir, (void* ctx, DIR* pdir),
+        (ctx, pdir), 0, 0)
+ESP_LITTLEFS_TIMED_HOOK(READDIR, int, vfs_littlefs_readdir_r,
+        (void* ctx, DIR* pdir, struct dirent* entry, struct dirent** out_dirent),
+        (ctx, pdir, entry, out_dirent), 0, 0)
+ESP_LITTLEFS_TIMED_HOOK(MKDIR, int, vfs_littlefs_mkdir, (void* ctx, const char* name, mode_t mode),
+        (ctx, name, mode), compute_hash(name), 0)
+ESP_LITTLEFS_TIMED_HOOK(RMDIR, int, vfs_littlefs_rmdir, (void* ctx, const char* name),
+        (ctx, name), compute_hash(name), 0)
+ESP_LITTLEFS_TIMED_HOOK(TELLDIR, long, vfs_littlefs_telldir, (void* ctx, DIR* pdir),
+        (ctx, pdir), 0, 0)
+#if CONFIG_LITTLEFS_USE_MTIME
+ESP_LITTLEFS_TIMED_HOOK(UTIME, int, vfs_littlefs_utime, (void *ctx, const char *path, const struct utimbuf *times),
+        (ctx, path, times), compute_hash(path), 0)
+#endif
+
+static void vfs_littlefs_seekdir_timed(void* ctx, DIR* pdir, long offset) {
+    int64_t t0 = ESP_LITTLEFS_LAT_NOW();
+    ESP_LITTLEFS_IO_OP((esp_littlefs_t *)ctx);
+    vfs_littlefs_seekdir(ctx, pdir, offset);
+    ESP_LITTLEFS_PROF_END((esp_littlefs_t *)ctx);
+    ESP_LITTLEFS_LAT_RECORD((esp_littlefs_t *)ctx, ESP_LITTLEFS_OP_SEEKDIR, t0);
+    ESP_LITTLEFS_TRACE((esp_littlefs_t *)ctx, ESP_LITTLEFS_TRACE_VFS,
+            ESP_LITTLEFS_OP_SEEKDIR, t0, 0, offset, 0);
+}
+
+#define ESP_LITTLEFS_HOOK(hook) &hook##_timed
+#else
+#define ESP_LITTLEFS_HOOK(hook) &hook
+#endif
 
 static SemaphoreHandle_t _efs_lock = NULL;
 static esp_littlefs_t * _efs[CONFIG_LITTLEFS_MAX_PARTITIONS] = { 0 };
@@ -103,10 +247,21 @@ void esp_littlefs_free_fds(esp_littlefs_t * efs) {
     /* Need to free all files that were opened */
     while (efs->file) {
         vfs_littlefs_file_t * next = efs->file->next;
-        free(efs->file);
+        vfs_littlefs_shared_t * sh = efs->file->shared;
+        if (sh && --sh->refs == 0) {
+            vSemaphoreDelete(sh->lock);
+            esp_littlefs_mem_free(sh->buf);
+            esp_littlefs_mem_free(sh->fcfg.buffer);
+            esp_littlefs_obj_free(shared_pool, sh);
+        }
+#if CONFIG_LITTLEFS_INTROSPECT
+        free(efs->file->vbuf);
+#endif
+        vSemaphoreDelete(efs->file->drained);
+        esp_littlefs_obj_free(fd_pool, efs->file);
         efs->file = next;
     }
-    free(efs->cache); 
+    esp_littlefs_obj_free(fd_cache_pool, efs->cache);
     efs->cache = 0;
     efs->cache_size = efs->fd_count = 0;
 }
@@ -142,36 +297,89 @@ esp_err_t esp_littlefs_info(const char* partition_label, size_t *total_bytes, si
     return ESP_OK;
 }
 
+esp_err_t esp_littlefs_mount_timing(const char* partition_label, esp_littlefs_mount_timing_t *timing) {
+    int index;
+
+    assert(timing);
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    *timing = _efs[index]->timing;
+    return ESP_OK;
+}
+
+esp_err_t esp_littlefs_block_map(const char* partition_label, const esp_littlefs_block_map_cb_t *cb,
+        esp_littlefs_block_map_t *map) {
+    int index, res;
+    esp_littlefs_t *efs;
+    uint8_t *bitmap;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    efs = _efs[index];
+
+    bitmap = low_calloc(1, (efs->cfg.block_count + 3) / 4);
+    if(bitmap == NULL) return ESP_ERR_NO_MEM;
+
+    sem_take(efs);
+    res = esp_littlefs_map_blocks(efs, bitmap, cb, map);
+    sem_give(efs);
+    free(bitmap);
+
+    if(res < 0) {
+        ESP_LOGE(TAG, "Failed to map blocks. Error %s (%d)", esp_littlefs_errno(res), res);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_littlefs_block_bitmap(const char* partition_label, uint8_t *bitmap, size_t size) {
+    int index, res;
+    esp_littlefs_t *efs;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    efs = _efs[index];
+    if(size < (efs->cfg.block_count + 3) / 4) return ESP_ERR_INVALID_SIZE;
+
+    memset(bitmap, 0, size);
+    sem_take(efs);
+    res = esp_littlefs_map_blocks(efs, bitmap, NULL, NULL);
+    sem_give(efs);
+
+    if(res < 0) {
+        ESP_LOGE(TAG, "Failed to map blocks. Error %s (%d)", esp_littlefs_errno(res), res);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
 esp_err_t esp_vfs_littlefs_register(const esp_vfs_littlefs_conf_t * conf)
 {
     assert(conf->base_path);
     const esp_vfs_t vfs = {
         .flags       = ESP_VFS_FLAG_CONTEXT_PTR,
-        .write_p     = &vfs_littlefs_write,
-        .lseek_p     = &vfs_littlefs_lseek,
-        .read_p      = &vfs_littlefs_read,
-        .open_p      = &vfs_littlefs_open,
-        .close_p     = &vfs_littlefs_close,
+        .write_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_write),
+        .lseek_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_lseek),
+        .read_p      = ESP_LITTLEFS_HOOK(vfs_littlefs_read),
+        .open_p      = ESP_LITTLEFS_HOOK(vfs_littlefs_open),
+        .close_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_close),
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
-        .fstat_p     = &vfs_littlefs_fstat,
+        .fstat_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_fstat),
 #else
         .fstat_p     = NULL, /* Not supported */
 #endif
-        .stat_p      = &vfs_littlefs_stat,
+        .stat_p      = ESP_LITTLEFS_HOOK(vfs_littlefs_stat),
         .link_p      = NULL, /* Not Supported */
-        .unlink_p    = &vfs_littlefs_unlink,
-        .rename_p    = &vfs_littlefs_rename,
-        .opendir_p   = &vfs_littlefs_opendir,
-        .closedir_p  = &vfs_littlefs_closedir,
-        .readdir_p   = &vfs_littlefs_readdir,
-        .readdir_r_p = &vfs_littlefs_readdir_r,
-        .seekdir_p   = &vfs_littlefs_seekdir,
-        .telldir_p   = &vfs_littlefs_telldir,
-        .mkdir_p     = &vfs_littlefs_mkdir,
-        .rmdir_p     = &vfs_littlefs_rmdir,
-        .fsync_p     = &vfs_littlefs_fsync,
+        .unlink_p    = ESP_LITTLEFS_HOOK(vfs_littlefs_unlink),
+        .rename_p    = ESP_LITTLEFS_HOOK(vfs_littlefs_rename),
+        .opendir_p   = ESP_LITTLEFS_HOOK(vfs_littlefs_opendir),
+        .closedir_p  = ESP_LITTLEFS_HOOK(vfs_littlefs_closedir),
+        .readdir_p   = ESP_LITTLEFS_HOOK(vfs_littlefs_readdir),
+        .readdir_r_p = ESP_LITTLEFS_HOOK(vfs_littlefs_readdir_r),
+        .seekdir_p   = ESP_LITTLEFS_HOOK(vfs_littlefs_seekdir),
+        .telldir_p   = ESP_LITTLEFS_HOOK(vfs_littlefs_telldir),
+        .mkdir_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_mkdir),
+        .rmdir_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_rmdir),
+        .fsync_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_fsync),
 #if CONFIG_LITTLEFS_USE_MTIME
-        .utime_p     = &vfs_littlefs_utime,
+        .utime_p     = ESP_LITTLEFS_HOOK(vfs_littlefs_utime),
 #else
         .utime_p     = NULL,
 #endif // CONFIG_LITTLEFS_USE_MTIME
@@ -258,6 +466,18 @@ esp_err_t esp_littlefs_format(bool internal_version) {
     efs = _efs[index];
     assert( efs );
 
+    if(efs->snapshot) {
+        ESP_LOGE(TAG, "Cannot format while a snapshot is held.");
+        err = ESP_ERR_INVALID_STATE;
+        goto exit;
+    }
+
+    if(efs->read_only) {
+        ESP_LOGE(TAG, "Cannot format a read-only mount.");
+        err = ESP_ERR_INVALID_STATE;
+        goto exit;
+    }
+
     /* Unmount if mounted */
     if(efs->cache_size > 0){
         int res;
@@ -274,14 +494,24 @@ esp_err_t esp_littlefs_format(bool internal_version) {
     /* Erase and Format */
     {
         int res;
+        int64_t t0 = esp_timer_get_time();
         ESP_LOGD(TAG, "Formatting filesystem");
 #ifndef CONFIG_NEONIOUS_ONE
         if(internal_version)
             spi_flash_erase_range(gFSPos, g_rom_flashchip.chip_size - gFSPos);
         else
+#endif
+        {
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+            /* Nothing queued may land after the erase */
+            esp_littlefs_xfer_drain(efs->xfer);
 #endif
             data_spiflash_erase(CONFIG_CLIENT_SIZE_DATA_OFFSET, gSPIFlashSize - CONFIG_CLIENT_SIZE_DATA_OFFSET);
+        }
+        int64_t t1 = esp_timer_get_time();
         res = lfs_format(efs->fs, &efs->cfg);
+        efs->timing.erase_us = t1 - t0;
+        efs->timing.format_us = esp_timer_get_time() - t1;
         if( res != LFS_ERR_OK ) {
             ESP_LOGE(TAG, "Failed to format filesystem");
             return ESP_FAIL;
@@ -298,8 +528,8 @@ esp_err_t esp_littlefs_format(bool internal_version) {
             ESP_LOGE(TAG, "Failed to re-mount filesystem");
             return ESP_FAIL;
         }
-        efs->cache_size = CONFIG_LITTLEFS_FD_CACHE_MIN_SIZE;  // Initial size of cache; will resize ondemand
-        efs->cache = low_calloc(sizeof(*efs->cache), efs->cache_size);
+        efs->cache_size = CONFIG_LITTLEFS_FD_CACHE_INIT_SIZE;
+        efs->cache = esp_littlefs_obj_alloc(fd_cache_pool, efs->cache_size * sizeof(*efs->cache));
     }
     ESP_LOGD(TAG, "Format Success!");
     
@@ -340,6 +570,440 @@ const char * esp_littlefs_errno(enum lfs_error lfs_errno) {
 #define esp_littlefs_errno(x) ""
 #endif
 
+esp_err_t esp_littlefs_snapshot_take(const char* partition_label, esp_littlefs_snapshot_t ** snapshot) {
+    int index;
+    int res;
+    esp_err_t err;
+    esp_littlefs_t *efs = NULL;
+    esp_littlefs_snapshot_t *snap = NULL;
+
+    assert(snapshot);
+    err = esp_littlefs_by_label(partition_label, &index);
+    if(err != ESP_OK) return ESP_ERR_INVALID_STATE;
+    efs = _efs[index];
+    if(efs->cache_size == 0) return ESP_ERR_INVALID_STATE;
+
+    snap = low_calloc(1, sizeof(esp_littlefs_snapshot_t));
+    if(snap == NULL) {
+        ESP_LOGE(TAG, "snapshot could not be malloced");
+        return ESP_ERR_NO_MEM;
+    }
+    snap->efs = efs;
+    snap->pinned = low_calloc((efs->cfg.block_count + 31) / 32, sizeof(*snap->pinned));
+    snap->watermark = low_calloc(efs->cfg.block_count, sizeof(*snap->watermark));
+    if(snap->pinned == NULL || snap->watermark == NULL) {
+        ESP_LOGE(TAG, "snapshot block tables could not be malloced");
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    for(lfs_block_t i=0; i < efs->cfg.block_count; i++) {
+        snap->watermark[i] = efs->cfg.block_size;
+    }
+
+    /* Same geometry, but reads go through the pinned view and
+     * this instance has caches of its own. */
+    snap->cfg = efs->cfg;
+    snap->cfg.context = snap;
+    snap->cfg.read  = littlefs_api_snapshot_read;
+    snap->cfg.prog  = littlefs_api_snapshot_prog;
+    snap->cfg.erase = littlefs_api_snapshot_erase;
+    snap->cfg.sync  = littlefs_api_sync;
+    err = esp_littlefs_cfg_alloc_buffers(&snap->cfg);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "snapshot buffers could not be allocated");
+        goto exit;
+    }
+
+    sem_take(efs);
+    if(efs->snapshot) {
+        sem_give(efs);
+        ESP_LOGE(TAG, "A snapshot of \"%s\" already exists.", partition_label);
+        err = ESP_ERR_INVALID_STATE;
+        goto exit;
+    }
+    /* Pinning only works if the allocator calls back into us; a read-only
+     * mount never allocates */
+    if(!efs->read_only) {
+        err = littlefs_api_check_lookahead(efs);
+        if(err != ESP_OK) {
+            sem_give(efs);
+            ESP_LOGE(TAG, "littlefs doesn't call the allocator hook; blocks can't be pinned");
+            goto exit;
+        }
+    }
+    res = lfs_fs_traverse(efs->fs, esp_littlefs_snapshot_pin, snap);
+    if(res < 0) {
+        sem_give(efs);
+        ESP_LOGE(TAG, "Failed to traverse filesystem. Error %s (%d)",
+                esp_littlefs_errno(res), res);
+        err = ESP_FAIL;
+        goto exit;
+    }
+    efs->snapshot = snap;
+    /* The allocator may already have counted some of them free */
+    littlefs_api_snapshot_mask(snap, efs->fs);
+    res = lfs_mount(&snap->fs, &snap->cfg);
+    if(res < 0) {
+        efs->snapshot = NULL;
+        sem_give(efs);
+        ESP_LOGE(TAG, "Failed to mount snapshot. Error %s (%d)",
+                esp_littlefs_errno(res), res);
+        err = ESP_FAIL;
+        goto exit;
+    }
+    sem_give(efs);
+
+    *snapshot = snap;
+    return ESP_OK;
+
+exit:
+    esp_littlefs_snapshot_free(snap);
+    return err;
+}
+
+esp_err_t esp_littlefs_snapshot_release(esp_littlefs_snapshot_t * snapshot) {
+    if(snapshot == NULL) return ESP_ERR_INVALID_ARG;
+    esp_littlefs_t *efs = snapshot->efs;
+
+    sem_take(efs);
+    lfs_unmount(&snapshot->fs);
+    efs->snapshot = NULL;
+    sem_give(efs);
+
+    esp_littlefs_snapshot_free(snapshot);
+    return ESP_OK;
+}
+
+int esp_littlefs_snapshot_stat(esp_littlefs_snapshot_t * snapshot, const char * path, struct lfs_info * info) {
+    int res;
+    sem_take(snapshot->efs);
+    res = lfs_stat(&snapshot->fs, path, info);
+    sem_give(snapshot->efs);
+    return res;
+}
+
+int esp_littlefs_snapshot_dir_open(esp_littlefs_snapshot_t * snapshot, lfs_dir_t * dir, const char * path) {
+    int res;
+    sem_take(snapshot->efs);
+    res = lfs_dir_open(&snapshot->fs, dir, path);
+    sem_give(snapshot->efs);
+    return res;
+}
+
+int esp_littlefs_snapshot_dir_read(esp_littlefs_snapshot_t * snapshot, lfs_dir_t * dir, struct lfs_info * info) {
+    int res;
+    sem_take(snapshot->efs);
+    res = lfs_dir_read(&snapshot->fs, dir, info);
+    sem_give(snapshot->efs);
+    return res;
+}
+
+int esp_littlefs_snapshot_dir_close(esp_littlefs_snapshot_t * snapshot, lfs_dir_t * dir) {
+    int res;
+    sem_take(snapshot->efs);
+    res = lfs_dir_close(&snapshot->fs, dir);
+    sem_give(snapshot->efs);
+    return res;
+}
+
+int esp_littlefs_snapshot_file_open(esp_littlefs_snapshot_t * snapshot, lfs_file_t * file, const char * path) {
+    int res;
+    sem_take(snapshot->efs);
+    res = lfs_file_open(&snapshot->fs, file, path, LFS_O_RDONLY);
+    sem_give(snapshot->efs);
+    return res;
+}
+
+lfs_ssize_t esp_littlefs_snapshot_file_read(esp_littlefs_snapshot_t * snapshot, lfs_file_t * file, void * buffer, lfs_size_t size) {
+    lfs_ssize_t res;
+    sem_take(snapshot->efs);
+    res = lfs_file_read(&snapshot->fs, file, buffer, size);
+    sem_give(snapshot->efs);
+    return res;
+}
+
+int esp_littlefs_snapshot_file_close(esp_littlefs_snapshot_t * snapshot, lfs_file_t * file) {
+    int res;
+    sem_take(snapshot->efs);
+    res = lfs_file_close(&snapshot->fs, file);
+    sem_give(snapshot->efs);
+    return res;
+}
+
+size_t esp_littlefs_mem_reclaim(size_t bytes) {
+    size_t freed = 0;
+    bool efs_taken;
+
+    /* Called from esp_littlefs_mem_alloc() when over budget or out of heap,
+     * which may already hold some of these locks, and from the application's
+     * heap-pressure handlers, which must not block */
+    if(_efs_lock == NULL || !esp_littlefs_try_take(_efs_lock, &efs_taken)) return 0;
+
+    for(int i=0; i < CONFIG_LITTLEFS_MAX_PARTITIONS && freed < bytes; i++) {
+        esp_littlefs_t *efs = _efs[i];
+        bool taken;
+
+        if(efs == NULL || efs->lock == NULL || !esp_littlefs_try_take(efs->lock, &taken)) continue;
+        for(vfs_littlefs_file_t *f = efs->file; f != NULL && freed < bytes; f = f->next) {
+            vfs_littlefs_shared_t *sh = f->shared;
+            if(sh == NULL || xSemaphoreTake(sh->lock, 0) != pdTRUE) continue;
+            if(sh->buf) {
+                esp_littlefs_mem_free(sh->buf);
+                sh->buf = NULL;
+                sh->buf_len = 0;
+                freed += CONFIG_LITTLEFS_FILE_BUF_SIZE;
+            }
+            xSemaphoreGive(sh->lock);
+        }
+        if(taken) xSemaphoreGive(efs->lock);
+    }
+
+    if(efs_taken) xSemaphoreGive(_efs_lock);
+    return freed;
+}
+
+esp_err_t esp_littlefs_stats(const char* partition_label, esp_littlefs_stats_t *stats) {
+#if CONFIG_LITTLEFS_STATS
+    int index;
+    esp_littlefs_t *efs;
+
+    assert(stats);
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    efs = _efs[index];
+
+    memset(stats, 0, sizeof(*stats));
+    for(int core=0; core < portNUM_PROCESSORS; core++) {
+        const esp_littlefs_stats_t *c = &efs->stats[core];
+        for(int i=0; i < ESP_LITTLEFS_OP_MAX; i++) stats->ops[i] += c->ops[i];
+        for(int i=0; i < ESP_LITTLEFS_ERR_MAX; i++) stats->errors[i] += c->errors[i];
+        stats->read_bytes += c->read_bytes;
+        stats->write_bytes += c->write_bytes;
+        stats->flash_reads += c->flash_reads;
+        stats->flash_progs += c->flash_progs;
+        stats->flash_erases += c->flash_erases;
+        stats->flash_read_bytes += c->flash_read_bytes;
+        stats->flash_prog_bytes += c->flash_prog_bytes;
+        stats->flash_erase_bytes += c->flash_erase_bytes;
+        stats->cache_hits += c->cache_hits;
+        stats->cache_misses += c->cache_misses;
+    }
+    stats->mount_us = efs->timing.total_us;
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_latency(const char* partition_label, int which, esp_littlefs_latency_t *latency) {
+#if CONFIG_LITTLEFS_LATENCY
+    const uint8_t pct[3] = {50, 90, 99};
+    uint32_t *out[3] = {&latency->p50, &latency->p90, &latency->p99};
+    int index;
+    esp_littlefs_t *efs;
+
+    assert(latency);
+    if(which < 0 || which >= ESP_LITTLEFS_LAT_MAX) return ESP_ERR_INVALID_ARG;
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    efs = _efs[index];
+
+    memset(latency, 0, sizeof(*latency));
+    for(int core=0; core < portNUM_PROCESSORS; core++) {
+        const esp_littlefs_hist_t *h = &efs->lat[core][which];
+        for(int b=0; b < ESP_LITTLEFS_LAT_BUCKETS; b++) {
+            latency->buckets[b] += h->buckets[b];
+            latency->count += h->buckets[b];
+        }
+        latency->max = MAX(latency->max, h->max);
+    }
+
+    for(int i=0; i < 3; i++) {
+        /* Smallest bucket that covers pct[i] percent of the samples */
+        uint64_t rank = ((uint64_t)latency->count * pct[i] + 99) / 100;
+        uint32_t seen = 0;
+        for(int b=0; b < ESP_LITTLEFS_LAT_BUCKETS && rank > 0; b++) {
+            seen += latency->buckets[b];
+            if(seen >= rank) {
+                uint32_t bound = b == 0 ? 0 : (1u << b) - 1;
+                *out[i] = b == ESP_LITTLEFS_LAT_BUCKETS - 1 ? latency->max : MIN(bound, latency->max);
+                break;
+            }
+        }
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_latency_reset(const char* partition_label) {
+#if CONFIG_LITTLEFS_LATENCY
+    int index;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    memset(_efs[index]->lat, 0, sizeof(_efs[index]->lat));
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_trace_start(const char* partition_label) {
+#if CONFIG_LITTLEFS_TRACE
+    int index;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    esp_littlefs_trace_begin(_efs[index]);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_lock_profile(const char* partition_label, esp_littlefs_lock_profile_t *profile) {
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+    int index;
+    esp_littlefs_lock_prof_t *prof;
+
+    assert(profile);
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    prof = &_efs[index]->prof;
+
+    memset(profile, 0, sizeof(*profile));
+    portENTER_CRITICAL(&prof->mux);
+    memcpy(profile->wait_us, prof->op_wait_us, sizeof(profile->wait_us));
+    memcpy(profile->hold_us, prof->op_hold_us, sizeof(profile->hold_us));
+    memcpy(profile->worst, prof->worst, sizeof(profile->worst));
+    profile->untracked = prof->untracked;
+    profile->task_count = prof->task_count;
+    for(int i=0; i < prof->task_count; i++) profile->tasks[i] = prof->tasks[i].stats;
+    portEXIT_CRITICAL(&prof->mux);
+
+    /* Top contenders first */
+    for(int i=1; i < profile->task_count; i++) {
+        esp_littlefs_lock_task_t t = profile->tasks[i];
+        int j = i;
+        for(; j > 0 && profile->tasks[j - 1].wait_us < t.wait_us; j--)
+            profile->tasks[j] = profile->tasks[j - 1];
+        profile->tasks[j] = t;
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_lock_profile_reset(const char* partition_label) {
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+    int index;
+    esp_littlefs_t *efs;
+    esp_littlefs_lock_prof_t *prof;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    efs = _efs[index];
+    prof = &efs->prof;
+
+    /* Not sem_take(); the reset itself shouldn't be profiled */
+    xSemaphoreTake(efs->lock, portMAX_DELAY);
+    portENTER_CRITICAL(&prof->mux);
+    memset(prof->tasks, 0, sizeof(prof->tasks));
+    memset(prof->op_wait_us, 0, sizeof(prof->op_wait_us));
+    memset(prof->op_hold_us, 0, sizeof(prof->op_hold_us));
+    memset(prof->worst, 0, sizeof(prof->worst));
+    prof->task_count = 0;
+    prof->untracked = 0;
+    portEXIT_CRITICAL(&prof->mux);
+    xSemaphoreGive(efs->lock);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_amp(const char* partition_label, esp_littlefs_amp_t *amp) {
+#if CONFIG_LITTLEFS_AMP
+    int index;
+
+    assert(amp);
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    esp_littlefs_amp_report(_efs[index], amp);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_amp_reset(const char* partition_label) {
+#if CONFIG_LITTLEFS_AMP
+    int index;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    esp_littlefs_amp_clear(_efs[index]);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_top(const char* partition_label, esp_littlefs_top_t *top) {
+#if CONFIG_LITTLEFS_TASK_IO
+    int index;
+
+    assert(top);
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    esp_littlefs_io_report(_efs[index], top);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_top_reset(const char* partition_label) {
+#if CONFIG_LITTLEFS_TASK_IO
+    int index;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    esp_littlefs_io_clear(_efs[index]);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_io_budget(const char* partition_label, uint32_t us_per_sec) {
+#if CONFIG_LITTLEFS_TASK_IO
+    int index;
+    esp_littlefs_io_state_t *io;
+
+    if(us_per_sec > 1000000) return ESP_ERR_INVALID_ARG;
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    io = &_efs[index]->io;
+
+    portENTER_CRITICAL(&io->mux);
+    io->budget_us = us_per_sec;
+    /* Every task starts over with a full bucket */
+    for(uint8_t i=0; i < io->task_count; i++) {
+        io->tasks[i].tokens = us_per_sec;
+        io->tasks[i].refilled = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&io->mux);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t esp_littlefs_stats_reset(const char* partition_label) {
+#if CONFIG_LITTLEFS_STATS
+    int index;
+
+    if(esp_littlefs_by_label(partition_label, &index) != ESP_OK) return ESP_ERR_INVALID_STATE;
+    memset(_efs[index]->stats, 0, sizeof(_efs[index]->stats));
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
 /********************
  * Static Functions *
  ********************/
@@ -357,10 +1021,30 @@ static void esp_littlefs_free(esp_littlefs_t ** efs)
     if (e == NULL) return;
     *efs = NULL;
 
+#if CONFIG_LITTLEFS_TRACE
+    if(esp_littlefs_traced == e) esp_littlefs_trace_stop();
+#endif
     if (e->fs) {
         if(e->cache_size > 0) lfs_unmount(e->fs);
         free(e->fs);
     }
+    esp_littlefs_cfg_free_buffers(&e->cfg);
+    if(e->snapshot) {
+        ESP_LOGE(TAG, "Snapshot of \"%s\" was never released.", e->label);
+        lfs_unmount(&e->snapshot->fs);
+        esp_littlefs_snapshot_free(e->snapshot);
+    }
+    for(uint8_t i=0; i < e->reader_count; i++) {
+        lfs_unmount(e->readers[i].fs);
+        free(e->readers[i].fs);
+        esp_littlefs_cfg_free_buffers(&e->readers[i].cfg);
+        vSemaphoreDelete(e->readers[i].lock);
+    }
+    free(e->readers);
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    esp_littlefs_xfer_free(e->xfer);
+#endif
+    if(e->bd_lock) vSemaphoreDelete(e->bd_lock);
     if(e->lock) vSemaphoreDelete(e->lock);
     esp_littlefs_free_fds(e);
     free(e->label);
@@ -372,8 +1056,31 @@ static void esp_littlefs_free(esp_littlefs_t ** efs)
  */
 static void esp_littlefs_dir_free(vfs_littlefs_dir_t *dir){
     if(dir == NULL) return;
-    if(dir->path) free(dir->path);
-    free(dir);
+    esp_littlefs_obj_free(dir_pool, dir);
+}
+
+/**
+ * @brief Free a snapshot and its block tables.
+ */
+static void esp_littlefs_snapshot_free(esp_littlefs_snapshot_t *snap){
+    if(snap == NULL) return;
+    esp_littlefs_cfg_free_buffers(&snap->cfg);
+    free(snap->pinned);
+    free(snap->watermark);
+    free(snap->shadow[0]);
+    free(snap->shadow[1]);
+    free(snap);
+}
+
+/**
+ * @brief lfs_fs_traverse callback marking a block as used by a snapshot.
+ */
+static int esp_littlefs_snapshot_pin(void *data, lfs_block_t block){
+    esp_littlefs_snapshot_t *snap = data;
+    if(block < snap->efs->cfg.block_count) {
+        snap->pinned[block / 32] |= 1u << (block % 32);
+    }
+    return 0;
 }
 
 /**
@@ -440,15 +1147,326 @@ static int esp_littlefs_flags_conv(int m) {
 }
 
 /**
- * @brief Initialize and mount littlefs 
- * @param[in] conf Filesystem Configuration
- * @return ESP_OK on success
+ * @brief State of a walk over the tree by esp_littlefs_map_blocks()
  */
-static esp_err_t esp_littlefs_init(const esp_vfs_littlefs_conf_t* conf)
-{
-    int index = -1;
-    esp_err_t err = ESP_FAIL;
-    esp_littlefs_t * efs = NULL;
+typedef struct {
+    esp_littlefs_t *efs;
+    uint8_t *bitmap;
+    const esp_littlefs_block_map_cb_t *cb;
+    esp_littlefs_block_map_t *map;
+    void *cache;
+    struct lfs_info info;
+    char path[CONFIG_LITTLEFS_OBJ_NAME_LEN + 1];
+} esp_littlefs_map_ctx_t;
+
+static inline void esp_littlefs_map_set(uint8_t *bitmap, lfs_block_t block, esp_littlefs_block_type_t type) {
+    bitmap[block / 4] = (bitmap[block / 4] & ~(3 << (block % 4 * 2))) | (type << (block % 4 * 2));
+}
+
+static inline esp_littlefs_block_type_t esp_littlefs_map_get(const uint8_t *bitmap, lfs_block_t block) {
+    return (bitmap[block / 4] >> (block % 4 * 2)) & 3;
+}
+
+static int esp_littlefs_map_used(void *data, lfs_block_t block) {
+    esp_littlefs_map_ctx_t *ctx = data;
+    if(block < ctx->efs->cfg.block_count) esp_littlefs_map_set(ctx->bitmap, block, ESP_LITTLEFS_BLOCK_META);
+    return 0;
+}
+
+/**
+ * @brief Mark the data blocks of the file at ctx->path.
+ *
+ * Follows the file's CTZ skip-list from its last block to its first,
+ * reading only the pointer each block has to the one before it.
+ */
+static int esp_littlefs_map_file(esp_littlefs_map_ctx_t *ctx) {
+    const struct lfs_config *cfg = &ctx->efs->cfg;
+    struct lfs_file_config fcfg = { .buffer = ctx->cache };
+    lfs_file_t file;
+    uint32_t blocks = 0, extents = 0;
+    int res;
+
+    res = lfs_file_opencfg(ctx->efs->fs, &file, ctx->path, LFS_O_RDONLY, &fcfg);
+    if(res < 0) return res;
+
+    if(!(file.flags & LFS_F_INLINE) && file.ctz.size > 0) {
+        /* Index of the last block, as lfs_ctz_index() computes it */
+        lfs_off_t b = cfg->block_size - 2 * 4;
+        lfs_off_t size = file.ctz.size - 1;
+        lfs_off_t index = size / b;
+        if(index > 0) index = (size - 4 * (__builtin_popcount(index - 1) + 2)) / b;
+
+        lfs_block_t head = file.ctz.head, prev = 0;
+        for(;;) {
+            uint8_t ptr[4];
+            if(head >= cfg->block_count) {
+                res = LFS_ERR_CORRUPT;
+                break;
+            }
+            esp_littlefs_map_set(ctx->bitmap, head, ESP_LITTLEFS_BLOCK_DATA);
+            if(ctx->cb && ctx->cb->block) ctx->cb->block(ctx->cb->arg, head, ESP_LITTLEFS_BLOCK_DATA, ctx->path);
+            /* Walking backwards; the file is contiguous where each block follows the previous */
+            if(blocks == 0 || head + 1 != prev) extents++;
+            blocks++;
+            prev = head;
+            if(index == 0) break;
+
+            /* The first pointer of every block but the first is to the one before it */
+            res = cfg->read(cfg, head, 0, ptr, sizeof(ptr));
+            if(res < 0) break;
+            head = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+            index--;
+        }
+    }
+    lfs_file_close(ctx->efs->fs, &file);
+    if(res < 0) return res;
+
+    if(ctx->map) {
+        ctx->map->files++;
+        ctx->map->data_extents += extents;
+        if(extents > 1) ctx->map->fragmented_files++;
+    }
+    if(ctx->cb && ctx->cb->file) ctx->cb->file(ctx->cb->arg, ctx->path, file.ctz.size, blocks, extents);
+    return 0;
+}
+
+/**
+ * @brief Map the files below ctx->path, which is len long.
+ */
+static int esp_littlefs_map_dir(esp_littlefs_map_ctx_t *ctx, size_t len) {
+    lfs_dir_t dir;
+    int res;
+
+    res = lfs_dir_open(ctx->efs->fs, &dir, len ? ctx->path : "/");
+    if(res < 0) return res;
+
+    while((res = lfs_dir_read(ctx->efs->fs, &dir, &ctx->info)) > 0) {
+        if(!strcmp(ctx->info.name, ".") || !strcmp(ctx->info.name, "..")) continue;
+
+        size_t n = strlen(ctx->info.name);
+        if(len + 1 + n >= sizeof(ctx->path)) {
+            res = LFS_ERR_NAMETOOLONG;
+            break;
+        }
+        ctx->path[len] = '/';
+        memcpy(ctx->path + len + 1, ctx->info.name, n + 1);
+        if(ctx->info.type == LFS_TYPE_DIR) res = esp_littlefs_map_dir(ctx, len + 1 + n);
+        else res = esp_littlefs_map_file(ctx);
+        ctx->path[len] = '\0';
+        if(res < 0) break;
+    }
+    lfs_dir_close(ctx->efs->fs, &dir);
+    return res;
+}
+
+/**
+ * @brief Classify every block into bitmap and summarize it into map.
+ * @param[out] bitmap 2 bits per block, zeroed
+ * @return 0 on success, or a littlefs error.
+ * @warning This must be called with lock taken
+ */
+static int esp_littlefs_map_blocks(esp_littlefs_t *efs, uint8_t *bitmap,
+        const esp_littlefs_block_map_cb_t *cb, esp_littlefs_block_map_t *map) {
+    esp_littlefs_map_ctx_t *ctx;
+    uint32_t run = 0;
+    int res;
+
+    ctx = low_calloc(1, sizeof(*ctx));
+    if(ctx) ctx->cache = esp_littlefs_mem_alloc(ESP_LITTLEFS_MEM_FILE_CACHE, efs->cfg.cache_size);
+    if(ctx == NULL || ctx->cache == NULL) {
+        if(ctx) free(ctx);
+        return LFS_ERR_NOMEM;
+    }
+    ctx->efs = efs;
+    ctx->bitmap = bitmap;
+    ctx->cb = cb;
+    ctx->map = map;
+    if(map) memset(map, 0, sizeof(*map));
+
+    /* Everything in use, then the file data blocks within it */
+    res = lfs_fs_traverse(efs->fs, esp_littlefs_map_used, ctx);
+    if(res >= 0) res = esp_littlefs_map_dir(ctx, 0);
+    esp_littlefs_mem_free(ctx->cache);
+    free(ctx);
+    if(res < 0) return res;
+
+    for(lfs_block_t block=0; block <= efs->cfg.block_count; block++) {
+        esp_littlefs_block_type_t type = ESP_LITTLEFS_BLOCK_DATA;
+
+        if(block < efs->cfg.block_count) {
+            type = esp_littlefs_map_get(bitmap, block);
+            if(cb && cb->block && type != ESP_LITTLEFS_BLOCK_DATA) cb->block(cb->arg, block, type, NULL);
+        }
+        if(map == NULL) continue;
+
+        if(type == ESP_LITTLEFS_BLOCK_FREE) {
+            run++;
+            map->free_blocks++;
+            continue;
+        }
+        if(type == ESP_LITTLEFS_BLOCK_META) map->meta_blocks++;
+        else if(block < efs->cfg.block_count) map->data_blocks++;
+        if(run > 0) {
+            /* A free run just ended */
+            map->free_runs[MIN(31 - __builtin_clz(run), ESP_LITTLEFS_RUN_BUCKETS - 1)]++;
+            map->largest_free_run = MAX(map->largest_free_run, run);
+            run = 0;
+        }
+    }
+    if(map) {
+        map->block_count = efs->cfg.block_count;
+        if(map->free_blocks) map->fragmentation = 1.0f - (float)map->largest_free_run / map->free_blocks;
+    }
+    return 0;
+}
+
+#if CONFIG_LITTLEFS_STATS
+/**
+ * @brief Map a littlefs error to its counter in esp_littlefs_stats_t
+ */
+static esp_littlefs_err_t esp_littlefs_stats_err(int lfs_err) {
+    switch(lfs_err) {
+        case LFS_ERR_IO: return ESP_LITTLEFS_ERR_IO;
+        case LFS_ERR_CORRUPT: return ESP_LITTLEFS_ERR_CORRUPT;
+        case LFS_ERR_NOENT: return ESP_LITTLEFS_ERR_NOENT;
+        case LFS_ERR_EXIST: return ESP_LITTLEFS_ERR_EXIST;
+        case LFS_ERR_NOTDIR: return ESP_LITTLEFS_ERR_NOTDIR;
+        case LFS_ERR_ISDIR: return ESP_LITTLEFS_ERR_ISDIR;
+        case LFS_ERR_NOTEMPTY: return ESP_LITTLEFS_ERR_NOTEMPTY;
+        case LFS_ERR_BADF: return ESP_LITTLEFS_ERR_BADF;
+        case LFS_ERR_FBIG: return ESP_LITTLEFS_ERR_FBIG;
+        case LFS_ERR_INVAL: return ESP_LITTLEFS_ERR_INVAL;
+        case LFS_ERR_NOSPC: return ESP_LITTLEFS_ERR_NOSPC;
+        case LFS_ERR_NOMEM: return ESP_LITTLEFS_ERR_NOMEM;
+        case LFS_ERR_NOATTR: return ESP_LITTLEFS_ERR_NOATTR;
+        case LFS_ERR_NAMETOOLONG: return ESP_LITTLEFS_ERR_NAMETOOLONG;
+        case -EBUSY: return ESP_LITTLEFS_ERR_BUSY;
+        case -EROFS: return ESP_LITTLEFS_ERR_ROFS;
+        default: return ESP_LITTLEFS_ERR_OTHER;
+    }
+}
+#endif
+
+/**
+ * @brief Give a littlefs configuration read, prog and lookahead buffers of
+ *        its own, accounted against the memory budget.
+ * @return ESP_OK on success
+ */
+static esp_err_t esp_littlefs_cfg_alloc_buffers(struct lfs_config *cfg) {
+    cfg->read_buffer = esp_littlefs_mem_alloc(ESP_LITTLEFS_MEM_MOUNT_CACHE, cfg->cache_size);
+    cfg->prog_buffer = esp_littlefs_mem_alloc(ESP_LITTLEFS_MEM_MOUNT_CACHE, cfg->cache_size);
+    cfg->lookahead_buffer = esp_littlefs_mem_alloc(ESP_LITTLEFS_MEM_MOUNT_CACHE, cfg->lookahead_size);
+    if(cfg->read_buffer == NULL || cfg->prog_buffer == NULL || cfg->lookahead_buffer == NULL) {
+        esp_littlefs_cfg_free_buffers(cfg);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Free the buffers from esp_littlefs_cfg_alloc_buffers.
+ */
+static void esp_littlefs_cfg_free_buffers(struct lfs_config *cfg) {
+    esp_littlefs_mem_free(cfg->read_buffer);
+    esp_littlefs_mem_free(cfg->prog_buffer);
+    esp_littlefs_mem_free(cfg->lookahead_buffer);
+    cfg->read_buffer = NULL;
+    cfg->prog_buffer = NULL;
+    cfg->lookahead_buffer = NULL;
+}
+
+/**
+ * @brief Take a mutex without waiting, unless this task already holds it.
+ * @param[out] taken whether the caller has to give it back
+ * @return whether the caller now holds the mutex
+ */
+static bool esp_littlefs_try_take(SemaphoreHandle_t lock, bool *taken) {
+    *taken = false;
+    if(xSemaphoreGetMutexHolder(lock) == xTaskGetCurrentTaskHandle()) return true;
+    *taken = xSemaphoreTake(lock, 0) == pdTRUE;
+    return *taken;
+}
+
+/**
+ * @brief Mount the independent instances of a read-only filesystem.
+ * @param[in,out] efs file system context; its main instance must be mounted
+ * @return ESP_OK on success
+ */
+static esp_err_t esp_littlefs_mount_readers(esp_littlefs_t *efs)
+{
+    efs->readers = low_calloc(CONFIG_LITTLEFS_RO_READERS, sizeof(*efs->readers));
+    if (efs->readers == NULL) {
+        ESP_LOGE(TAG, "readers could not be malloced");
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (!efs->internal_version) {
+        efs->bd_lock = xSemaphoreCreateMutex();
+        if (efs->bd_lock == NULL) {
+            ESP_LOGE(TAG, "block device lock could not be created");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    for (uint8_t i = 0; i < CONFIG_LITTLEFS_RO_READERS; i++) {
+        esp_littlefs_reader_t *reader = &efs->readers[i];
+        reader->cfg = efs->cfg;
+        reader->lock = xSemaphoreCreateMutex();
+        reader->fs = low_calloc(1, sizeof(lfs_t));
+        if (reader->lock == NULL || reader->fs == NULL
+                || esp_littlefs_cfg_alloc_buffers(&reader->cfg) != ESP_OK) {
+            ESP_LOGE(TAG, "reader %d could not be allocated", i);
+            if (reader->lock) vSemaphoreDelete(reader->lock);
+            free(reader->fs);
+            esp_littlefs_cfg_free_buffers(&reader->cfg);
+            return ESP_ERR_NO_MEM;
+        }
+        int res = lfs_mount(reader->fs, &reader->cfg);
+        if (res != LFS_ERR_OK) {
+            ESP_LOGE(TAG, "reader mount failed, %s (%i)", esp_littlefs_errno(res), res);
+            vSemaphoreDelete(reader->lock);
+            free(reader->fs);
+            esp_littlefs_cfg_free_buffers(&reader->cfg);
+            return ESP_FAIL;
+        }
+        efs->reader_count++;
+    }
+
+    efs->read_only = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief lfs_mount() efs, noting how long it took and what it read.
+ * @return littlefs error code
+ */
+static int esp_littlefs_timed_mount(esp_littlefs_t *efs)
+{
+    int res;
+
+    efs->timing.superblock_us = 0;
+    efs->timing.mount_reads = 0;
+    efs->mount_t0 = esp_timer_get_time();
+    res = lfs_mount(efs->fs, &efs->cfg);
+    efs->timing.mount_us = esp_timer_get_time() - efs->mount_t0;
+    efs->mount_t0 = 0;
+    /* Nothing past the superblock pair */
+    if(efs->timing.superblock_us == 0) efs->timing.superblock_us = efs->timing.mount_us;
+    efs->timing.metadata_us = efs->timing.mount_us - efs->timing.superblock_us;
+    return res;
+}
+
+/**
+ * @brief Initialize and mount littlefs 
+ * @param[in] conf Filesystem Configuration
+ * @return ESP_OK on success
+ */
+static esp_err_t esp_littlefs_init(const esp_vfs_littlefs_conf_t* conf)
+{
+    int index = -1;
+    esp_err_t err = ESP_FAIL;
+    esp_littlefs_t * efs = NULL;
+    int64_t t_start = esp_timer_get_time(), t;
 
     if( _efs_lock == NULL ){
         static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
@@ -475,6 +1493,7 @@ static esp_err_t esp_littlefs_init(const esp_vfs_littlefs_conf_t* conf)
         goto exit;
     }
 
+    t = esp_timer_get_time();
 #ifdef CONFIG_NEONIOUS_ONE
     bool internal_version = true;
 
@@ -554,35 +1573,74 @@ static esp_err_t esp_littlefs_init(const esp_vfs_littlefs_conf_t* conf)
 #endif /* CONFIG_NEONIOUS_ONE */
     efs->internal_version = internal_version;
     efs->label = strdup(conf->partition_label);
+    vPortCPUInitializeMutex(&efs->fd_mux);
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+    vPortCPUInitializeMutex(&efs->prof.mux);
+#endif
+#if CONFIG_LITTLEFS_AMP
+    vPortCPUInitializeMutex(&efs->amp.mux);
+#endif
+#if CONFIG_LITTLEFS_TASK_IO
+    vPortCPUInitializeMutex(&efs->io.mux);
+#endif
 
     { /* LittleFS Configuration */
         efs->cfg.context = efs;
 
         // block device operations
-        efs->cfg.read  = littlefs_api_read;
-        efs->cfg.prog  = littlefs_api_prog;
-        efs->cfg.erase = littlefs_api_erase;
-        efs->cfg.sync  = littlefs_api_sync;
+#ifndef CONFIG_NEONIOUS_ONE
+        if(internal_version) {
+            efs->cfg.read  = littlefs_api_internal_read;
+            efs->cfg.prog  = littlefs_api_internal_prog;
+            efs->cfg.erase = littlefs_api_internal_erase;
+            efs->cfg.sync  = littlefs_api_sync;
+        }
+        else
+#endif /* CONFIG_NEONIOUS_ONE */
+        {
+            efs->cfg.read  = littlefs_api_external_read;
+            efs->cfg.prog  = littlefs_api_external_prog;
+            efs->cfg.erase = littlefs_api_external_erase;
+            efs->cfg.sync  = littlefs_api_external_sync;
+        }
+    }
+
+    efs->fs = low_calloc(1, sizeof(lfs_t));
+    if (efs->fs == NULL) {
+        ESP_LOGE(TAG, "littlefs could not be malloced");
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    efs->timing.alloc_us = esp_timer_get_time() - t;
+
+    t = esp_timer_get_time();
+    err = esp_littlefs_cfg_alloc_buffers(&efs->cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "littlefs buffers could not be allocated");
+        goto exit;
     }
+    efs->timing.buffers_us = esp_timer_get_time() - t;
 
+    t = esp_timer_get_time();
     efs->lock = xSemaphoreCreateMutex();
     if (efs->lock == NULL) {
         ESP_LOGE(TAG, "mutex lock could not be created");
         err = ESP_ERR_NO_MEM;
         goto exit;
     }
+    efs->timing.lock_us = esp_timer_get_time() - t;
 
-    efs->fs = low_calloc(1, sizeof(lfs_t));
-    if (efs->fs == NULL) {
-        ESP_LOGE(TAG, "littlefs could not be malloced");
-        err = ESP_ERR_NO_MEM;
-        goto exit;
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    if(!internal_version) {
+        err = esp_littlefs_xfer_init(efs);
+        if(err != ESP_OK) goto exit;
     }
+#endif
 
     // Mount and Error Check
     _efs[index] = efs;
     if(!conf->dont_mount){
-        int res = lfs_mount(efs->fs, &efs->cfg);
+        int res = esp_littlefs_timed_mount(efs);
 
         if (conf->format_if_mount_failed && res != LFS_ERR_OK) {
             esp_err_t err;
@@ -593,59 +1651,562 @@ static esp_err_t esp_littlefs_init(const esp_vfs_littlefs_conf_t* conf)
                 err = ESP_FAIL;
                 goto exit;
             }
-            res = lfs_mount(efs->fs, &efs->cfg);
+            res = esp_littlefs_timed_mount(efs);
         }
         if (res != LFS_ERR_OK) {
             ESP_LOGE(TAG, "mount failed, %s (%i)", esp_littlefs_errno(res), res);
             err = ESP_FAIL;
             goto exit;
         }
-        efs->cache_size = 4;
-        efs->cache = low_calloc(sizeof(*efs->cache), efs->cache_size);
+        efs->cache_size = CONFIG_LITTLEFS_FD_CACHE_INIT_SIZE;
+        efs->cache = esp_littlefs_obj_alloc(fd_cache_pool, efs->cache_size * sizeof(*efs->cache));
+
+#if CONFIG_LITTLEFS_MOUNT_TRAVERSE
+        /* The same walk the allocator does on the first write */
+        t = esp_timer_get_time();
+        lfs_ssize_t used = lfs_fs_size(efs->fs);
+        efs->timing.traverse_us = esp_timer_get_time() - t;
+        efs->timing.used_blocks = used > 0 ? used : 0;
+#endif
+
+        if(conf->read_only) {
+            t = esp_timer_get_time();
+            err = esp_littlefs_mount_readers(efs);
+            if(err != ESP_OK) goto exit;
+            efs->timing.readers_us = esp_timer_get_time() - t;
+        }
+    }
+
+    efs->timing.total_us = esp_timer_get_time() - t_start;
+    ESP_LOGD(TAG, "mounted in %u us (lfs_mount %u us, %u reads)", efs->timing.total_us,
+            efs->timing.mount_us, efs->timing.mount_reads);
+    err = ESP_OK;
+
+exit:
+    if(err != ESP_OK){
+        if( index >= 0 ) {
+            esp_littlefs_free(&_efs[index]);
+        }
+        else{
+            esp_littlefs_free(&efs);
+        }
+    }
+    xSemaphoreGive(_efs_lock);
+    return err;
+}
+
+/**
+ * @brief Take a lock of efs, timing the wait when it's contended.
+ * @return true if the lock was held by another task.
+ */
+static bool esp_littlefs_take(esp_littlefs_t *efs, SemaphoreHandle_t lock) {
+    if(xSemaphoreTake(lock, 0) == pdTRUE) {
+#if CONFIG_LITTLEFS_LATENCY
+        esp_littlefs_lat_record(efs, ESP_LITTLEFS_LAT_LOCK_WAIT, 0);
+#endif
+        return false;
+    }
+    int64_t t0 = ESP_LITTLEFS_LAT_NOW();
+    xSemaphoreTake(lock, portMAX_DELAY);
+    ESP_LITTLEFS_LAT_RECORD(efs, ESP_LITTLEFS_LAT_LOCK_WAIT, t0);
+    return true;
+}
+
+/**
+ * @brief
+ * @parameter efs file system context
+ */
+static inline int sem_take(esp_littlefs_t *efs) {
+#if LOG_LOCAL_LEVEL >= 4
+    ESP_LOGD(TAG, "------------------------ Sem Taking [%s]", pcTaskGetTaskName(NULL));
+#endif
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+    int64_t t0 = esp_timer_get_time();
+    bool contended = esp_littlefs_take(efs, efs->lock);
+    esp_littlefs_prof_acquired(efs, t0, contended);
+#else
+    esp_littlefs_take(efs, efs->lock);
+#endif
+
+#if LOG_LOCAL_LEVEL >= 4
+    ESP_LOGD(TAG, "--------------------->>> Sem Taken [%s]", pcTaskGetTaskName(NULL));
+#endif
+    return 0;
+}
+
+/**
+ * @brief
+ * @parameter efs file system context
+ */
+static inline int sem_give(esp_littlefs_t *efs) {
+#if LOG_LOCAL_LEVEL >= 4
+    ESP_LOGD(TAG, "---------------------<<< Sem Give [%s]", pcTaskGetTaskName(NULL));
+#endif
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+    esp_littlefs_prof_released(efs);
+#endif
+    ESP_LITTLEFS_AMP_CLEAR(efs);
+   return xSemaphoreGive(efs->lock);
+}
+
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+/**
+ * @brief Find the profile slot of the calling task, adding it if there's room.
+ * @return the slot index, or -1 if the table is full.
+ * @warning This must be called with prof.mux held
+ */
+static int esp_littlefs_prof_slot(esp_littlefs_lock_prof_t *prof) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+    for(int i=0; i < prof->task_count; i++) {
+        if(prof->tasks[i].task == task) return i;
+    }
+    if(prof->task_count == ESP_LITTLEFS_LOCK_TASKS) return -1;
+
+    esp_littlefs_prof_task_t *t = &prof->tasks[prof->task_count];
+    memset(t, 0, sizeof(*t));
+    t->task = task;
+    t->op = ESP_LITTLEFS_OP_MAX;
+    strlcpy(t->stats.task, pcTaskGetTaskName(task), sizeof(t->stats.task));
+    return prof->task_count++;
+}
+
+/**
+ * @brief Note the VFS call the calling task is in, for the lock it takes next.
+ */
+static void esp_littlefs_prof_op(esp_littlefs_t *efs, uint8_t op, uint32_t key) {
+    esp_littlefs_lock_prof_t *prof = &efs->prof;
+
+    portENTER_CRITICAL(&prof->mux);
+    int slot = esp_littlefs_prof_slot(prof);
+    if(slot >= 0) {
+        prof->tasks[slot].op = op;
+        prof->tasks[slot].key = key;
+    }
+    portEXIT_CRITICAL(&prof->mux);
+}
+
+/**
+ * @brief Forget the VFS call the calling task was in; it has returned.
+ */
+static void esp_littlefs_prof_end(esp_littlefs_t *efs) {
+    esp_littlefs_lock_prof_t *prof = &efs->prof;
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL(&prof->mux);
+    for(int i=0; i < prof->task_count; i++) {
+        if(prof->tasks[i].task == task) {
+            prof->tasks[i].op = ESP_LITTLEFS_OP_MAX;
+            prof->tasks[i].key = 0;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&prof->mux);
+}
+
+/**
+ * @brief Account the wait for efs->lock, which the calling task now holds.
+ * @param[in] t0        when the task started taking it
+ * @param[in] contended whether it had to wait for another holder
+ */
+static void esp_littlefs_prof_acquired(esp_littlefs_t *efs, int64_t t0, bool contended) {
+    esp_littlefs_lock_prof_t *prof = &efs->prof;
+    int64_t now = esp_timer_get_time();
+    uint32_t wait = contended ? now - t0 : 0;
+
+    portENTER_CRITICAL(&prof->mux);
+    int slot = esp_littlefs_prof_slot(prof);
+    prof->holder = slot;
+    prof->acquired = now;
+    if(slot < 0) {
+        prof->untracked++;
+        prof->holder_op = ESP_LITTLEFS_OP_MAX;
+        prof->holder_key = 0;
+    }
+    else {
+        esp_littlefs_prof_task_t *t = &prof->tasks[slot];
+        prof->holder_op = t->op;
+        prof->holder_key = t->key;
+        t->stats.acquisitions++;
+        if(contended) t->stats.contended++;
+        t->stats.wait_us += wait;
+        t->stats.max_wait_us = MAX(t->stats.max_wait_us, wait);
+    }
+    prof->op_wait_us[prof->holder_op] += wait;
+    portEXIT_CRITICAL(&prof->mux);
+}
+
+/**
+ * @brief Account the hold of efs->lock, which the calling task is about to give.
+ */
+static void esp_littlefs_prof_released(esp_littlefs_t *efs) {
+    esp_littlefs_lock_prof_t *prof = &efs->prof;
+    int64_t now = esp_timer_get_time();
+    uint32_t hold = now - prof->acquired;
+
+    portENTER_CRITICAL(&prof->mux);
+    prof->op_hold_us[prof->holder_op] += hold;
+    if(prof->holder >= 0) {
+        esp_littlefs_lock_task_t *stats = &prof->tasks[prof->holder].stats;
+        stats->hold_us += hold;
+        stats->max_hold_us = MAX(stats->max_hold_us, hold);
+    }
+
+    /* Keep the worst holds, longest first */
+    int i = ESP_LITTLEFS_LOCK_EVENTS;
+    while(i > 0 && prof->worst[i - 1].hold_us < hold) i--;
+    if(i < ESP_LITTLEFS_LOCK_EVENTS) {
+        memmove(&prof->worst[i + 1], &prof->worst[i],
+                (ESP_LITTLEFS_LOCK_EVENTS - i - 1) * sizeof(prof->worst[0]));
+        esp_littlefs_lock_event_t *ev = &prof->worst[i];
+        if(prof->holder >= 0) strlcpy(ev->task, prof->tasks[prof->holder].stats.task, sizeof(ev->task));
+        else strlcpy(ev->task, pcTaskGetTaskName(NULL), sizeof(ev->task));
+        ev->op = prof->holder_op;
+        ev->key = prof->holder_key;
+        ev->hold_us = hold;
+        ev->time = (uint32_t)now;
+    }
+    portEXIT_CRITICAL(&prof->mux);
+}
+#endif
+
+/**
+ * @brief Get an open file by FD and hold it; release with esp_littlefs_put_file().
+ * @param[in] efs file system context
+ * @param[in] fd  file descriptor
+ * @return the file. NULL with errno set if fd is invalid or being closed.
+ * @note Doesn't need the lock; the cache is swapped under fd_mux when it grows.
+ *       close() waits for every hold to be released before freeing the file.
+ */
+static vfs_littlefs_file_t * esp_littlefs_get_file(esp_littlefs_t *efs, int fd) {
+    vfs_littlefs_file_t *file = NULL;
+
+    portENTER_CRITICAL(&efs->fd_mux);
+    if((uint32_t)fd < efs->cache_size) file = efs->cache[fd];
+    if(file != NULL && file->closing) file = NULL;
+    if(file != NULL) file->busy++;
+    portEXIT_CRITICAL(&efs->fd_mux);
+
+    if(file == NULL) {
+        ESP_LOGE(TAG, "FD %d is not open.", fd);
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_BADF);
+        errno = -LFS_ERR_BADF;
+    }
+    return file;
+}
+
+/**
+ * @brief Release a hold taken by esp_littlefs_get_file(). file must not be used after.
+ */
+static void esp_littlefs_put_file(esp_littlefs_t *efs, vfs_littlefs_file_t *file) {
+    bool drained;
+
+    portENTER_CRITICAL(&efs->fd_mux);
+    file->busy--;
+    /* The hold left is close()'s; it frees file once woken */
+    drained = file->closing && file->busy == 1;
+    portEXIT_CRITICAL(&efs->fd_mux);
+    if(drained) xSemaphoreGive(file->drained);
+}
+
+/**
+ * @brief Stop new holds on a file and wait for the other hooks holding it.
+ * @return false if another close() of the FD got there first.
+ * @warning This must be called holding file once, and without any lock
+ */
+static bool esp_littlefs_file_drain(esp_littlefs_t *efs, vfs_littlefs_file_t *file) {
+    bool closing;
+    uint16_t busy;
+
+    portENTER_CRITICAL(&efs->fd_mux);
+    closing = file->closing;
+    file->closing = true;
+    busy = file->busy;
+    portEXIT_CRITICAL(&efs->fd_mux);
+    if(closing) return false;
+
+    /* No new holds from here, so exactly one put brings busy down to 1 */
+    if(busy > 1) xSemaphoreTake(file->drained, portMAX_DELAY);
+    return true;
+}
+
+/**
+ * @brief Lock the littlefs instance a file was opened on.
+ */
+static void esp_littlefs_fs_take(esp_littlefs_t *efs, vfs_littlefs_file_t *file) {
+    if(file->shared->reader) esp_littlefs_take(efs, file->shared->reader->lock);
+    else {
+        sem_take(efs);
+        ESP_LITTLEFS_AMP_SET(efs, file->hash);
+    }
+}
+
+/**
+ * @brief Unlock the littlefs instance a file was opened on.
+ */
+static void esp_littlefs_fs_give(esp_littlefs_t *efs, vfs_littlefs_file_t *file) {
+    if(file->shared->reader) xSemaphoreGive(file->shared->reader->lock);
+    else sem_give(efs);
+}
+
+/**
+ * @brief The littlefs instance a file was opened on.
+ */
+static inline lfs_t * esp_littlefs_file_fs(esp_littlefs_t *efs, vfs_littlefs_file_t *file) {
+    return file->shared->reader ? file->shared->reader->fs : efs->fs;
+}
+
+/*** Per-file data path ***/
+
+/**
+ * @brief Get the file's data-path buffer, allocating it on first use.
+ * @return NULL if buffering is disabled or the buffer doesn't fit the budget.
+ * @warning This must be called with file->shared->lock taken
+ */
+static uint8_t * esp_littlefs_file_buf(vfs_littlefs_file_t *file) {
+#if CONFIG_LITTLEFS_FILE_BUF_SIZE > 0
+    if(file->shared->buf == NULL) {
+        file->shared->buf = esp_littlefs_mem_alloc(ESP_LITTLEFS_MEM_FILE_BUF,
+                CONFIG_LITTLEFS_FILE_BUF_SIZE);
+    }
+#endif
+    return file->shared->buf;
+}
+
+/**
+ * @brief Seek littlefs to the FD position if it isn't there already.
+ * @warning This must be called with file->shared->lock and the instance lock taken
+ */
+static int esp_littlefs_file_sync_pos(lfs_t *fs, vfs_littlefs_file_t *file) {
+    lfs_file_t *lfs_file = &file->shared->file;
+
+    /* A seek drops littlefs' read state, so only seek when needed */
+    if(lfs_file_tell(fs, lfs_file) == file->pos) return 0;
+    lfs_soff_t res = lfs_file_seek(fs, lfs_file, file->pos, LFS_SEEK_SET);
+    return res < 0 ? res : 0;
+}
+
+/**
+ * @brief Read from the FD position, through the file's buffer.
+ *
+ * FDs sharing the file also share the buffer, so readers streaming the
+ * same file close together mostly hit each other's read-ahead.
+ *
+ * @return bytes read, or a littlefs error.
+ * @warning This must be called with file->shared->lock taken
+ */
+static lfs_ssize_t esp_littlefs_file_read(esp_littlefs_t *efs, vfs_littlefs_file_t *file,
+        void *dst, lfs_size_t size) {
+    uint8_t *out = dst;
+    lfs_ssize_t total = 0;
+    lfs_ssize_t res;
+    lfs_t *fs = esp_littlefs_file_fs(efs, file);
+    vfs_littlefs_shared_t *sh = file->shared;
+
+    while(size > 0) {
+        if(file->pos >= sh->buf_pos && file->pos < sh->buf_pos + sh->buf_len) {
+            /* Hit; no need to bother littlefs */
+            ESP_LITTLEFS_STATS_ADD(efs, cache_hits, 1);
+            lfs_size_t n = MIN(size, sh->buf_pos + sh->buf_len - file->pos);
+            memcpy(out, sh->buf + (file->pos - sh->buf_pos), n);
+            out += n;
+            size -= n;
+            total += n;
+            file->pos += n;
+            continue;
+        }
+
+        /* Miss; read large requests straight through, refill for small ones */
+        ESP_LITTLEFS_STATS_ADD(efs, cache_misses, 1);
+        bool direct = size >= CONFIG_LITTLEFS_FILE_BUF_SIZE || esp_littlefs_file_buf(file) == NULL;
+        esp_littlefs_fs_take(efs, file);
+        res = esp_littlefs_file_sync_pos(fs, file);
+        if(res >= 0) {
+            res = lfs_file_read(fs, &sh->file, direct ? out : sh->buf,
+                    direct ? size : CONFIG_LITTLEFS_FILE_BUF_SIZE);
+        }
+        esp_littlefs_fs_give(efs, file);
+
+        if(res < 0) return total > 0 ? total : res;
+        if(res == 0) break; /* EOF */
+        if(direct) {
+            total += res;
+            file->pos += res;
+            break;
+        }
+        sh->buf_pos = file->pos;
+        sh->buf_len = res;
+    }
+
+    return total;
+}
+
+/**
+ * @brief Write at the FD position, straight to littlefs so the caller
+ *        gets its errors (ENOSPC, EIO) and other FDs see the data as usual.
+ * @return bytes written, or a littlefs error.
+ * @warning This must be called with file->shared->lock taken
+ */
+static lfs_ssize_t esp_littlefs_file_write(esp_littlefs_t *efs, vfs_littlefs_file_t *file,
+        const void *data, lfs_size_t size) {
+    lfs_ssize_t res;
+    lfs_t *fs = esp_littlefs_file_fs(efs, file);
+    vfs_littlefs_shared_t *sh = file->shared;
+
+    /* Read-ahead is stale once the file changes */
+    sh->buf_len = 0;
+
+    esp_littlefs_fs_take(efs, file);
+    res = 0;
+    if(!(sh->flags & LFS_O_APPEND)) {
+        res = esp_littlefs_file_sync_pos(fs, file);
+    }
+    if(res >= 0) {
+        res = lfs_file_write(fs, &sh->file, data, size);
     }
+    if(res >= 0) {
+        file->pos = lfs_file_tell(fs, &sh->file);
+    }
+    esp_littlefs_fs_give(efs, file);
 
-    err = ESP_OK;
+    return res;
+}
 
-exit:
-    if(err != ESP_OK){
-        if( index >= 0 ) {
-            esp_littlefs_free(&_efs[index]);
-        }
-        else{
-            esp_littlefs_free(&efs);
-        }
+/**
+ * @brief Move the FD position.
+ * @return the new position, or a littlefs error.
+ * @warning This must be called with file->shared->lock taken
+ */
+static lfs_soff_t esp_littlefs_file_seek(esp_littlefs_t *efs, vfs_littlefs_file_t *file,
+        lfs_soff_t offset, int whence) {
+    lfs_soff_t pos;
+    lfs_t *fs = esp_littlefs_file_fs(efs, file);
+
+    switch(whence) {
+        case LFS_SEEK_SET: pos = offset; break;
+        case LFS_SEEK_CUR: pos = file->pos + offset; break;
+        default:
+            /* Only littlefs knows where the end is */
+            esp_littlefs_fs_take(efs, file);
+            pos = lfs_file_size(fs, &file->shared->file);
+            esp_littlefs_fs_give(efs, file);
+            if(pos < 0) return pos;
+            pos += offset;
+            break;
     }
-    xSemaphoreGive(_efs_lock);
-    return err;
+    if(pos < 0) return LFS_ERR_INVAL;
+
+    file->pos = pos;
+    return pos;
 }
 
 /**
- * @brief
- * @parameter efs file system context
+ * @brief Open path for an FD, sharing an open file when possible.
+ * @return 0 on success, or a littlefs error.
+ * @warning This must be called with lock taken
  */
-static inline int sem_take(esp_littlefs_t *efs) {
-#if LOG_LOCAL_LEVEL >= 4
-    ESP_LOGD(TAG, "------------------------ Sem Taking [%s]", pcTaskGetTaskName(NULL));
+static int esp_littlefs_shared_open(esp_littlefs_t *efs, vfs_littlefs_file_t *file,
+        const char *path, int lfs_flags) {
+    vfs_littlefs_shared_t *sh;
+    bool writer_open = false;
+    int res;
+
+    for(vfs_littlefs_file_t *f = efs->file; f != NULL; f = f->next) {
+        if(f == file || f->shared == NULL || f->hash != file->hash) continue;
+#ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
+        if(strcmp(f->path, path) != 0) continue;
+        if(lfs_flags == LFS_O_RDONLY && f->shared->shareable) {
+            file->shared = f->shared;
+            file->shared->refs++;
+            return 0;
+        }
 #endif
-    xSemaphoreTake(efs->lock, portMAX_DELAY);
+        /* Later readers must not see what this open is about to change */
+        if(lfs_flags != LFS_O_RDONLY) f->shared->shareable = false;
+        if(f->shared->flags != LFS_O_RDONLY) writer_open = true;
+    }
 
-#if LOG_LOCAL_LEVEL >= 4
-    ESP_LOGD(TAG, "--------------------->>> Sem Taken [%s]", pcTaskGetTaskName(NULL));
+    sh = esp_littlefs_obj_alloc(shared_pool, sizeof(*sh));
+    if(sh == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate open file");
+        return LFS_ERR_NOMEM;
+    }
+    sh->fcfg.buffer = esp_littlefs_mem_alloc(ESP_LITTLEFS_MEM_FILE_CACHE, efs->cfg.cache_size);
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    sh->lock = xSemaphoreCreateMutexStatic(&sh->lock_buf);
+#else
+    sh->lock = xSemaphoreCreateMutex();
 #endif
+    if(sh->fcfg.buffer == NULL || sh->lock == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate file cache");
+        if(sh->lock) vSemaphoreDelete(sh->lock);
+        esp_littlefs_mem_free(sh->fcfg.buffer);
+        esp_littlefs_obj_free(shared_pool, sh);
+        return LFS_ERR_NOMEM;
+    }
+
+    if(efs->read_only) {
+        /* Spread files over the readers so they can be read in parallel */
+        sh->reader = &efs->readers[0];
+        for(uint8_t i=1; i < efs->reader_count; i++) {
+            if(efs->readers[i].open_count < sh->reader->open_count)
+                sh->reader = &efs->readers[i];
+        }
+        esp_littlefs_take(efs, sh->reader->lock);
+        res = lfs_file_opencfg(sh->reader->fs, &sh->file, path, lfs_flags, &sh->fcfg);
+        xSemaphoreGive(sh->reader->lock);
+        if(res >= 0) sh->reader->open_count++;
+    }
+    else {
+        res = lfs_file_opencfg(efs->fs, &sh->file, path, lfs_flags, &sh->fcfg);
+    }
+    if(res < 0) {
+        vSemaphoreDelete(sh->lock);
+        esp_littlefs_mem_free(sh->fcfg.buffer);
+        esp_littlefs_obj_free(shared_pool, sh);
+        return res;
+    }
+
+    sh->flags = lfs_flags;
+    sh->refs = 1;
+    sh->shareable = lfs_flags == LFS_O_RDONLY && !writer_open;
+    file->shared = sh;
     return 0;
 }
 
 /**
- * @brief
- * @parameter efs file system context
+ * @brief Drop an FD's reference to its open file, closing it on the last one.
+ * @return 0 on success, or a littlefs error.
+ * @warning This must be called with lock taken, and file->shared->lock not taken
  */
-static inline int sem_give(esp_littlefs_t *efs) {
-#if LOG_LOCAL_LEVEL >= 4
-    ESP_LOGD(TAG, "---------------------<<< Sem Give [%s]", pcTaskGetTaskName(NULL));
-#endif
-   return xSemaphoreGive(efs->lock);
-}
+static int esp_littlefs_shared_close(esp_littlefs_t *efs, vfs_littlefs_file_t *file) {
+    vfs_littlefs_shared_t *sh = file->shared;
+    int res;
+
+    if(sh->refs > 1) {
+        sh->refs--;
+        file->shared = NULL;
+        return 0;
+    }
+
+    if(sh->reader) {
+        esp_littlefs_take(efs, sh->reader->lock);
+        res = lfs_file_close(sh->reader->fs, &sh->file);
+        xSemaphoreGive(sh->reader->lock);
+        if(res >= 0) sh->reader->open_count--;
+    }
+    else {
+        res = lfs_file_close(efs->fs, &sh->file);
+    }
+    if(res < 0) return res;
 
+    vSemaphoreDelete(sh->lock);
+    esp_littlefs_mem_free(sh->buf);
+    esp_littlefs_mem_free(sh->fcfg.buffer);
+    esp_littlefs_obj_free(shared_pool, sh);
+    file->shared = NULL;
+    return 0;
+}
 
 /* We are using a double allocation system here, which an array and a linked list. 
    The array contains the pointer to the file descriptor (the index in the array is what's returned to the user).
@@ -681,26 +2242,36 @@ static int esp_littlefs_allocate_fd(esp_littlefs_t *efs, vfs_littlefs_file_t **
     assert( efs->cache_size < UINT16_MAX );
 
     /* Make sure there is enough space in the cache to store new fd */
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    if (efs->fd_count + 1 > efs->cache_size) {
+        ESP_LOGE(TAG, "All %d FDs are in use", efs->cache_size);
+        return -1;
+    }
+#else
     if (efs->fd_count + 1 > efs->cache_size) {
         uint16_t new_size = (uint16_t)MIN(UINT16_MAX, CONFIG_LITTLEFS_FD_CACHE_REALLOC_FACTOR * efs->cache_size);
-        /* Resize the cache */
-        vfs_littlefs_file_t ** new_cache = realloc(efs->cache, new_size * sizeof(*efs->cache));
+        /* Resize the cache. Not realloc: lookups may be reading the old one */
+        vfs_littlefs_file_t ** new_cache = low_calloc(new_size, sizeof(*efs->cache));
         if (!new_cache) {
             ESP_LOGE(TAG, "Unable to allocate file cache");
             return -1; /* If it fails here, no harm is done to the filesystem, so it's safe */
         }
-        /* Zero out the new portions of the cache */
-        memset(&new_cache[efs->cache_size], 0, (new_size - efs->cache_size) * sizeof(*efs->cache));
+        memcpy(new_cache, efs->cache, efs->cache_size * sizeof(*efs->cache));
+        portENTER_CRITICAL(&efs->fd_mux);
+        vfs_littlefs_file_t ** old_cache = efs->cache;
         efs->cache = new_cache;
         efs->cache_size = new_size;
+        portEXIT_CRITICAL(&efs->fd_mux);
+        free(old_cache);
     }
+#endif
 
 
     /* Allocate file descriptor here now */
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
-    *file = low_calloc(1, sizeof(**file) + path_len);
+    *file = esp_littlefs_obj_alloc(fd_pool, sizeof(**file) + path_len);
 #else
-    *file = low_calloc(1, sizeof(**file));
+    *file = esp_littlefs_obj_alloc(fd_pool, sizeof(**file));
 #endif
 
     if (*file == NULL) {
@@ -708,6 +2279,16 @@ static int esp_littlefs_allocate_fd(esp_littlefs_t *efs, vfs_littlefs_file_t **
         ESP_LOGE(TAG, "Unable to allocate FD");
         return -1; 
     }
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    (*file)->drained = xSemaphoreCreateBinaryStatic(&(*file)->drained_buf);
+#else
+    (*file)->drained = xSemaphoreCreateBinary();
+    if ((*file)->drained == NULL) {
+        ESP_LOGE(TAG, "Unable to allocate FD");
+        esp_littlefs_obj_free(fd_pool, *file);
+        return -1;
+    }
+#endif
 
     /* Starting from here, nothing can fail anymore */
 
@@ -768,11 +2349,14 @@ static int esp_littlefs_free_fd(esp_littlefs_t *efs, int fd){
         /* Transaction starts here and can't fail anymore */ 
         head->next = file->next;
     }
+    portENTER_CRITICAL(&efs->fd_mux);
     efs->cache[fd] = NULL;
+    portEXIT_CRITICAL(&efs->fd_mux);
     efs->fd_count--;
 
     ESP_LOGD(TAG, "Clearing FD");
-    free(file);
+    vSemaphoreDelete(file->drained);
+    esp_littlefs_obj_free(fd_pool, file);
 
 #if 0
     /* Realloc smaller if its possible
@@ -856,6 +2440,86 @@ static int esp_littlefs_get_fd_by_name(esp_littlefs_t *efs, const char *path){
     return -1;
 }
 
+#if CONFIG_LITTLEFS_INTROSPECT
+/**
+ * @brief Locate a path in ESP_LITTLEFS_VDIR.
+ * @return the file name within it, "" for the directory itself, or NULL if
+ *         path is outside of it.
+ */
+static const char * esp_littlefs_vpath(const char *path) {
+    const size_t len = sizeof(ESP_LITTLEFS_VDIR) - 1;
+
+    if(strncmp(path, ESP_LITTLEFS_VDIR, len) != 0) return NULL;
+    if(path[len] == '\0') return path + len;
+    if(path[len] != '/') return NULL;
+    return path + len + 1;
+}
+
+/**
+ * @brief Open a file of ESP_LITTLEFS_VDIR. Its contents are rendered once,
+ *        here, so reads see one consistent copy and never touch flash.
+ * @return FD, or -1 with errno set.
+ */
+static int esp_littlefs_vfile_open(esp_littlefs_t *efs, const char *path, const char *name, int flags) {
+    vfs_littlefs_file_t *file = NULL;
+    char *buf;
+    int fd = -1, len;
+#ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
+    size_t path_len = strlen(path) + 1;
+#endif
+
+    if((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC | O_APPEND))) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
+        return -1;
+    }
+#if CONFIG_LITTLEFS_STATIC_ALLOC && !defined(CONFIG_LITTLEFS_USE_ONLY_HASH)
+    if(path_len > CONFIG_LITTLEFS_OBJ_NAME_LEN) {
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_NAMETOOLONG);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+#endif
+
+    buf = low_calloc(1, CONFIG_LITTLEFS_INTROSPECT_BUF_SIZE);
+    if(buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    sem_take(efs);
+    len = esp_littlefs_vfile_render(efs, name, buf, CONFIG_LITTLEFS_INTROSPECT_BUF_SIZE);
+    if(len < 0) {
+        ESP_LITTLEFS_STATS_ERROR(efs, *name ? LFS_ERR_NOENT : LFS_ERR_ISDIR);
+        errno = *name ? ENOENT : EISDIR;
+        goto exit;
+    }
+    fd = esp_littlefs_allocate_fd(efs, &file
+#ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
+    , path_len
+#endif
+    );
+    if(fd < 0) {
+        ESP_LOGE(TAG, "Error obtaining FD");
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_INVAL);
+        errno = -LFS_ERR_INVAL;
+        goto exit;
+    }
+    file->hash = compute_hash(path);
+    file->vbuf = buf;
+    file->vlen = len;
+#ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
+    memcpy(file->path, path, path_len);
+#endif
+    buf = NULL;
+
+exit:
+    sem_give(efs);
+    free(buf);
+    return fd;
+}
+#endif
+
 /*** Filesystem Hooks ***/
 
 static int vfs_littlefs_open(void* ctx, const char * path, int flags, int mode) {
@@ -865,16 +2529,41 @@ static int vfs_littlefs_open(void* ctx, const char * path, int flags, int mode)
     vfs_littlefs_file_t *file = NULL;
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
     size_t path_len = strlen(path) + 1;  // include NULL terminator
+#endif
+#if CONFIG_LITTLEFS_INTROSPECT
+    const char *vname;
 #endif
     assert(path);
 
+    ESP_LITTLEFS_STATS_OP(efs, OPEN);
+    ESP_LITTLEFS_PROF_OP(efs, OPEN, compute_hash(path));
     ESP_LOGD(TAG, "Opening %s", path);
 
+#if CONFIG_LITTLEFS_INTROSPECT
+    if((vname = esp_littlefs_vpath(path)) != NULL)
+        return esp_littlefs_vfile_open(efs, path, vname, flags);
+#endif
+
+    if(efs->read_only && (flags & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC | O_APPEND))) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
+        return -1;
+    }
+
+#if CONFIG_LITTLEFS_STATIC_ALLOC && !defined(CONFIG_LITTLEFS_USE_ONLY_HASH)
+    if(path_len > CONFIG_LITTLEFS_OBJ_NAME_LEN) {
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_NAMETOOLONG);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+#endif
+
     /* Convert flags to lfs flags */
     lfs_flags = esp_littlefs_flags_conv(flags);
 
     /* Get a FD */
     sem_take(efs);
+    ESP_LITTLEFS_AMP_SET(efs, compute_hash(path));
     fd = esp_littlefs_allocate_fd(efs, &file
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
     , path_len
@@ -883,11 +2572,13 @@ static int vfs_littlefs_open(void* ctx, const char * path, int flags, int mode)
     if(fd < 0) {
         sem_give(efs);
         ESP_LOGE(TAG, "Error obtaining FD");
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_INVAL);
         errno = -LFS_ERR_INVAL;
         return -1;
     }
     /* Open File */
-    res = lfs_file_open(efs->fs, &file->file, path, lfs_flags);
+    file->hash = compute_hash(path);
+    res = esp_littlefs_shared_open(efs, file, path, lfs_flags);
 
     if( res < 0 ) {
         esp_littlefs_free_fd(efs, fd);
@@ -895,11 +2586,11 @@ static int vfs_littlefs_open(void* ctx, const char * path, int flags, int mode)
         if(-res != ENOENT)
             ESP_LOGE(TAG, "Failed to open file. Error %s (%d)",
                     esp_littlefs_errno(res), res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
 
-    file->hash = compute_hash(path);
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
     memcpy(file->path, path, path_len);
 #endif
@@ -922,16 +2613,29 @@ static ssize_t vfs_littlefs_write(void* ctx, int fd, const void * data, size_t s
     ssize_t res;
     vfs_littlefs_file_t *file = NULL;
 
-    sem_take(efs);
-    if((uint32_t)fd > efs->cache_size) {
-        sem_give(efs);
-        ESP_LOGE(TAG, "FD %d must be <%d.", fd, efs->cache_size);
-        errno = -LFS_ERR_BADF;
+    ESP_LITTLEFS_STATS_OP(efs, WRITE);
+    ESP_LITTLEFS_PROF_OP(efs, WRITE, fd);
+    if(efs->read_only) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
         return -1;
     }
-    file = efs->cache[fd];
-    res = lfs_file_write(efs->fs, &file->file, data, size);
-    sem_give(efs);
+
+    file = esp_littlefs_get_file(efs, fd);
+    if(file == NULL) return -1;
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(file->vbuf) {
+        esp_littlefs_put_file(efs, file);
+        errno = EBADF;
+        return -1;
+    }
+#endif
+    esp_littlefs_take(efs, file->shared->lock);
+    res = esp_littlefs_file_write(efs, file, data, size);
+    xSemaphoreGive(file->shared->lock);
+    if(res > 0) ESP_LITTLEFS_STATS_ADD(efs, write_bytes, res);
+    if(res > 0) ESP_LITTLEFS_IO_USER(efs, true, res);
+    if(res > 0) ESP_LITTLEFS_AMP_USER(efs, file->hash, res);
 
     if(res < 0){
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
@@ -941,6 +2645,11 @@ static ssize_t vfs_littlefs_write(void* ctx, int fd, const void * data, size_t s
         ESP_LOGE(TAG, "Failed to write FD %d. Error %s (%d)",
                 fd, esp_littlefs_errno(res), res);
 #endif
+    }
+    esp_littlefs_put_file(efs, file);
+
+    if(res < 0){
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -953,17 +2662,24 @@ static ssize_t vfs_littlefs_read(void* ctx, int fd, void * dst, size_t size) {
     ssize_t res;
     vfs_littlefs_file_t *file = NULL;
 
-
-    sem_take(efs);
-    if((uint32_t)fd > efs->cache_size) {
-        sem_give(efs);
-        ESP_LOGE(TAG, "FD %d must be <%d.", fd, efs->cache_size);
-        errno = -LFS_ERR_BADF;
-        return -1;
+    ESP_LITTLEFS_STATS_OP(efs, READ);
+    ESP_LITTLEFS_PROF_OP(efs, READ, fd);
+    file = esp_littlefs_get_file(efs, fd);
+    if(file == NULL) return -1;
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(file->vbuf) {
+        res = file->pos < file->vlen ? MIN(size, file->vlen - file->pos) : 0;
+        memcpy(dst, file->vbuf + file->pos, res);
+        file->pos += res;
+        esp_littlefs_put_file(efs, file);
+        return res;
     }
-    file = efs->cache[fd];
-    res = lfs_file_read(efs->fs, &file->file, dst, size);
-    sem_give(efs);
+#endif
+    esp_littlefs_take(efs, file->shared->lock);
+    res = esp_littlefs_file_read(efs, file, dst, size);
+    xSemaphoreGive(file->shared->lock);
+    if(res > 0) ESP_LITTLEFS_STATS_ADD(efs, read_bytes, res);
+    if(res > 0) ESP_LITTLEFS_IO_USER(efs, false, res);
 
     if(res < 0){
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
@@ -973,6 +2689,11 @@ static ssize_t vfs_littlefs_read(void* ctx, int fd, void * dst, size_t size) {
         ESP_LOGE(TAG, "Failed to read FD %d. Error %s (%d)",
                 fd, esp_littlefs_errno(res), res);
 #endif
+    }
+    esp_littlefs_put_file(efs, file);
+
+    if(res < 0){
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -986,15 +2707,33 @@ static int vfs_littlefs_close(void* ctx, int fd) {
     int res;
     vfs_littlefs_file_t *file = NULL;
 
-    sem_take(efs);
-    if((uint32_t)fd > efs->cache_size) {
-        sem_give(efs);
-        ESP_LOGE(TAG, "FD %d must be <%d.", fd, efs->cache_size);
+    ESP_LITTLEFS_STATS_OP(efs, CLOSE);
+    ESP_LITTLEFS_PROF_OP(efs, CLOSE, fd);
+    file = esp_littlefs_get_file(efs, fd);
+    if(file == NULL) return -1;
+
+    /* Other hooks on this FD finish first; our hold keeps it from being freed under them */
+    if(!esp_littlefs_file_drain(efs, file)) {
+        esp_littlefs_put_file(efs, file);
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_BADF);
         errno = -LFS_ERR_BADF;
         return -1;
     }
-    file = efs->cache[fd];
-    res = lfs_file_close(efs->fs, &file->file);
+
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(file->vbuf) {
+        char *vbuf = file->vbuf;
+        sem_take(efs);
+        esp_littlefs_free_fd(efs, fd);
+        sem_give(efs);
+        free(vbuf);
+        return 0;
+    }
+#endif
+
+    sem_take(efs);
+    ESP_LITTLEFS_AMP_SET(efs, file->hash);
+    res = esp_littlefs_shared_close(efs, file);
     if(res < 0){
         sem_give(efs);
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
@@ -1004,6 +2743,12 @@ static int vfs_littlefs_close(void* ctx, int fd) {
         ESP_LOGE(TAG, "Failed to close Fd %d. Error %s (%d)",
                 fd, esp_littlefs_errno(res), res);
 #endif
+        /* Still open; let it be used and closed again */
+        portENTER_CRITICAL(&efs->fd_mux);
+        file->closing = false;
+        file->busy--;
+        portEXIT_CRITICAL(&efs->fd_mux);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1018,25 +2763,36 @@ static off_t vfs_littlefs_lseek(void* ctx, int fd, off_t offset, int mode) {
     vfs_littlefs_file_t *file = NULL;
     int whence;
 
+    ESP_LITTLEFS_STATS_OP(efs, LSEEK);
+    ESP_LITTLEFS_PROF_OP(efs, LSEEK, fd);
     switch (mode) {
         case SEEK_SET: whence = LFS_SEEK_SET; break;
         case SEEK_CUR: whence = LFS_SEEK_CUR; break;
         case SEEK_END: whence = LFS_SEEK_END; break;
         default: 
             ESP_LOGE(TAG, "Invalid mode");
+            ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_INVAL);
+            errno = EINVAL;
             return -1;
     }
 
-    sem_take(efs);
-    if((uint32_t)fd > efs->cache_size) {
-        sem_give(efs);
-        ESP_LOGE(TAG, "FD %d must be <%d.", fd, efs->cache_size);
-        errno = -LFS_ERR_BADF;
-        return -1;
+    file = esp_littlefs_get_file(efs, fd);
+    if(file == NULL) return -1;
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(file->vbuf) {
+        res = offset + (whence == LFS_SEEK_CUR ? file->pos : whence == LFS_SEEK_END ? file->vlen : 0);
+        if(res >= 0) file->pos = res;
+        esp_littlefs_put_file(efs, file);
+        if(res < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        return res;
     }
-    file = efs->cache[fd];
-    res = lfs_file_seek(efs->fs, &file->file, offset, whence);
-    sem_give(efs);
+#endif
+    esp_littlefs_take(efs, file->shared->lock);
+    res = esp_littlefs_file_seek(efs, file, offset, whence);
+    xSemaphoreGive(file->shared->lock);
 
     if(res < 0){
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
@@ -1046,6 +2802,11 @@ static off_t vfs_littlefs_lseek(void* ctx, int fd, off_t offset, int mode) {
         ESP_LOGE(TAG, "Failed to seek FD %d to offset %08x. Error (%d)",
                 fd, (unsigned int)offset, res);
 #endif
+    }
+    esp_littlefs_put_file(efs, file);
+
+    if(res < 0){
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1059,18 +2820,21 @@ static int vfs_littlefs_fsync(void* ctx, int fd)
     ssize_t res;
     vfs_littlefs_file_t *file = NULL;
 
-
-
-    sem_take(efs);
-    if((uint32_t)fd > efs->cache_size) {
-        sem_give(efs);
-        ESP_LOGE(TAG, "FD %d must be <%d.", fd, efs->cache_size);
-        errno = -LFS_ERR_BADF;
-        return -1;
+    ESP_LITTLEFS_STATS_OP(efs, FSYNC);
+    ESP_LITTLEFS_PROF_OP(efs, FSYNC, fd);
+    file = esp_littlefs_get_file(efs, fd);
+    if(file == NULL) return -1;
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(file->vbuf) {
+        esp_littlefs_put_file(efs, file);
+        return 0;
     }
-    file = efs->cache[fd];
-    res = lfs_file_sync(efs->fs, &file->file);
-    sem_give(efs);
+#endif
+    esp_littlefs_take(efs, file->shared->lock);
+    esp_littlefs_fs_take(efs, file);
+    res = lfs_file_sync(esp_littlefs_file_fs(efs, file), &file->shared->file);
+    esp_littlefs_fs_give(efs, file);
+    xSemaphoreGive(file->shared->lock);
 
     if(res < 0){
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
@@ -1079,6 +2843,11 @@ static int vfs_littlefs_fsync(void* ctx, int fd)
 #else
         ESP_LOGE(TAG, "Failed to sync file %d. Error %d", fd, res);
 #endif
+    }
+    esp_littlefs_put_file(efs, file);
+
+    if(res < 0){
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1094,32 +2863,38 @@ static int vfs_littlefs_fstat(void* ctx, int fd, struct stat * st) {
     int res;
     vfs_littlefs_file_t *file = NULL;
 
+    ESP_LITTLEFS_STATS_OP(efs, FSTAT);
+    ESP_LITTLEFS_PROF_OP(efs, FSTAT, fd);
     memset(st, 0, sizeof(struct stat));
     st->st_blksize = efs->cfg.block_size;
 
-    sem_take(efs);
-    if((uint32_t)fd > efs->cache_size) {
-        sem_give(efs);
-        ESP_LOGE(TAG, "FD must be <%d.", efs->cache_size);
-        errno = -LFS_ERR_BADF;
-        return -1;
+    file = esp_littlefs_get_file(efs, fd);
+    if(file == NULL) return -1;
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(file->vbuf) {
+        st->st_size = file->vlen;
+        st->st_mode = S_IFREG;
+        esp_littlefs_put_file(efs, file);
+        return 0;
     }
-    file = efs->cache[fd];
-    res = lfs_stat(efs->fs, file->path, &info);
+#endif
+    esp_littlefs_fs_take(efs, file);
+    res = lfs_stat(esp_littlefs_file_fs(efs, file), file->path, &info);
+    esp_littlefs_fs_give(efs, file);
     if (res < 0) {
-        sem_give(efs);
         if(-res != ENOENT)
             ESP_LOGE(TAG, "Failed to stat file \"%s\". Error %s (%d)",
                     file->path, esp_littlefs_errno(res), res);
+        esp_littlefs_put_file(efs, file);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
 
-    sem_give(efs);
-
 #if CONFIG_LITTLEFS_USE_MTIME  
     st->st_mtime = vfs_littlefs_get_mtime(efs, file->path);
 #endif
+    esp_littlefs_put_file(efs, file);
     st->st_size = info.size;
     st->st_mode = ((info.type==LFS_TYPE_REG)?S_IFREG:S_IFDIR);
     return 0;
@@ -1132,9 +2907,31 @@ static int vfs_littlefs_stat(void* ctx, const char * path, struct stat * st) {
     struct lfs_info info;
     int res;
 
+    ESP_LITTLEFS_STATS_OP(efs, STAT);
+    ESP_LITTLEFS_PROF_OP(efs, STAT, compute_hash(path));
     memset(st, 0, sizeof(struct stat));
     st->st_blksize = efs->cfg.block_size;
 
+#if CONFIG_LITTLEFS_INTROSPECT
+    const char *vname = esp_littlefs_vpath(path);
+    if(vname != NULL) {
+        /* Like procfs, the size of a file is only known once it is read */
+        if(*vname == '\0') {
+            st->st_mode = S_IFDIR;
+            return 0;
+        }
+        for(int i=0; esp_littlefs_vfile_name(i); i++) {
+            if(strcmp(vname, esp_littlefs_vfile_name(i)) == 0) {
+                st->st_mode = S_IFREG;
+                return 0;
+            }
+        }
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_NOENT);
+        errno = ENOENT;
+        return -1;
+    }
+#endif
+
     sem_take(efs);
     res = lfs_stat(efs->fs, path, &info);
     sem_give(efs);
@@ -1143,6 +2940,7 @@ static int vfs_littlefs_stat(void* ctx, const char * path, struct stat * st) {
          * if a file exists */
         ESP_LOGI(TAG, "Failed to stat path \"%s\". Error %s (%d)",
                 path, esp_littlefs_errno(res), res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1161,12 +2959,22 @@ static int vfs_littlefs_unlink(void* ctx, const char *path) {
     struct lfs_info info;
     int res;
 
+    ESP_LITTLEFS_STATS_OP(efs, UNLINK);
+    ESP_LITTLEFS_PROF_OP(efs, UNLINK, compute_hash(path));
+    if(efs->read_only) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
+        return -1;
+    }
+
     sem_take(efs);
+    ESP_LITTLEFS_AMP_SET(efs, compute_hash(path));
     res = lfs_stat(efs->fs, path, &info);
     if (res < 0) {
         sem_give(efs);
         ESP_LOGE(TAG, fail_str_1 " Error %s (%d)",
                 path, esp_littlefs_errno(res), res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1174,13 +2982,15 @@ static int vfs_littlefs_unlink(void* ctx, const char *path) {
     if(esp_littlefs_get_fd_by_name(efs, path) >= 0) {
         sem_give(efs);
         ESP_LOGE(TAG, fail_str_1 " Has open FD.", path);
-        errno = -res;
+        ESP_LITTLEFS_STATS_ERROR(efs, -EBUSY);
+        errno = EBUSY;
         return -1;
     }
 
     if (info.type == LFS_TYPE_DIR) {
         sem_give(efs);
         ESP_LOGE(TAG, "Cannot unlink a directory.");
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_ISDIR);
         errno = -LFS_ERR_ISDIR;
         return -1;
     }
@@ -1191,6 +3001,7 @@ static int vfs_littlefs_unlink(void* ctx, const char *path) {
         if(-res != ENOENT)
             ESP_LOGE(TAG, fail_str_1 " Error %s (%d)",
                     path, esp_littlefs_errno(res), res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1205,17 +3016,28 @@ static int vfs_littlefs_rename(void* ctx, const char *src, const char *dst) {
     esp_littlefs_t * efs = (esp_littlefs_t *)ctx;
     int res;
 
+    ESP_LITTLEFS_STATS_OP(efs, RENAME);
+    ESP_LITTLEFS_PROF_OP(efs, RENAME, compute_hash(src));
+    if(efs->read_only) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
+        return -1;
+    }
+
     sem_take(efs);
+    ESP_LITTLEFS_AMP_SET(efs, compute_hash(src));
 
     if(esp_littlefs_get_fd_by_name(efs, src) >= 0){
         sem_give(efs);
         ESP_LOGE(TAG, "Cannot rename; src \"%s\" is open.", src);
+        ESP_LITTLEFS_STATS_ERROR(efs, -EBUSY);
         errno = EBUSY;
         return -1;
     }
     else if(esp_littlefs_get_fd_by_name(efs, dst) >= 0){
         sem_give(efs);
         ESP_LOGE(TAG, "Cannot rename; dst \"%s\" is open.", dst);
+        ESP_LITTLEFS_STATS_ERROR(efs, -EBUSY);
         errno = EBUSY;
         return -1;
     }
@@ -1225,6 +3047,7 @@ static int vfs_littlefs_rename(void* ctx, const char *src, const char *dst) {
     if (res < 0) {
         ESP_LOGE(TAG, "Failed to rename \"%s\" -> \"%s\". Error %s (%d)",
                 src, dst, esp_littlefs_errno(res), res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1237,17 +3060,37 @@ static DIR* vfs_littlefs_opendir(void* ctx, const char* name) {
     int res;
     vfs_littlefs_dir_t *dir = NULL;
 
-    dir = low_calloc(1, sizeof(vfs_littlefs_dir_t));
+    size_t path_len = strlen(name) + 1;
+    ESP_LITTLEFS_STATS_OP(efs, OPENDIR);
+    ESP_LITTLEFS_PROF_OP(efs, OPENDIR, compute_hash(name));
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    if(path_len > CONFIG_LITTLEFS_OBJ_NAME_LEN) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+#endif
+    dir = esp_littlefs_obj_alloc(dir_pool, sizeof(vfs_littlefs_dir_t) + path_len);
     if( dir == NULL ) {
         ESP_LOGE(TAG, "dir struct could not be malloced");
+        errno = ENOMEM;
         goto exit;
     }
 
-    dir->path = strdup(name);
-    if(dir->path == NULL){
-        ESP_LOGE(TAG, "dir path name could not be malloced");
-        goto exit;
+    /* Same trick as the FD path, see esp_littlefs_allocate_fd */
+    dir->path = (char*)dir + sizeof(*dir);
+    memcpy(dir->path, name, path_len);
+
+#if CONFIG_LITTLEFS_INTROSPECT
+    const char *vname = esp_littlefs_vpath(name);
+    if(vname != NULL) {
+        if(*vname != '\0') {
+            errno = ENOTDIR;
+            goto exit;
+        }
+        dir->virt = true;
+        return (DIR *)dir;
     }
+#endif
 
     sem_take(efs);
     res = lfs_dir_open(efs->fs, &dir->d, dir->path);
@@ -1275,6 +3118,14 @@ static int vfs_littlefs_closedir(void* ctx, DIR* pdir) {
     vfs_littlefs_dir_t * dir = (vfs_littlefs_dir_t *) pdir;
     int res;
 
+    ESP_LITTLEFS_STATS_OP(efs, CLOSEDIR);
+    ESP_LITTLEFS_PROF_OP(efs, CLOSEDIR, 0);
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(dir->virt) {
+        esp_littlefs_dir_free(dir);
+        return 0;
+    }
+#endif
     sem_take(efs);
     res = lfs_dir_close(efs->fs, &dir->d);
     sem_give(efs);
@@ -1285,6 +3136,7 @@ static int vfs_littlefs_closedir(void* ctx, DIR* pdir) {
 #else
         ESP_LOGE(TAG, "Failed to closedir \"%s\". Error %d", dir->path, res);
 #endif
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1312,6 +3164,23 @@ static int vfs_littlefs_readdir_r(void* ctx, DIR* pdir,
     int res;
     struct lfs_info info = { 0 };
 
+    ESP_LITTLEFS_STATS_OP(efs, READDIR);
+    ESP_LITTLEFS_PROF_OP(efs, READDIR, 0);
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(dir->virt) {
+        const char *vname = esp_littlefs_vfile_name(dir->offset);
+        if(vname == NULL) {
+            *out_dirent = NULL;
+            return 0;
+        }
+        entry->d_ino = 0;
+        entry->d_type = DT_REG;
+        strncpy(entry->d_name, vname, sizeof(entry->d_name));
+        *out_dirent = entry;
+        dir->offset++;
+        return 0;
+    }
+#endif
     sem_take(efs);
     do{ /* Read until we get a real object name */
         res = lfs_dir_read(efs->fs, &dir->d, &info);
@@ -1324,6 +3193,7 @@ static int vfs_littlefs_readdir_r(void* ctx, DIR* pdir,
 #else
         ESP_LOGE(TAG, "Failed to readdir \"%s\". Error %d", dir->path, res);
 #endif
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1354,7 +3224,11 @@ static int vfs_littlefs_readdir_r(void* ctx, DIR* pdir,
 
 static long vfs_littlefs_telldir(void* ctx, DIR* pdir) {
     assert(pdir);
+    esp_littlefs_t * efs = (esp_littlefs_t *)ctx;
     vfs_littlefs_dir_t * dir = (vfs_littlefs_dir_t *) pdir;
+
+    ESP_LITTLEFS_STATS_OP(efs, TELLDIR);
+    ESP_LITTLEFS_PROF_OP(efs, TELLDIR, 0);
     return dir->offset;
 }
 
@@ -1364,6 +3238,14 @@ static void vfs_littlefs_seekdir(void* ctx, DIR* pdir, long offset) {
     vfs_littlefs_dir_t * dir = (vfs_littlefs_dir_t *) pdir;
     int res;
 
+    ESP_LITTLEFS_STATS_OP(efs, SEEKDIR);
+    ESP_LITTLEFS_PROF_OP(efs, SEEKDIR, 0);
+#if CONFIG_LITTLEFS_INTROSPECT
+    if(dir->virt) {
+        dir->offset = offset;
+        return;
+    }
+#endif
     if (offset < dir->offset) {
         /* close and re-open dir to rewind to beginning */
         sem_take(efs);
@@ -1393,13 +3275,23 @@ static int vfs_littlefs_mkdir(void* ctx, const char* name, mode_t mode) {
     int res;
     ESP_LOGD(TAG, "mkdir \"%s\"", name);
 
+    ESP_LITTLEFS_STATS_OP(efs, MKDIR);
+    ESP_LITTLEFS_PROF_OP(efs, MKDIR, compute_hash(name));
+    if(efs->read_only) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
+        return -1;
+    }
+
     sem_take(efs);
+    ESP_LITTLEFS_AMP_SET(efs, compute_hash(name));
     res = lfs_mkdir(efs->fs, name);
     sem_give(efs);
     if (res < 0) {
         if(-res != EEXIST)
             ESP_LOGE(TAG, "Failed to mkdir \"%s\". Error %s (%d)",
                     name, esp_littlefs_errno(res), res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1411,12 +3303,22 @@ static int vfs_littlefs_rmdir(void* ctx, const char* name) {
     struct lfs_info info;
     int res;
 
+    ESP_LITTLEFS_STATS_OP(efs, RMDIR);
+    ESP_LITTLEFS_PROF_OP(efs, RMDIR, compute_hash(name));
+    if(efs->read_only) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
+        return -1;
+    }
+
     /* Error Checking */
     sem_take(efs);
+    ESP_LITTLEFS_AMP_SET(efs, compute_hash(name));
     res = lfs_stat(efs->fs, name, &info);
     if (res < 0) {
         sem_give(efs);
         ESP_LOGE(TAG, "\"%s\" doesn't exist.", name);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1424,6 +3326,7 @@ static int vfs_littlefs_rmdir(void* ctx, const char* name) {
     if (info.type != LFS_TYPE_DIR) {
         sem_give(efs);
         ESP_LOGE(TAG, "\"%s\" is not a directory.", name);
+        ESP_LITTLEFS_STATS_ERROR(efs, LFS_ERR_NOTDIR);
         errno = ENOTDIR;
         return -1;
     }
@@ -1434,6 +3337,7 @@ static int vfs_littlefs_rmdir(void* ctx, const char* name) {
     if ( res < 0) {
         ESP_LOGE(TAG, "Failed to unlink path \"%s\". Error %s (%d)",
                 name, esp_littlefs_errno(res), res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1449,11 +3353,13 @@ static int vfs_littlefs_update_mtime_value(esp_littlefs_t *efs, const char *path
 {
     int res;
     sem_take(efs);
+    ESP_LITTLEFS_AMP_SET(efs, compute_hash(path));
     res = lfs_setattr(efs->fs, path, LITTLEFS_ATTR_MTIME,
             &t, sizeof(t));
     sem_give(efs);
     if( res < 0 ) {
         ESP_LOGE(TAG, "Failed to update mtime (%d)", res);
+        ESP_LITTLEFS_STATS_ERROR(efs, res);
         errno = -res;
         return -1;
     }
@@ -1464,38 +3370,44 @@ static int vfs_littlefs_update_mtime_value(esp_littlefs_t *efs, const char *path
 /**
  * Sets the mtime attr to an appropriate value
  */
-static void vfs_littlefs_update_mtime(esp_littlefs_t *efs, const char *path)
+static int vfs_littlefs_update_mtime(esp_littlefs_t *efs, const char *path)
 {
-    vfs_littlefs_utime(efs, path, NULL);
+    time_t t;
+#if CONFIG_LITTLEFS_MTIME_USE_SECONDS
+    // use current time
+    t = time(NULL);
+#elif CONFIG_LITTLEFS_MTIME_USE_NONCE
+    assert( sizeof(time_t) == 4 );
+    t = vfs_littlefs_get_mtime(efs, path);
+    if( 0 == t ) t = esp_random();
+    else t += 1;
+
+    if( 0 == t ) t = 1;
+#else
+#error "Invalid MTIME configuration"
+#endif
+    return vfs_littlefs_update_mtime_value(efs, path, t);
 }
 
 
 static int vfs_littlefs_utime(void *ctx, const char *path, const struct utimbuf *times)
 {
     esp_littlefs_t * efs = (esp_littlefs_t *)ctx;
-    time_t t;
 
     assert(path);
 
-    if (times) {
-        t = times->modtime;
-    } else {
-#if CONFIG_LITTLEFS_MTIME_USE_SECONDS
-        // use current time
-        t = time(NULL);
-#elif CONFIG_LITTLEFS_MTIME_USE_NONCE
-        assert( sizeof(time_t) == 4 );
-        t = vfs_littlefs_get_mtime(efs, path);
-        if( 0 == t ) t = esp_random();
-        else t += 1;
-
-        if( 0 == t ) t = 1;
-#else
-#error "Invalid MTIME configuration"
-#endif
+    ESP_LITTLEFS_STATS_OP(efs, UTIME);
+    ESP_LITTLEFS_PROF_OP(efs, UTIME, compute_hash(path));
+    if(efs->read_only) {
+        ESP_LITTLEFS_STATS_ERROR(efs, -EROFS);
+        errno = EROFS;
+        return -1;
     }
 
-    return vfs_littlefs_update_mtime_value(efs, path, t);
+    if (times) {
+        return vfs_littlefs_update_mtime_value(efs, path, times->modtime);
+    }
+    return vfs_littlefs_update_mtime(efs, path);
 }
 
 static time_t vfs_littlefs_get_mtime(esp_littlefs_t *efs, const char *path)
@@ -0,0 +1,121 @@
+/**
+ * @file littlefs_amp.c
+ * @brief Attribution of flash programs and erases to the files that cause them
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_littlefs.h"
+#include "littlefs_api.h"
+
+#if CONFIG_LITTLEFS_AMP
+
+/**
+ * @brief Find the entry of a file, making room for it if needed.
+ * @warning This must be called with amp->mux held
+ */
+static esp_littlefs_amp_file_t * esp_littlefs_amp_file(esp_littlefs_amp_state_t *amp, uint32_t hash) {
+    esp_littlefs_amp_file_t *f;
+    uint8_t victim = 0;
+
+    amp->clock++;
+    for(uint8_t i=0; i < amp->file_count; i++) {
+        if(amp->files[i].hash == hash) {
+            amp->used[i] = amp->clock;
+            return &amp->files[i];
+        }
+    }
+    if(amp->file_count < ESP_LITTLEFS_AMP_FILES) {
+        victim = amp->file_count++;
+    }
+    else {
+        /* Drop the file touched least recently; a file that was just added
+         * would be the cheapest and keep being replaced */
+        for(uint8_t i=1; i < ESP_LITTLEFS_AMP_FILES; i++) {
+            if(amp->clock - amp->used[i] > amp->clock - amp->used[victim]) victim = i;
+        }
+        amp->evicted++;
+    }
+    f = &amp->files[victim];
+    memset(f, 0, sizeof(*f));
+    f->hash = hash;
+    amp->used[victim] = amp->clock;
+    return f;
+}
+
+void esp_littlefs_amp_user(esp_littlefs_t *efs, uint32_t hash, size_t bytes) {
+    esp_littlefs_amp_state_t *amp = &efs->amp;
+
+    portENTER_CRITICAL(&amp->mux);
+    amp->user_bytes += bytes;
+    esp_littlefs_amp_file(amp, hash)->user_bytes += bytes;
+    portEXIT_CRITICAL(&amp->mux);
+}
+
+void esp_littlefs_amp_flash(esp_littlefs_t *efs, size_t prog_bytes, size_t erase_bytes) {
+    esp_littlefs_amp_state_t *amp = &efs->amp;
+
+    portENTER_CRITICAL(&amp->mux);
+    amp->prog_bytes += prog_bytes;
+    amp->erase_bytes += erase_bytes;
+    if(amp->cur_set) {
+        esp_littlefs_amp_file_t *f = esp_littlefs_amp_file(amp, amp->cur_hash);
+        f->prog_bytes += prog_bytes;
+        f->erase_bytes += erase_bytes;
+    }
+    else {
+        amp->other_prog_bytes += prog_bytes;
+        amp->other_erase_bytes += erase_bytes;
+    }
+    portEXIT_CRITICAL(&amp->mux);
+}
+
+void esp_littlefs_amp_report(esp_littlefs_t *efs, esp_littlefs_amp_t *out) {
+    esp_littlefs_amp_state_t *amp = &efs->amp;
+
+    memset(out, 0, sizeof(*out));
+    portENTER_CRITICAL(&amp->mux);
+    out->user_bytes = amp->user_bytes;
+    out->prog_bytes = amp->prog_bytes;
+    out->erase_bytes = amp->erase_bytes;
+    out->other_prog_bytes = amp->other_prog_bytes;
+    out->other_erase_bytes = amp->other_erase_bytes;
+    out->evicted = amp->evicted;
+    out->file_count = amp->file_count;
+    memcpy(out->files, amp->files, amp->file_count * sizeof(amp->files[0]));
+    portEXIT_CRITICAL(&amp->mux);
+
+    if(out->user_bytes) {
+        out->write_amp = (float)out->prog_bytes / out->user_bytes;
+        out->erase_amp = (float)out->erase_bytes / out->user_bytes;
+    }
+
+    /* Most programmed first */
+    for(uint8_t i=0; i < out->file_count; i++) {
+        esp_littlefs_amp_file_t f = out->files[i];
+        int j = i;
+        if(f.user_bytes) {
+            f.write_amp = (float)f.prog_bytes / f.user_bytes;
+            f.erase_amp = (float)f.erase_bytes / f.user_bytes;
+        }
+        for(; j > 0 && out->files[j - 1].prog_bytes < f.prog_bytes; j--)
+            out->files[j] = out->files[j - 1];
+        out->files[j] = f;
+    }
+}
+
+void esp_littlefs_amp_clear(esp_littlefs_t *efs) {
+    esp_littlefs_amp_state_t *amp = &efs->amp;
+
+    portENTER_CRITICAL(&amp->mux);
+    amp->user_bytes = 0;
+    amp->prog_bytes = 0;
+    amp->erase_bytes = 0;
+    amp->other_prog_bytes = 0;
+    amp->other_erase_bytes = 0;
+    amp->evicted = 0;
+    amp->file_count = 0;
+    portEXIT_CRITICAL(&amp->mux);
+}
+
+#endif
@@ -8,6 +8,7 @@
 
 #include "esp_log.h"
 #include "esp_partition.h"
+#include <sys/param.h>
 #include "esp_vfs.h"
 #include "littlefs/lfs.h"
 #include "esp_littlefs.h"
@@ -15,92 +16,380 @@
 
 #include "data_spiflash.h"
 #include "config.h"
+#include "alloc.h"
+
+#if CONFIG_LITTLEFS_BOUNCE
+#include "soc/soc_memory_layout.h"
+#endif
 
 extern int gFSPos;
 
 static const char TAG[] = "esp_littlefs_api";
 
-int littlefs_api_read(const struct lfs_config *c, lfs_block_t block,
-        lfs_off_t off, void *buffer, lfs_size_t size)
+/* Backends; each gets its own read/prog/erase below, so the backend and
+ * its geometry are constants the compiler folds into the call */
+#define BD_INTERNAL 0
+#define BD_EXTERNAL 1
+
+/* Both backends erase 4 KB sectors, so block * BD_BLOCK_SIZE is a shift */
+#define BD_BLOCK_SIZE CONFIG_LITTLEFS_BLOCK_SIZE
+_Static_assert(DATA_SPIFLASH_ERASE_4KB == BD_BLOCK_SIZE, "external flash sector is not a block");
+
+#define BD_INLINE static inline __attribute__((always_inline))
+
+/* The backend's driver call for a read of part_off */
+BD_INLINE esp_err_t bd_flash_read(const int backend, esp_littlefs_t *efs,
+        size_t part_off, void *buffer, size_t size)
 {
-    if(size > 1024)
+#ifndef CONFIG_NEONIOUS_ONE
+    if(backend == BD_INTERNAL) return spi_flash_read(gFSPos + part_off, buffer, size);
+#endif /* CONFIG_NEONIOUS_ONE */
+
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    esp_littlefs_xfer_read(efs->xfer, part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, buffer, size);
+#else
+    // Split up... Not sure why LittleFS sometimes ignores the read size, but lets handle it
+    for(size_t done = 0; done < size; done += ESP_LITTLEFS_EXTERNAL_MAX_READ)
     {
-        // Split up... Not sure why LittleFS sometimes ignores the read size, but lets handle it
-        for(int i = 0; i + 1024 <= size; i += 1024)
-        {
-            int j = size - i;
-            if(j > 1024)
-                j = 1024;
-            int ret = littlefs_api_read(c, block, off + i, ((unsigned char *)buffer) + i, j);
-            if(ret != 0)
-                return ret;
-        }
-        return 0;
+        data_spiflash_read(part_off + done + CONFIG_CLIENT_SIZE_DATA_OFFSET,
+                (uint8_t *)buffer + done, MIN(size - done, ESP_LITTLEFS_EXTERNAL_MAX_READ));
     }
+#endif
+    return ESP_OK;
+}
 
-    esp_littlefs_t * efs = c->context;
-    size_t part_off = (block * c->block_size) + off;
-
+/* The backend's driver call for a program of part_off */
+BD_INLINE esp_err_t bd_flash_prog(const int backend, esp_littlefs_t *efs,
+        size_t part_off, const void *buffer, size_t size)
+{
 #ifndef CONFIG_NEONIOUS_ONE
-    if(efs->internal_version)
-    {
+    if(backend == BD_INTERNAL) return spi_flash_write(gFSPos + part_off, buffer, size);
+#endif /* CONFIG_NEONIOUS_ONE */
 
-        esp_err_t err = spi_flash_read(gFSPos + part_off, buffer, size);
-        if (err) {
-            ESP_LOGE(TAG, "failed to read addr %08x, size %08x, err %d", part_off, size, err);
-            return LFS_ERR_IO;
-        }
-        return 0;
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    esp_littlefs_xfer_prog(efs->xfer, part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, buffer, size);
+#else
+    data_spiflash_write(part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, buffer, size);
+#endif
+    return ESP_OK;
+}
+
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+/* External programs and erases return once queued; the transfer task times
+ * them and charges the task that queued them */
+#define BD_TIMED_WRITE(backend) ((backend) == BD_INTERNAL)
+#else
+#define BD_TIMED_WRITE(backend) 1
+#endif
+
+#if CONFIG_LITTLEFS_BOUNCE
+/* Static, so in internal DRAM where the drivers can DMA */
+ESP_LITTLEFS_POOL_DEFINE(bounce_pool, CONFIG_LITTLEFS_BOUNCE_BUF_SIZE, CONFIG_LITTLEFS_BOUNCE_BUFS);
+
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+/* External programs are already copied into a transfer buffer when queued */
+#define BD_BOUNCE_PROG(backend) ((backend) == BD_INTERNAL)
+#else
+#define BD_BOUNCE_PROG(backend) 1
+#endif
+
+/* Reads into a buffer the drivers can't DMA to go through a bounce buffer in
+ * large pieces; if all are taken, straight to the driver */
+BD_INLINE esp_err_t bd_bounce_read(const int backend, esp_littlefs_t *efs,
+        size_t part_off, void *buffer, size_t size)
+{
+    esp_err_t err = ESP_OK;
+    uint8_t *bounce;
+
+    if(esp_ptr_dma_capable(buffer)) return bd_flash_read(backend, efs, part_off, buffer, size);
+    bounce = esp_littlefs_pool_take(&bounce_pool);
+    if(bounce == NULL) return bd_flash_read(backend, efs, part_off, buffer, size);
+    for(size_t done = 0; done < size && err == ESP_OK; done += CONFIG_LITTLEFS_BOUNCE_BUF_SIZE) {
+        size_t n = MIN(size - done, CONFIG_LITTLEFS_BOUNCE_BUF_SIZE);
+        err = bd_flash_read(backend, efs, part_off + done, bounce, n);
+        memcpy((uint8_t *)buffer + done, bounce, n);
     }
-#endif /* CONFIG_NEONIOUS_ONE */
+    esp_littlefs_pool_free(&bounce_pool, bounce);
+    return err;
+}
+
+BD_INLINE esp_err_t bd_bounce_prog(const int backend, esp_littlefs_t *efs,
+        size_t part_off, const void *buffer, size_t size)
+{
+    esp_err_t err = ESP_OK;
+    uint8_t *bounce;
+
+    if(!BD_BOUNCE_PROG(backend) || esp_ptr_dma_capable(buffer))
+        return bd_flash_prog(backend, efs, part_off, buffer, size);
+    bounce = esp_littlefs_pool_take(&bounce_pool);
+    if(bounce == NULL) return bd_flash_prog(backend, efs, part_off, buffer, size);
+    for(size_t done = 0; done < size && err == ESP_OK; done += CONFIG_LITTLEFS_BOUNCE_BUF_SIZE) {
+        size_t n = MIN(size - done, CONFIG_LITTLEFS_BOUNCE_BUF_SIZE);
+        memcpy(bounce, (const uint8_t *)buffer + done, n);
+        err = bd_flash_prog(backend, efs, part_off + done, bounce, n);
+    }
+    esp_littlefs_pool_free(&bounce_pool, bounce);
+    return err;
+}
+#else
+#define bd_bounce_read bd_flash_read
+#define bd_bounce_prog bd_flash_prog
+#endif
 
-    data_spiflash_read(part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, buffer, size);
+BD_INLINE int bd_read(const int backend, const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size)
+{
+    esp_littlefs_t * efs = c->context;
+    size_t part_off = block * BD_BLOCK_SIZE + off;
+
+    ESP_LITTLEFS_STATS_ADD(efs, flash_reads, 1);
+    ESP_LITTLEFS_STATS_ADD(efs, flash_read_bytes, size);
+    if(efs->mount_t0) esp_littlefs_mount_read(efs, block);
+
+    /* Read-only mounts read from several tasks without the mount lock. The
+     * external driver (and the transfer task's prefetch) can't take that. */
+    bool locked = backend == BD_EXTERNAL && efs->bd_lock;
+    if(locked) xSemaphoreTake(efs->bd_lock, portMAX_DELAY);
+    int64_t t0 = ESP_LITTLEFS_LAT_NOW();
+    esp_err_t err = bd_bounce_read(backend, efs, part_off, buffer, size);
+    ESP_LITTLEFS_LAT_RECORD(efs, ESP_LITTLEFS_LAT_FLASH_READ, t0);
+    ESP_LITTLEFS_IO_FLASH(efs, ESP_LITTLEFS_LAT_FLASH_READ, size, t0);
+    ESP_LITTLEFS_TRACE(efs, ESP_LITTLEFS_TRACE_READ, 0, t0, block, off, size);
+    if(locked) xSemaphoreGive(efs->bd_lock);
+    if (err) {
+        ESP_LOGE(TAG, "failed to read addr %08x, size %08x, err %d", part_off, size, err);
+        return LFS_ERR_IO;
+    }
     return 0;
 }
 
-int littlefs_api_prog(const struct lfs_config *c, lfs_block_t block,
-        lfs_off_t off, const void *buffer, lfs_size_t size) {
+BD_INLINE int bd_prog(const int backend, const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size)
+{
     esp_littlefs_t * efs = c->context;
-    size_t part_off = (block * c->block_size) + off;
+    size_t part_off = block * BD_BLOCK_SIZE + off;
 
-#ifndef CONFIG_NEONIOUS_ONE
-    if(efs->internal_version)
-    {
-        esp_err_t err = spi_flash_write(gFSPos + part_off, buffer, size);
-        if (err) {
-            ESP_LOGE(TAG, "failed to write addr %08x, size %08x, err %d", part_off, size, err);
-            return LFS_ERR_IO;
-        }
-        return 0;
+    if(efs->snapshot && ESP_LITTLEFS_SNAPSHOT_PINNED(efs->snapshot, block)) {
+        esp_littlefs_snapshot_t * snap = efs->snapshot;
+        /* Progs within an erase cycle only ever append, so the first one
+         * after the snapshot marks where the snapshot's data ends. A shadowed
+         * superblock has already been erased; its watermark is final. */
+        bool shadowed = block < 2 && snap->shadow[block];
+        if(!shadowed && off < snap->watermark[block])
+            snap->watermark[block] = off;
     }
-#endif /* CONFIG_NEONIOUS_ONE */
 
-    data_spiflash_write(part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, buffer, size);
+    ESP_LITTLEFS_STATS_ADD(efs, flash_progs, 1);
+    ESP_LITTLEFS_STATS_ADD(efs, flash_prog_bytes, size);
+    ESP_LITTLEFS_AMP_FLASH(efs, size, 0);
+
+    int64_t t0 = ESP_LITTLEFS_LAT_NOW();
+    esp_err_t err = bd_bounce_prog(backend, efs, part_off, buffer, size);
+    if(BD_TIMED_WRITE(backend)) {
+        ESP_LITTLEFS_LAT_RECORD(efs, ESP_LITTLEFS_LAT_FLASH_PROG, t0);
+        ESP_LITTLEFS_IO_FLASH(efs, ESP_LITTLEFS_LAT_FLASH_PROG, size, t0);
+    }
+    ESP_LITTLEFS_TRACE(efs, ESP_LITTLEFS_TRACE_PROG, 0, t0, block, off, size);
+    if (err) {
+        ESP_LOGE(TAG, "failed to write addr %08x, size %08x, err %d", part_off, size, err);
+        return LFS_ERR_IO;
+    }
     return 0;
 }
 
-int littlefs_api_erase(const struct lfs_config *c, lfs_block_t block) {
+BD_INLINE int bd_erase(const int backend, const struct lfs_config *c, lfs_block_t block)
+{
     esp_littlefs_t * efs = c->context;
-    size_t part_off = block * c->block_size;
+    size_t part_off = block * BD_BLOCK_SIZE;
 
+    if(efs->snapshot && ESP_LITTLEFS_SNAPSHOT_PINNED(efs->snapshot, block)) {
+        esp_littlefs_snapshot_t * snap = efs->snapshot;
+        if(block >= 2) {
+            /* The allocator skips pinned blocks, so this is a metadata pair
+             * being compacted in place. Looks like a bad block to littlefs,
+             * which relocates the pair. */
+            ESP_LOGD(TAG, "block %d is pinned by a snapshot", block);
+            return LFS_ERR_CORRUPT;
+        }
+        if(!snap->shadow[block]) {
+            /* The superblock pair can't move; keep the old contents in RAM */
+            snap->shadow[block] = low_calloc(1, BD_BLOCK_SIZE);
+            if(!snap->shadow[block]) {
+                ESP_LOGE(TAG, "failed to shadow pinned superblock %d", block);
+                return LFS_ERR_NOMEM;
+            }
+            /* Straight from the driver; littlefs didn't ask for this read, so
+             * it stays out of stats, traces and the task's I/O */
+            esp_err_t err = bd_bounce_read(backend, efs, part_off, snap->shadow[block], snap->watermark[block]);
+            if(err) {
+                ESP_LOGE(TAG, "failed to read addr %08x, size %08x, err %d", part_off, snap->watermark[block], err);
+                free(snap->shadow[block]);
+                snap->shadow[block] = NULL;
+                return LFS_ERR_IO;
+            }
+        }
+    }
+
+    ESP_LITTLEFS_STATS_ADD(efs, flash_erases, 1);
+    ESP_LITTLEFS_STATS_ADD(efs, flash_erase_bytes, BD_BLOCK_SIZE);
+    ESP_LITTLEFS_AMP_FLASH(efs, 0, BD_BLOCK_SIZE);
+
+    int64_t t0 = ESP_LITTLEFS_LAT_NOW();
 #ifndef CONFIG_NEONIOUS_ONE
-    if(efs->internal_version)
+    if(backend == BD_INTERNAL)
     {
-        esp_err_t err = spi_flash_erase_range(gFSPos + part_off, c->block_size);
+        esp_err_t err = spi_flash_erase_range(gFSPos + part_off, BD_BLOCK_SIZE);
+        ESP_LITTLEFS_LAT_RECORD(efs, ESP_LITTLEFS_LAT_FLASH_ERASE, t0);
+        ESP_LITTLEFS_IO_FLASH(efs, ESP_LITTLEFS_LAT_FLASH_ERASE, BD_BLOCK_SIZE, t0);
+        ESP_LITTLEFS_TRACE(efs, ESP_LITTLEFS_TRACE_ERASE, 0, t0, block, 0, BD_BLOCK_SIZE);
         if (err) {
-            ESP_LOGE(TAG, "failed to erase addr %08x, size %08x, err %d", part_off, c->block_size, err);
+            ESP_LOGE(TAG, "failed to erase addr %08x, size %08x, err %d", part_off, BD_BLOCK_SIZE, err);
             return LFS_ERR_IO;
         }
         return 0;
     }
 #endif /* CONFIG_NEONIOUS_ONE */
 
-    data_spiflash_erase(part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, c->block_size);
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    esp_littlefs_xfer_erase(efs->xfer, part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, BD_BLOCK_SIZE);
+#else
+    data_spiflash_erase(part_off + CONFIG_CLIENT_SIZE_DATA_OFFSET, BD_BLOCK_SIZE);
+#endif
+    if(BD_TIMED_WRITE(backend)) {
+        ESP_LITTLEFS_LAT_RECORD(efs, ESP_LITTLEFS_LAT_FLASH_ERASE, t0);
+        ESP_LITTLEFS_IO_FLASH(efs, ESP_LITTLEFS_LAT_FLASH_ERASE, BD_BLOCK_SIZE, t0);
+    }
+    ESP_LITTLEFS_TRACE(efs, ESP_LITTLEFS_TRACE_ERASE, 0, t0, block, 0, BD_BLOCK_SIZE);
     return 0;
 }
 
+#ifndef CONFIG_NEONIOUS_ONE
+int littlefs_api_internal_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    return bd_read(BD_INTERNAL, c, block, off, buffer, size);
+}
+
+int littlefs_api_internal_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    return bd_prog(BD_INTERNAL, c, block, off, buffer, size);
+}
+
+int littlefs_api_internal_erase(const struct lfs_config *c, lfs_block_t block) {
+    return bd_erase(BD_INTERNAL, c, block);
+}
+#endif /* CONFIG_NEONIOUS_ONE */
+
+int littlefs_api_external_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    return bd_read(BD_EXTERNAL, c, block, off, buffer, size);
+}
+
+int littlefs_api_external_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    return bd_prog(BD_EXTERNAL, c, block, off, buffer, size);
+}
+
+int littlefs_api_external_erase(const struct lfs_config *c, lfs_block_t block) {
+    return bd_erase(BD_EXTERNAL, c, block);
+}
+
 int littlefs_api_sync(const struct lfs_config *c) {
     /* Unnecessary for esp-idf */
     return 0;
 }
 
+int littlefs_api_external_sync(const struct lfs_config *c) {
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    esp_littlefs_t * efs = c->context;
+    esp_littlefs_xfer_drain(efs->xfer);
+#endif
+    return 0;
+}
+
+
+int littlefs_api_snapshot_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size)
+{
+    esp_littlefs_snapshot_t * snap = c->context;
+    lfs_size_t valid = size;
+
+    if(ESP_LITTLEFS_SNAPSHOT_PINNED(snap, block)) {
+        /* Anything past the watermark was written after the snapshot;
+         * present it as erased so littlefs stops at the last old commit. */
+        lfs_off_t end = snap->watermark[block];
+        valid = off >= end ? 0 : MIN(size, end - off);
+        memset((uint8_t *)buffer + valid, 0xff, size - valid);
+    }
+
+    if(valid == 0)
+        return 0;
+
+    if(block < 2 && snap->shadow[block]) {
+        memcpy(buffer, snap->shadow[block] + off, valid);
+        return 0;
+    }
+
+    return snap->efs->cfg.read(&snap->efs->cfg, block, off, buffer, valid);
+}
+
+int littlefs_api_snapshot_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    return LFS_ERR_IO;
+}
+
+int littlefs_api_snapshot_erase(const struct lfs_config *c, lfs_block_t block) {
+    return LFS_ERR_IO;
+}
+
+/* The lookahead window moved into lfs->lookahead in littlefs 2.9. Its bitmap
+ * is uint32_t words before, bytes since; on little-endian targets both have
+ * block start + n at bit n % 8 of byte n / 8. */
+#if LFS_VERSION >= 0x00020009
+#define LOOKAHEAD_START(lfs)  ((lfs)->lookahead.start)
+#define LOOKAHEAD_SIZE(lfs)   ((lfs)->lookahead.size)
+#define LOOKAHEAD_BUFFER(lfs) ((uint8_t *)(lfs)->lookahead.buffer)
+#else
+#define LOOKAHEAD_START(lfs)  ((lfs)->free.off)
+#define LOOKAHEAD_SIZE(lfs)   ((lfs)->free.size)
+#define LOOKAHEAD_BUFFER(lfs) ((uint8_t *)(lfs)->free.buffer)
+#endif
+
+void littlefs_api_snapshot_mask(esp_littlefs_snapshot_t *snap, lfs_t *lfs) {
+    uint8_t *buffer = LOOKAHEAD_BUFFER(lfs);
+
+    for(lfs_block_t off=0; off < LOOKAHEAD_SIZE(lfs); off++) {
+        lfs_block_t block = (LOOKAHEAD_START(lfs) + off) % lfs->cfg->block_count;
+        if(ESP_LITTLEFS_SNAPSHOT_PINNED(snap, block))
+            buffer[off / 8] |= 1 << (off % 8);
+    }
+}
+
+void littlefs_api_alloc_lookahead(lfs_t *lfs, lfs_block_t block) {
+    esp_littlefs_t * efs;
+
+    /* Every walk starts at the superblock pair, so this runs once per refill.
+     * Snapshot instances never write, and their context isn't a mount. */
+    if(block != 0 || lfs->cfg->read == littlefs_api_snapshot_read) return;
+    efs = lfs->cfg->context;
+    if(lfs != efs->fs) return;
+    efs->alloc_hooked = true;
+    if(efs->snapshot) littlefs_api_snapshot_mask(efs->snapshot, lfs);
+}
+
+esp_err_t littlefs_api_check_lookahead(esp_littlefs_t *efs) {
+    if(efs->alloc_hooked) return ESP_OK;
+#if LFS_VERSION >= 0x00020009
+    /* An empty window makes lfs_fs_gc() scan for the next one. Blocks up to
+     * lookahead.next were handed out already; the scan starts after them. */
+    efs->fs->lookahead.size = 0;
+    int res = lfs_fs_gc(efs->fs);
+    if(res < 0) {
+        ESP_LOGE(TAG, "failed to refill the lookahead window, err %d", res);
+        return ESP_FAIL;
+    }
+#else
+    /* No public way to force a refill; an allocation since mount must
+     * have run the hook */
+#endif
+    return efs->alloc_hooked ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
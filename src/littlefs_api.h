@@ -3,17 +3,69 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "esp_vfs.h"
 #include "esp_partition.h"
+#include "esp_timer.h"
 #include "littlefs/lfs.h"
+#include "esp_littlefs.h"
+
+#define CONFIG_LITTLEFS_BLOCK_SIZE 4096 /* ESP32 can only operate at 4kb */
+
+/* data_spiflash_read() is given at most this much at a time */
+#define ESP_LITTLEFS_EXTERNAL_MAX_READ 1024
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief An independent littlefs instance of a read-only mount
+ */
+typedef struct {
+    lfs_t *fs;                                /*!< Mounted littlefs handle */
+    struct lfs_config cfg;                    /*!< Mount configuration of fs, with its own buffers */
+    SemaphoreHandle_t lock;                   /*!< Serializes use of fs */
+    uint16_t open_count;                      /*!< Number of files opened on this instance */
+} esp_littlefs_reader_t;
+
+/**
+ * @brief An open littlefs file, shared by the FDs reading the same path
+ *
+ * Small reads are served from a read-ahead buffer under the object's own
+ * lock. The lock of the littlefs instance (efs->lock, or the reader's lock
+ * on read-only mounts) is only taken when the buffer misses and for writes,
+ * since that is when littlefs touches shared state (caches, allocator,
+ * metadata). Writes go straight to littlefs, so write() reports their
+ * errors. Lock order is file lock, then instance lock.
+ *
+ * A read-only open of a path that is already open read-only reuses that
+ * object, so concurrent readers of one file cost a single lfs_file_t and
+ * buffer and hit each other's read-ahead. Each FD keeps its own position.
+ * Opening a path for writing stops its existing object from being shared
+ * further, so later readers see the new contents. Sharing needs the full
+ * path, so it is off with CONFIG_LITTLEFS_USE_ONLY_HASH.
+ */
+typedef struct {
+    lfs_file_t file;
+    struct lfs_file_config fcfg;              /*!< Points littlefs at a cache from esp_littlefs_mem_alloc */
+    SemaphoreHandle_t lock;                   /*!< Serializes data-path operations on this file */
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    StaticSemaphore_t lock_buf;               /*!< Storage of lock */
+#endif
+    esp_littlefs_reader_t * reader;           /*!< Instance serving this file on read-only mounts; NULL otherwise */
+    int        flags;                         /*!< littlefs open flags */
+    uint16_t   refs;                          /*!< Number of FDs using this file */
+    bool       shareable;                     /*!< Read-only opens of the same path may reuse this file */
+    uint8_t  * buf;                           /*!< Read-ahead data, CONFIG_LITTLEFS_FILE_BUF_SIZE bytes; allocated on first use */
+    lfs_off_t  buf_pos;                       /*!< File offset of buf[0] */
+    lfs_size_t buf_len;                       /*!< Valid bytes in buf */
+} vfs_littlefs_shared_t;
+
 /**
  * @brief a file descriptor
  * That's also a singly linked list used for keeping tracks of all opened file descriptor 
@@ -31,14 +83,141 @@ extern "C" {
  *    2. Same as (1), but for renames
  */
 typedef struct _vfs_littlefs_file_t {
-    lfs_file_t file;
+    vfs_littlefs_shared_t * shared;           /*!< Open littlefs file; may be shared with other FDs */
     uint32_t   hash;
     struct _vfs_littlefs_file_t * next;       /*!< Pointer to next file in Singly Linked List */
+    lfs_off_t  pos;                           /*!< Position of the FD; shared->file.pos lags behind while buf serves reads */
+    uint16_t   busy;                          /*!< Hooks holding the FD, see esp_littlefs_get_file(); guarded by efs->fd_mux */
+    bool       closing;                       /*!< close() has started; no new holds. Guarded by efs->fd_mux */
+    SemaphoreHandle_t drained;                /*!< Given to a waiting close() when the other holds are released */
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    StaticSemaphore_t drained_buf;            /*!< Storage of drained */
+#endif
 #ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
     char     * path;
 #endif
+#if CONFIG_LITTLEFS_INTROSPECT
+    char     * vbuf;                          /*!< Contents of a file under ESP_LITTLEFS_VDIR, rendered at open; shared is NULL then */
+    size_t     vlen;                          /*!< Length of vbuf */
+#endif
 } vfs_littlefs_file_t;
 
+struct esp_littlefs_snapshot;
+
+/**
+ * @brief Flash traffic attributed to files, see esp_littlefs_amp_t
+ */
+typedef struct {
+    portMUX_TYPE mux;                         /*!< Guards the counters */
+    bool cur_set;                             /*!< Whether flash writes are attributed to cur_hash; owned by the lock holder */
+    uint32_t cur_hash;
+    uint64_t user_bytes;
+    uint64_t prog_bytes;
+    uint64_t erase_bytes;
+    uint64_t other_prog_bytes;
+    uint64_t other_erase_bytes;
+    uint32_t evicted;
+    uint8_t file_count;
+    esp_littlefs_amp_file_t files[ESP_LITTLEFS_AMP_FILES];
+    uint32_t used[ESP_LITTLEFS_AMP_FILES];    /*!< Value of clock when each file was last charged, for eviction */
+    uint32_t clock;                           /*!< Counts lookups in files */
+} esp_littlefs_amp_state_t;
+
+/**
+ * @brief A task tracked by the per-task I/O accounting
+ */
+typedef struct {
+    TaskHandle_t task;
+    int64_t tokens;                           /*!< Flash microseconds the task may still use */
+    int64_t refilled;                         /*!< When tokens were last topped up */
+    uint32_t used;                            /*!< Value of the state's clock when last charged, for eviction */
+    esp_littlefs_task_io_t stats;
+} esp_littlefs_io_task_t;
+
+/**
+ * @brief Per-task I/O, see esp_littlefs_top_t
+ */
+typedef struct {
+    portMUX_TYPE mux;                         /*!< Guards everything below */
+    uint32_t budget_us;
+    uint32_t evicted;
+    uint32_t untracked;
+    uint32_t clock;                           /*!< Counts lookups in tasks */
+    uint8_t task_count;
+    esp_littlefs_io_task_t tasks[ESP_LITTLEFS_IO_TASKS];
+} esp_littlefs_io_state_t;
+
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+enum {
+    ESP_LITTLEFS_XFER_READ,
+    ESP_LITTLEFS_XFER_PROG,
+    ESP_LITTLEFS_XFER_ERASE,
+};
+
+/**
+ * @brief One transfer of the external flash, see littlefs_xfer.c
+ */
+typedef struct {
+    uint8_t op;                               /*!< ESP_LITTLEFS_XFER_* */
+    bool busy;                                /*!< Queued or running, and done not taken yet */
+    bool valid;                               /*!< buf holds the flash at [addr, addr + len) */
+    uint32_t addr;                            /*!< Flash address */
+    uint32_t len;
+    uint8_t *buf;                             /*!< Own buffer, or the caller's */
+    TaskHandle_t task;                        /*!< Task that queued it, charged for its flash time */
+    SemaphoreHandle_t done;                   /*!< Given by the transfer task when finished */
+} esp_littlefs_xfer_slot_t;
+
+/**
+ * @brief Transfer task and buffers of an external flash mount
+ */
+typedef struct {
+    esp_littlefs_xfer_slot_t slot[3];         /*!< Two ping-pong buffers, then one for caller buffers and erases */
+    QueueHandle_t queue;                      /*!< Slots for the transfer task, in submission order */
+    TaskHandle_t task;
+    uint8_t next;                             /*!< Ping-pong slot to fill next */
+    uint32_t end;                             /*!< End of the partition in flash */
+    uint32_t seq_end;                         /*!< End of the last read, to spot sequential reads */
+    uint32_t hits;                            /*!< Reads served from a prefetch */
+    uint32_t misses;
+} esp_littlefs_xfer_t;
+#endif
+
+/**
+ * @brief A task seen taking the mount lock
+ */
+typedef struct {
+    TaskHandle_t task;
+    uint8_t op;                               /*!< VFS call the task is in */
+    uint32_t key;                             /*!< Its path hash or fd */
+    esp_littlefs_lock_task_t stats;
+} esp_littlefs_prof_task_t;
+
+/**
+ * @brief Contention profile of the mount lock, see esp_littlefs_lock_profile_t
+ */
+typedef struct {
+    portMUX_TYPE mux;                         /*!< Guards everything below but the holder fields */
+    esp_littlefs_prof_task_t tasks[ESP_LITTLEFS_LOCK_TASKS];
+    uint8_t task_count;
+    uint32_t untracked;
+    uint64_t op_wait_us[ESP_LITTLEFS_OP_MAX + 1];
+    uint64_t op_hold_us[ESP_LITTLEFS_OP_MAX + 1];
+    esp_littlefs_lock_event_t worst[ESP_LITTLEFS_LOCK_EVENTS];
+    int holder;                               /*!< Slot of the lock holder, -1 if untracked; owned by the holder */
+    uint8_t holder_op;
+    uint32_t holder_key;
+    int64_t acquired;
+} esp_littlefs_lock_prof_t;
+
+/**
+ * @brief One latency histogram, see esp_littlefs_latency_t
+ */
+typedef struct {
+    uint32_t buckets[ESP_LITTLEFS_LAT_BUCKETS];
+    uint32_t max;
+} esp_littlefs_hist_t;
+
 /**
  * @brief littlefs definition structure
  */
@@ -52,21 +231,302 @@ typedef struct {
     vfs_littlefs_file_t *file;                /*!< Singly Linked List of files */
 
     vfs_littlefs_file_t **cache;              /*!< A cache of pointers to the opened files */
+    portMUX_TYPE         fd_mux;              /*!< Guards FD lookups against the cache being reallocated */
     uint16_t             cache_size;          /*!< The cache allocated size (in pointers) */
     uint16_t             fd_count;            /*!< The count of opened file descriptor used to speed up computation */
 
     bool internal_version;
     char *label;
+
+    bool read_only;                           /*!< Mounted read-only; see esp_vfs_littlefs_conf_t */
+    esp_littlefs_reader_t *readers;           /*!< Read-only instances files are spread over */
+    uint8_t reader_count;                     /*!< Number of mounted readers */
+    SemaphoreHandle_t bd_lock;                /*!< Serializes external flash reads on read-only mounts; its driver isn't reentrant */
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    esp_littlefs_xfer_t *xfer;                /*!< External flash transfers; NULL for internal flash */
+#endif
+
+    struct esp_littlefs_snapshot *snapshot;   /*!< Active point-in-time snapshot, NULL if none */
+    bool alloc_hooked;                        /*!< littlefs_api_alloc_lookahead() has run on fs */
+
+    esp_littlefs_mount_timing_t timing;       /*!< Phases of the last mount */
+    int64_t mount_t0;                         /*!< Start of the lfs_mount() being timed; 0 outside of it */
+
+#if CONFIG_LITTLEFS_STATS
+    esp_littlefs_stats_t stats[portNUM_PROCESSORS]; /*!< Operation counters; each core only updates its own */
+#endif
+#if CONFIG_LITTLEFS_AMP
+    esp_littlefs_amp_state_t amp;             /*!< Write and erase amplification */
+#endif
+#if CONFIG_LITTLEFS_TASK_IO
+    esp_littlefs_io_state_t io;               /*!< Per-task I/O */
+#endif
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+    esp_littlefs_lock_prof_t prof;            /*!< Contention profile of lock */
+#endif
+#if CONFIG_LITTLEFS_LATENCY
+    esp_littlefs_hist_t lat[portNUM_PROCESSORS][ESP_LITTLEFS_LAT_MAX]; /*!< Latency histograms; per core like stats */
+#endif
 } esp_littlefs_t;
 
+/**
+ * @brief Account a flash read of a timed lfs_mount(). littlefs fetches the
+ *        superblock pair first, so the first read elsewhere ends that phase.
+ */
+static inline void esp_littlefs_mount_read(esp_littlefs_t *efs, lfs_block_t block) {
+    efs->timing.mount_reads++;
+    if(block >= 2 && efs->timing.superblock_us == 0)
+        efs->timing.superblock_us = esp_timer_get_time() - efs->mount_t0;
+}
+
+#if CONFIG_LITTLEFS_STATS
+/* Masking interrupts on this core keeps the task from being preempted or
+ * migrated between picking the core's counters and updating them */
+#define ESP_LITTLEFS_STATS_ADD(efs, field, n) do {                          \
+        UBaseType_t _irq = portSET_INTERRUPT_MASK_FROM_ISR();               \
+        (efs)->stats[xPortGetCoreID()].field += (n);                        \
+        portCLEAR_INTERRUPT_MASK_FROM_ISR(_irq);                            \
+    } while(0)
+#else
+#define ESP_LITTLEFS_STATS_ADD(efs, field, n) ((void)0)
+#endif
+
+#if CONFIG_LITTLEFS_LATENCY
+/**
+ * @brief Add one sample to a histogram of efs, on the calling core.
+ *
+ * Interrupts are masked like in ESP_LITTLEFS_STATS_ADD; the transfer task
+ * records too, so the calling task isn't the only writer on its core.
+ */
+static inline void esp_littlefs_lat_record(esp_littlefs_t *efs, int which, int64_t us) {
+    uint32_t v = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    int b = v ? 32 - __builtin_clz(v) : 0;
+    UBaseType_t irq = portSET_INTERRUPT_MASK_FROM_ISR();
+    esp_littlefs_hist_t *h = &efs->lat[xPortGetCoreID()][which];
+    h->buckets[MIN(b, ESP_LITTLEFS_LAT_BUCKETS - 1)]++;
+    if(v > h->max) h->max = v;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(irq);
+}
+#define ESP_LITTLEFS_LAT_RECORD(efs, which, t0) \
+    esp_littlefs_lat_record(efs, which, esp_timer_get_time() - (t0))
+#else
+#define ESP_LITTLEFS_LAT_RECORD(efs, which, t0) ((void)(t0))
+#endif
+
+#if CONFIG_LITTLEFS_AMP
+void esp_littlefs_amp_user(esp_littlefs_t *efs, uint32_t hash, size_t bytes);
+void esp_littlefs_amp_flash(esp_littlefs_t *efs, size_t prog_bytes, size_t erase_bytes);
+void esp_littlefs_amp_report(esp_littlefs_t *efs, esp_littlefs_amp_t *amp);
+void esp_littlefs_amp_clear(esp_littlefs_t *efs);
+
+/* Flash writes until the lock is given are caused by the file with this path hash */
+#define ESP_LITTLEFS_AMP_SET(efs, hash)        ((efs)->amp.cur_hash = (hash), (efs)->amp.cur_set = true)
+#define ESP_LITTLEFS_AMP_CLEAR(efs)            ((efs)->amp.cur_set = false)
+#define ESP_LITTLEFS_AMP_USER(efs, hash, n)    esp_littlefs_amp_user(efs, hash, n)
+#define ESP_LITTLEFS_AMP_FLASH(efs, prog, erase) esp_littlefs_amp_flash(efs, prog, erase)
+#else
+#define ESP_LITTLEFS_AMP_SET(efs, hash)        ((void)0)
+#define ESP_LITTLEFS_AMP_CLEAR(efs)            ((void)0)
+#define ESP_LITTLEFS_AMP_USER(efs, hash, n)    ((void)0)
+#define ESP_LITTLEFS_AMP_FLASH(efs, prog, erase) ((void)0)
+#endif
+
+#if CONFIG_LITTLEFS_TASK_IO
+void esp_littlefs_io_op(esp_littlefs_t *efs);
+void esp_littlefs_io_user(esp_littlefs_t *efs, bool write, size_t bytes);
+void esp_littlefs_io_flash(esp_littlefs_t *efs, int which, size_t bytes, int64_t t0);
+void esp_littlefs_io_flash_task(esp_littlefs_t *efs, TaskHandle_t task, int which, size_t bytes, int64_t t0);
+void esp_littlefs_io_report(esp_littlefs_t *efs, esp_littlefs_top_t *top);
+void esp_littlefs_io_clear(esp_littlefs_t *efs);
+
+/* Charged to the calling task; which is an ESP_LITTLEFS_LAT_FLASH_* */
+#define ESP_LITTLEFS_IO_OP(efs)                   esp_littlefs_io_op(efs)
+#define ESP_LITTLEFS_IO_USER(efs, write, n)       esp_littlefs_io_user(efs, write, n)
+#define ESP_LITTLEFS_IO_FLASH(efs, which, n, t0)  esp_littlefs_io_flash(efs, which, n, t0)
+/* Charged to task instead, for transfers it queued */
+#define ESP_LITTLEFS_IO_FLASH_TASK(efs, task, which, n, t0) esp_littlefs_io_flash_task(efs, task, which, n, t0)
+#else
+#define ESP_LITTLEFS_IO_OP(efs)                   ((void)0)
+#define ESP_LITTLEFS_IO_USER(efs, write, n)       ((void)0)
+#define ESP_LITTLEFS_IO_FLASH(efs, which, n, t0)  ((void)(t0))
+#define ESP_LITTLEFS_IO_FLASH_TASK(efs, task, which, n, t0) ((void)(t0))
+#endif
+
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+/**
+ * @brief Start the transfer task of an external flash mount.
+ */
+esp_err_t esp_littlefs_xfer_init(esp_littlefs_t *efs);
+
+/**
+ * @brief Wait for queued transfers, then stop the task and free its buffers. NULL is ignored.
+ */
+void esp_littlefs_xfer_free(esp_littlefs_xfer_t *xfer);
+
+/*
+ * Transfers of the external flash at flash address addr. Reads return with
+ * the data; programs and erases may return while still queued. Callers are
+ * serialized by the mount lock, or bd_lock on read-only mounts.
+ */
+void esp_littlefs_xfer_read(esp_littlefs_xfer_t *xfer, uint32_t addr, void *buffer, uint32_t size);
+void esp_littlefs_xfer_prog(esp_littlefs_xfer_t *xfer, uint32_t addr, const void *buffer, uint32_t size);
+void esp_littlefs_xfer_erase(esp_littlefs_xfer_t *xfer, uint32_t addr, uint32_t size);
+
+/**
+ * @brief Wait until every queued transfer is done, and forget prefetched data.
+ */
+void esp_littlefs_xfer_drain(esp_littlefs_xfer_t *xfer);
+#endif
+
+#if CONFIG_LITTLEFS_TRACE
+extern esp_littlefs_t * volatile esp_littlefs_traced;
+
+/**
+ * @brief Append a record ending now to the trace ring.
+ */
+void esp_littlefs_trace_add(uint8_t type, uint8_t op, int64_t t0,
+        uint32_t arg0, uint32_t arg1, uint32_t arg2);
+
+/**
+ * @brief Start tracing efs, see esp_littlefs_trace_start().
+ */
+void esp_littlefs_trace_begin(esp_littlefs_t *efs);
+
+#define ESP_LITTLEFS_TRACE(efs, type, op, t0, arg0, arg1, arg2) do {           \
+        if(esp_littlefs_traced == (efs))                                        \
+            esp_littlefs_trace_add(type, op, t0, arg0, arg1, arg2);             \
+    } while(0)
+#else
+#define ESP_LITTLEFS_TRACE(efs, type, op, t0, arg0, arg1, arg2) ((void)0)
+#endif
+
+#if CONFIG_LITTLEFS_LATENCY || CONFIG_LITTLEFS_TRACE || CONFIG_LITTLEFS_TASK_IO
+#define ESP_LITTLEFS_LAT_NOW() esp_timer_get_time()
+#else
+#define ESP_LITTLEFS_LAT_NOW() 0
+#endif
+
+#if CONFIG_LITTLEFS_INTROSPECT
+#define ESP_LITTLEFS_VDIR "/.lfs"
+
+/**
+ * @brief Name of the index-th file under ESP_LITTLEFS_VDIR, NULL past the last one.
+ */
+const char * esp_littlefs_vfile_name(int index);
+
+/**
+ * @brief Render a file under ESP_LITTLEFS_VDIR into buf, truncating to size - 1 bytes.
+ * @warning This must be called with the instance lock taken
+ * @return length of the contents, or -1 if there is no such file.
+ */
+int esp_littlefs_vfile_render(esp_littlefs_t *efs, const char *name, char *buf, size_t size);
+#endif
+
+/**
+ * @brief A point-in-time read-only view of a mounted filesystem.
+ *
+ * Every block referenced by the tree at snapshot time is pinned. The
+ * allocator treats pinned blocks as in use, so new data never lands on
+ * them. Metadata pairs are compacted in place though; the block layer
+ * refuses to erase a pinned one (littlefs treats it as bad and relocates
+ * the pair), and remembers where the first new commit was appended to each
+ * pinned metadata block, so the snapshot's own littlefs instance never sees
+ * data written after the snapshot was taken.
+ *
+ * The superblock pair (blocks 0 and 1) cannot be relocated; if it gets
+ * compacted while pinned, its old contents are copied to RAM first.
+ */
+typedef struct esp_littlefs_snapshot {
+    esp_littlefs_t *efs;                      /*!< Filesystem the snapshot was taken of */
+    lfs_t fs;                                 /*!< Read-only littlefs instance over the pinned tree */
+    struct lfs_config cfg;                    /*!< Mount configuration of fs */
+    uint32_t *pinned;                         /*!< Bitmap of blocks referenced at snapshot time */
+    uint16_t *watermark;                      /*!< Per block; end of the data that belongs to the snapshot */
+    uint8_t  *shadow[2];                      /*!< RAM copies of superblock blocks erased while pinned */
+} esp_littlefs_snapshot_t;
+
+#define ESP_LITTLEFS_SNAPSHOT_PINNED(s, block) \
+    (((s)->pinned[(block) / 32] >> ((block) % 32)) & 1)
+
+/**
+ * @brief Kinds of buffers accounted against the memory budget
+ */
+typedef enum {
+    ESP_LITTLEFS_MEM_MOUNT_CACHE,             /*!< Read, prog and lookahead buffers of a littlefs instance */
+    ESP_LITTLEFS_MEM_FILE_CACHE,              /*!< littlefs cache of an open file */
+    ESP_LITTLEFS_MEM_FILE_BUF,                /*!< Data-path buffer of an open file; can be evicted */
+    ESP_LITTLEFS_MEM_KIND_MAX,
+} esp_littlefs_mem_kind_t;
+
+/**
+ * @brief Allocate a buffer against the memory budget, where
+ *        CONFIG_LITTLEFS_MEM_PLACEMENT prefers.
+ *
+ * If the budget would be exceeded, evictable buffers are reclaimed first,
+ * except when allocating an evictable buffer.
+ *
+ * @return the buffer, or NULL if out of budget or memory.
+ */
+void * esp_littlefs_mem_alloc(esp_littlefs_mem_kind_t kind, size_t size);
+
+/**
+ * @brief Free a buffer from esp_littlefs_mem_alloc. NULL is ignored.
+ */
+void esp_littlefs_mem_free(void *buf);
+
+/**
+ * @brief A fixed number of fixed-size slots in static memory, used instead
+ *        of the heap with CONFIG_LITTLEFS_STATIC_ALLOC.
+ */
+typedef struct {
+    uint8_t  *mem;                            /*!< count slots of size bytes */
+    uint32_t *used;                           /*!< Bitmap of taken slots */
+    size_t    size;                           /*!< Slot size; multiple of 8 */
+    uint16_t  count;                          /*!< Number of slots */
+} esp_littlefs_pool_t;
+
+#define ESP_LITTLEFS_POOL_SLOT(size) (((size) + 7) & ~7)
+
+/**
+ * @brief Define a static pool called name, of slots slots of slot_size bytes or more.
+ */
+#define ESP_LITTLEFS_POOL_DEFINE(name, slot_size, slots)                                \
+    static uint8_t name##_mem[(slots) * ESP_LITTLEFS_POOL_SLOT(slot_size)] __attribute__((aligned(8))); \
+    static uint32_t name##_used[((slots) + 31) / 32];                                   \
+    static esp_littlefs_pool_t name = {                                                 \
+        .mem = name##_mem, .used = name##_used,                                         \
+        .size = ESP_LITTLEFS_POOL_SLOT(slot_size), .count = (slots) }
+
+/**
+ * @brief Take a slot from a pool, as it was left.
+ * @return the slot, or NULL if all are taken.
+ */
+void * esp_littlefs_pool_take(esp_littlefs_pool_t *pool);
+
+/**
+ * @brief Take a zeroed slot from a pool.
+ * @return the slot, or NULL if size doesn't fit a slot or all are taken.
+ */
+void * esp_littlefs_pool_alloc(esp_littlefs_pool_t *pool, size_t size);
+
+/**
+ * @brief Return a slot to its pool. NULL is ignored.
+ */
+void esp_littlefs_pool_free(esp_littlefs_pool_t *pool, void *p);
+
 /**
  * @brief Read a region in a block.
  *
+ * There is a read, prog and erase per backend: internal_ for the ESP32's
+ * own flash at gFSPos, external_ for the data SPI flash. Each is compiled
+ * for its backend's fixed geometry; mount picks one set.
  * Negative error codes are propogated to the user.
  *
  * @return errorcode. 0 on success.
  */
-int littlefs_api_read(const struct lfs_config *c, lfs_block_t block,
+int littlefs_api_internal_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size);
+int littlefs_api_external_read(const struct lfs_config *c, lfs_block_t block,
         lfs_off_t off, void *buffer, lfs_size_t size);
 
 /**
@@ -78,7 +538,9 @@ int littlefs_api_read(const struct lfs_config *c, lfs_block_t block,
  *
  * @return errorcode. 0 on success.
  */
-int littlefs_api_prog(const struct lfs_config *c, lfs_block_t block,
+int littlefs_api_internal_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size);
+int littlefs_api_external_prog(const struct lfs_config *c, lfs_block_t block,
         lfs_off_t off, const void *buffer, lfs_size_t size);
 
 /**
@@ -90,16 +552,64 @@ int littlefs_api_prog(const struct lfs_config *c, lfs_block_t block,
  * May return LFS_ERR_CORRUPT if the block should be considered bad.
  * @return errorcode. 0 on success.
  */
-int littlefs_api_erase(const struct lfs_config *c, lfs_block_t block);
+int littlefs_api_internal_erase(const struct lfs_config *c, lfs_block_t block);
+int littlefs_api_external_erase(const struct lfs_config *c, lfs_block_t block);
 
 /**
  * @brief Sync the state of the underlying block device.
  *
+ * The external_ one waits for transfers CONFIG_LITTLEFS_EXTERNAL_XFER queued.
  * Negative error codes are propogated to the user.
  *
  * @return errorcode. 0 on success.
  */
 int littlefs_api_sync(const struct lfs_config *c);
+int littlefs_api_external_sync(const struct lfs_config *c);
+
+/**
+ * @brief Read a region in a block as it was when the snapshot was taken.
+ *
+ * Used as the read callback of a snapshot's littlefs instance; the context
+ * is the esp_littlefs_snapshot_t. Prog and erase on a snapshot always fail.
+ *
+ * @return errorcode. 0 on success.
+ */
+int littlefs_api_snapshot_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size);
+
+int littlefs_api_snapshot_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size);
+
+int littlefs_api_snapshot_erase(const struct lfs_config *c, lfs_block_t block);
+
+/**
+ * @brief Called by littlefs' allocator for every block in use while it
+ *        refills its lookahead window, see littlefs_hooks.h.
+ *
+ * Marks the blocks pinned by a snapshot as in use too, so they are never
+ * allocated.
+ */
+void littlefs_api_alloc_lookahead(lfs_t *lfs, lfs_block_t block);
+
+/**
+ * @brief Mark the blocks a snapshot pins as in use in the current lookahead
+ *        window of lfs.
+ * @warning This must be called with lock taken
+ */
+void littlefs_api_snapshot_mask(esp_littlefs_snapshot_t *snap, lfs_t *lfs);
+
+/**
+ * @brief Check that littlefs_api_alloc_lookahead() is wired into lfs.c,
+ *        forcing a refill of the lookahead window if it hasn't run yet.
+ *
+ * The hook depends on littlefs internals; a littlefs that renamed or inlined
+ * lfs_alloc_lookahead() would still build, without ever calling it.
+ *
+ * @return ESP_OK if the hook ran, ESP_ERR_NOT_SUPPORTED if not, ESP_FAIL if
+ *         the refill failed
+ * @warning This must be called with lock taken
+ */
+esp_err_t littlefs_api_check_lookahead(esp_littlefs_t *efs);
 
 #ifdef __cplusplus
 }
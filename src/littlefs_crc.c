@@ -0,0 +1,71 @@
+/**
+ * @file littlefs_crc.c
+ * @brief lfs_crc(), the CRC32 littlefs checks every metadata fetch and commit with
+ *
+ * The build compiles littlefs' lfs_util.c with lfs_crc renamed to
+ * lfs_crc_reference, and this file provides lfs_crc() from the backend
+ * chosen with CONFIG_LITTLEFS_CRC_*. Host tools can build it, without
+ * lfs_util.c, with -DCONFIG_LITTLEFS_CRC_SLICE8.
+ */
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#include "esp32/rom/crc.h"
+#endif
+#include "littlefs_crc.h"
+
+#ifdef ESP_PLATFORM
+uint32_t esp_littlefs_crc_rom(uint32_t crc, const void *buffer, size_t size) {
+    /* The ROM inverts the CRC on the way in and out; littlefs chains it as is */
+    return ~crc32_le(~crc, buffer, size);
+}
+#endif
+
+#if CONFIG_LITTLEFS_CRC_SLICE8 || !defined(ESP_PLATFORM)
+
+static uint32_t crc_table[8][256];
+
+__attribute__((constructor)) static void crc_table_init(void) {
+    for(uint32_t i=0; i < 256; i++) {
+        uint32_t c = i;
+        for(int k=0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for(uint32_t i=0; i < 256; i++) {
+        for(int t=1; t < 8; t++) {
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xff];
+        }
+    }
+}
+
+uint32_t esp_littlefs_crc_slice8(uint32_t crc, const void *buffer, size_t size) {
+    const uint8_t *p = buffer;
+
+    /* Bytes are assembled by hand, so any alignment and either endianness works */
+    for(; size >= 8; p += 8, size -= 8) {
+        uint32_t a = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t b = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_table[7][a & 0xff] ^ crc_table[6][(a >> 8) & 0xff]
+            ^ crc_table[5][(a >> 16) & 0xff] ^ crc_table[4][a >> 24]
+            ^ crc_table[3][b & 0xff] ^ crc_table[2][(b >> 8) & 0xff]
+            ^ crc_table[1][(b >> 16) & 0xff] ^ crc_table[0][b >> 24];
+    }
+    while(size--) crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#endif
+
+#if CONFIG_LITTLEFS_CRC_ROM || CONFIG_LITTLEFS_CRC_SLICE8 || CONFIG_LITTLEFS_CRC_REFERENCE
+
+uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size) {
+#if CONFIG_LITTLEFS_CRC_ROM
+    return esp_littlefs_crc_rom(crc, buffer, size);
+#elif CONFIG_LITTLEFS_CRC_SLICE8
+    return esp_littlefs_crc_slice8(crc, buffer, size);
+#else
+    return lfs_crc_reference(crc, buffer, size);
+#endif
+}
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file littlefs_crc.h
+ * @brief CRC32 backends for littlefs' lfs_crc(); plain C, so host tools can use them.
+ *
+ * All compute littlefs' CRC: reflected polynomial 0xedb88320, chained
+ * through crc without inverting it.
+ */
+
+#ifndef LITTLEFS_CRC_H__
+#define LITTLEFS_CRC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** What littlefs calls: one of the backends below, see CONFIG_LITTLEFS_CRC_* */
+uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size);
+
+/**
+ * littlefs' own nibble-table lfs_crc() from lfs_util.c, which the build
+ * renames so lfs_crc() can be one of the backends below.
+ */
+uint32_t lfs_crc_reference(uint32_t crc, const void *buffer, size_t size);
+
+#ifdef ESP_PLATFORM
+/** The crc32_le() in the ESP32 ROM */
+uint32_t esp_littlefs_crc_rom(uint32_t crc, const void *buffer, size_t size);
+#endif
+
+#if CONFIG_LITTLEFS_CRC_SLICE8 || !defined(ESP_PLATFORM)
+/** Slicing-by-8: 8 bytes per step through 8 KB of tables */
+uint32_t esp_littlefs_crc_slice8(uint32_t crc, const void *buffer, size_t size);
+#endif
+
+#if CONFIG_LITTLEFS_CRC_ROM
+#define ESP_LITTLEFS_CRC_NAME "rom"
+#elif CONFIG_LITTLEFS_CRC_SLICE8
+#define ESP_LITTLEFS_CRC_NAME "slice8"
+#else
+#define ESP_LITTLEFS_CRC_NAME "reference"
+#endif
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
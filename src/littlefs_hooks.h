@@ -0,0 +1,29 @@
+/**
+ * @file littlefs_hooks.h
+ * @brief Force-included into littlefs' lfs.c to observe its block allocator
+ *
+ * lfs_alloc() refills its lookahead window by walking the tree with
+ * lfs_alloc_lookahead() as callback. The function-like macro below only
+ * expands where the name is followed by an argument list, i.e. littlefs'
+ * own definition, which becomes lfs_alloc_lookahead_lfs(); the callback
+ * lfs_alloc() passes to the walk is then the wrapper defined here.
+ */
+
+#ifndef LITTLEFS_HOOKS_H__
+#define LITTLEFS_HOOKS_H__
+
+#include "littlefs/lfs.h"
+
+/* In littlefs_api.c */
+void littlefs_api_alloc_lookahead(lfs_t *lfs, lfs_block_t block);
+
+static int lfs_alloc_lookahead_lfs(void *p, lfs_block_t block);
+
+static int lfs_alloc_lookahead(void *p, lfs_block_t block) {
+    littlefs_api_alloc_lookahead((lfs_t *)p, block);
+    return lfs_alloc_lookahead_lfs(p, block);
+}
+
+#define lfs_alloc_lookahead(p, block) lfs_alloc_lookahead_lfs(p, block)
+
+#endif
@@ -0,0 +1,191 @@
+/**
+ * @file littlefs_introspect.c
+ * @brief Text renderings of a mount's counters, served as read-only files under ESP_LITTLEFS_VDIR
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_littlefs.h"
+#include "littlefs_api.h"
+
+#if CONFIG_LITTLEFS_INTROSPECT
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} vfile_out_t;
+
+static const char * const op_names[ESP_LITTLEFS_OP_MAX] = {
+    "open", "close", "read", "write", "lseek", "fsync", "fstat", "stat",
+    "unlink", "rename", "opendir", "readdir", "seekdir", "closedir", "mkdir", "rmdir",
+    "telldir", "utime",
+};
+
+static const char * const lat_names[ESP_LITTLEFS_LAT_MAX - ESP_LITTLEFS_OP_MAX] = {
+    "flash_read", "flash_prog", "flash_erase", "lock_wait",
+};
+
+static const char * const err_names[ESP_LITTLEFS_ERR_MAX] = {
+    "io", "corrupt", "noent", "exist", "notdir", "isdir", "notempty", "badf",
+    "fbig", "inval", "nospc", "nomem", "noattr", "nametoolong", "busy", "rofs", "other",
+};
+
+static void vfile_printf(vfile_out_t *out, const char *fmt, ...) {
+    va_list args;
+    int n;
+
+    if(out->len + 1 >= out->size) return;
+    va_start(args, fmt);
+    n = vsnprintf(out->buf + out->len, out->size - out->len, fmt, args);
+    va_end(args);
+    /* Output past the end is dropped */
+    if(n > 0) out->len = MIN(out->len + n, out->size - 1);
+}
+
+static void vfile_stats(esp_littlefs_t *efs, vfile_out_t *out) {
+    esp_littlefs_stats_t s;
+
+    if(esp_littlefs_stats(efs->label, &s) != ESP_OK) {
+        vfile_printf(out, "disabled\n");
+        return;
+    }
+    for(int i=0; i < ESP_LITTLEFS_OP_MAX; i++)
+        vfile_printf(out, "%s %u\n", op_names[i], (unsigned)s.ops[i]);
+    vfile_printf(out, "read_bytes %llu\n", (unsigned long long)s.read_bytes);
+    vfile_printf(out, "write_bytes %llu\n", (unsigned long long)s.write_bytes);
+    vfile_printf(out, "flash_reads %u\n", (unsigned)s.flash_reads);
+    vfile_printf(out, "flash_progs %u\n", (unsigned)s.flash_progs);
+    vfile_printf(out, "flash_erases %u\n", (unsigned)s.flash_erases);
+    vfile_printf(out, "flash_read_bytes %llu\n", (unsigned long long)s.flash_read_bytes);
+    vfile_printf(out, "flash_prog_bytes %llu\n", (unsigned long long)s.flash_prog_bytes);
+    vfile_printf(out, "flash_erase_bytes %llu\n", (unsigned long long)s.flash_erase_bytes);
+    vfile_printf(out, "mount_us %u\n", (unsigned)s.mount_us);
+    for(int i=0; i < ESP_LITTLEFS_ERR_MAX; i++)
+        vfile_printf(out, "err_%s %u\n", err_names[i], (unsigned)s.errors[i]);
+}
+
+static void vfile_latency(esp_littlefs_t *efs, vfile_out_t *out) {
+    esp_littlefs_latency_t l;
+
+    vfile_printf(out, "# name count p50_us p90_us p99_us max_us\n");
+    for(int i=0; i < ESP_LITTLEFS_LAT_MAX; i++) {
+        if(esp_littlefs_latency(efs->label, i, &l) != ESP_OK) {
+            vfile_printf(out, "disabled\n");
+            return;
+        }
+        vfile_printf(out, "%s %u %u %u %u %u\n",
+                i < ESP_LITTLEFS_OP_MAX ? op_names[i] : lat_names[i - ESP_LITTLEFS_OP_MAX],
+                (unsigned)l.count, (unsigned)l.p50, (unsigned)l.p90,
+                (unsigned)l.p99, (unsigned)l.max);
+    }
+}
+
+static void vfile_open_fds(esp_littlefs_t *efs, vfile_out_t *out) {
+    vfs_littlefs_file_t *f;
+
+    vfile_printf(out, "# fd hash pos refs buffered path\n");
+    for(uint16_t i=0; i < efs->cache_size; i++) {
+        if((f = efs->cache[i]) == NULL) continue;
+        vfile_printf(out, "%u %08x %u %u %u %s\n", (unsigned)i, (unsigned)f->hash,
+                (unsigned)f->pos,
+                f->shared ? (unsigned)f->shared->refs : 0,
+                f->shared ? (unsigned)f->shared->buf_len : 0,
+#ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
+                f->path
+#else
+                "-"
+#endif
+                );
+    }
+}
+
+static void vfile_cache(esp_littlefs_t *efs, vfile_out_t *out) {
+    esp_littlefs_mem_usage_t m;
+    esp_littlefs_stats_t s;
+
+    esp_littlefs_mem_usage(&m);
+    vfile_printf(out, "budget %u\n", (unsigned)m.budget);
+    vfile_printf(out, "total %u\n", (unsigned)m.total);
+    vfile_printf(out, "peak %u\n", (unsigned)m.peak);
+    vfile_printf(out, "spiram %u\n", (unsigned)m.spiram);
+    vfile_printf(out, "mount_caches %u\n", (unsigned)m.mount_caches);
+    vfile_printf(out, "file_caches %u\n", (unsigned)m.file_caches);
+    vfile_printf(out, "file_buffers %u\n", (unsigned)m.file_buffers);
+    if(esp_littlefs_stats(efs->label, &s) == ESP_OK) {
+        vfile_printf(out, "buffer_hits %u\n", (unsigned)s.cache_hits);
+        vfile_printf(out, "buffer_misses %u\n", (unsigned)s.cache_misses);
+    }
+}
+
+static void vfile_mount(esp_littlefs_t *efs, vfile_out_t *out) {
+    const esp_littlefs_mount_timing_t *t = &efs->timing;
+
+    vfile_printf(out, "total_us %u\n", (unsigned)t->total_us);
+    vfile_printf(out, "alloc_us %u\n", (unsigned)t->alloc_us);
+    vfile_printf(out, "lock_us %u\n", (unsigned)t->lock_us);
+    vfile_printf(out, "buffers_us %u\n", (unsigned)t->buffers_us);
+    vfile_printf(out, "mount_us %u\n", (unsigned)t->mount_us);
+    vfile_printf(out, "superblock_us %u\n", (unsigned)t->superblock_us);
+    vfile_printf(out, "metadata_us %u\n", (unsigned)t->metadata_us);
+    vfile_printf(out, "mount_reads %u\n", (unsigned)t->mount_reads);
+    vfile_printf(out, "traverse_us %u\n", (unsigned)t->traverse_us);
+    vfile_printf(out, "used_blocks %u\n", (unsigned)t->used_blocks);
+    vfile_printf(out, "erase_us %u\n", (unsigned)t->erase_us);
+    vfile_printf(out, "format_us %u\n", (unsigned)t->format_us);
+    vfile_printf(out, "readers_us %u\n", (unsigned)t->readers_us);
+}
+
+static void vfile_config(esp_littlefs_t *efs, vfile_out_t *out) {
+    vfile_printf(out, "label %s\n", efs->label);
+    vfile_printf(out, "base_path %s\n", efs->base_path);
+    vfile_printf(out, "read_size %u\n", (unsigned)efs->cfg.read_size);
+    vfile_printf(out, "prog_size %u\n", (unsigned)efs->cfg.prog_size);
+    vfile_printf(out, "block_size %u\n", (unsigned)efs->cfg.block_size);
+    vfile_printf(out, "block_count %u\n", (unsigned)efs->cfg.block_count);
+    vfile_printf(out, "block_cycles %d\n", (int)efs->cfg.block_cycles);
+    vfile_printf(out, "cache_size %u\n", (unsigned)efs->cfg.cache_size);
+    vfile_printf(out, "lookahead_size %u\n", (unsigned)efs->cfg.lookahead_size);
+    vfile_printf(out, "file_buf_size %u\n", (unsigned)CONFIG_LITTLEFS_FILE_BUF_SIZE);
+    vfile_printf(out, "read_only %u\n", (unsigned)efs->read_only);
+    vfile_printf(out, "readers %u\n", (unsigned)efs->reader_count);
+    vfile_printf(out, "fd_count %u\n", (unsigned)efs->fd_count);
+    vfile_printf(out, "fd_cache_size %u\n", (unsigned)efs->cache_size);
+}
+
+static const struct {
+    const char *name;
+    void (*render)(esp_littlefs_t *efs, vfile_out_t *out);
+} vfiles[] = {
+    {"stats", vfile_stats},
+    {"latency", vfile_latency},
+    {"open_fds", vfile_open_fds},
+    {"cache", vfile_cache},
+    {"config", vfile_config},
+    {"mount", vfile_mount},
+};
+
+#define VFILE_COUNT ((int)(sizeof(vfiles) / sizeof(vfiles[0])))
+
+const char * esp_littlefs_vfile_name(int index) {
+    if(index < 0 || index >= VFILE_COUNT) return NULL;
+    return vfiles[index].name;
+}
+
+int esp_littlefs_vfile_render(esp_littlefs_t *efs, const char *name, char *buf, size_t size) {
+    vfile_out_t out = {.buf = buf, .size = size, .len = 0};
+
+    for(int i=0; i < VFILE_COUNT; i++) {
+        if(strcmp(name, vfiles[i].name) == 0) {
+            buf[0] = '\0';
+            vfiles[i].render(efs, &out);
+            return out.len;
+        }
+    }
+    return -1;
+}
+
+#endif
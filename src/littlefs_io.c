@@ -0,0 +1,172 @@
+/**
+ * @file littlefs_io.c
+ * @brief Attribution of VFS calls, bytes and flash time to the calling task, and per-task I/O budgets
+ */
+
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_littlefs.h"
+#include "littlefs_api.h"
+
+#if CONFIG_LITTLEFS_TASK_IO
+
+/**
+ * @brief Whether a task has used more flash time than its budget has refilled.
+ * @warning This must be called with io->mux held
+ */
+static bool esp_littlefs_io_owes(esp_littlefs_io_state_t *io, esp_littlefs_io_task_t *t, int64_t now) {
+    return io->budget_us && t->tokens + (now - t->refilled) * io->budget_us / 1000000 < 0;
+}
+
+/**
+ * @brief Find the entry of a task, making room for it if add is set.
+ * @return The entry, or NULL if it isn't tracked and add isn't set, or no
+ *         entry can be dropped
+ * @warning This must be called with io->mux held
+ */
+static esp_littlefs_io_task_t * esp_littlefs_io_task(esp_littlefs_io_state_t *io, TaskHandle_t task,
+        int64_t now, bool add) {
+    esp_littlefs_io_task_t *t = NULL;
+
+    io->clock++;
+    for(uint8_t i=0; i < io->task_count; i++) {
+        if(io->tasks[i].task == task) {
+            io->tasks[i].used = io->clock;
+            return &io->tasks[i];
+        }
+    }
+    if(!add) return NULL;
+    if(io->task_count < ESP_LITTLEFS_IO_TASKS) {
+        t = &io->tasks[io->task_count++];
+    }
+    else {
+        /* Drop the task charged least recently; a task that was just added
+         * has used no flash yet and would keep being replaced. A task that
+         * still owes flash time stays, or it would come back with a full
+         * budget. */
+        for(uint8_t i=0; i < ESP_LITTLEFS_IO_TASKS; i++) {
+            esp_littlefs_io_task_t *c = &io->tasks[i];
+            if(esp_littlefs_io_owes(io, c, now)) continue;
+            if(t == NULL || io->clock - c->used > io->clock - t->used) t = c;
+        }
+        if(t == NULL) {
+            io->untracked++;
+            return NULL;
+        }
+        io->evicted++;
+    }
+    memset(t, 0, sizeof(*t));
+    t->task = task;
+    t->tokens = io->budget_us;
+    t->refilled = now;
+    t->used = io->clock;
+    strlcpy(t->stats.task, pcTaskGetTaskName(task), sizeof(t->stats.task));
+    return t;
+}
+
+void esp_littlefs_io_op(esp_littlefs_t *efs) {
+    esp_littlefs_io_state_t *io = &efs->io;
+    int64_t now = esp_timer_get_time();
+    int64_t wait = 0;
+    esp_littlefs_io_task_t *t;
+
+    portENTER_CRITICAL(&io->mux);
+    t = esp_littlefs_io_task(io, xTaskGetCurrentTaskHandle(), now, true);
+    if(t == NULL) {
+        portEXIT_CRITICAL(&io->mux);
+        return;
+    }
+    t->stats.ops++;
+    if(io->budget_us) {
+        /* Token bucket: budget_us per second, up to one second's worth */
+        t->tokens = MIN(t->tokens + (now - t->refilled) * io->budget_us / 1000000, (int64_t)io->budget_us);
+        t->refilled = now;
+        if(t->tokens < 0) {
+            wait = -t->tokens * 1000000 / io->budget_us;
+            t->stats.throttled++;
+            t->stats.throttled_us += wait;
+        }
+    }
+    portEXIT_CRITICAL(&io->mux);
+
+    /* Only called by the hook wrappers, before the hook takes any lock */
+    if(wait > 0) vTaskDelay(MAX(1, pdMS_TO_TICKS((wait + 999) / 1000)));
+}
+
+void esp_littlefs_io_user(esp_littlefs_t *efs, bool write, size_t bytes) {
+    esp_littlefs_io_state_t *io = &efs->io;
+    esp_littlefs_io_task_t *t;
+
+    portENTER_CRITICAL(&io->mux);
+    t = esp_littlefs_io_task(io, xTaskGetCurrentTaskHandle(), esp_timer_get_time(), true);
+    if(t != NULL) {
+        if(write) t->stats.write_bytes += bytes;
+        else t->stats.read_bytes += bytes;
+    }
+    portEXIT_CRITICAL(&io->mux);
+}
+
+void esp_littlefs_io_flash(esp_littlefs_t *efs, int which, size_t bytes, int64_t t0) {
+    esp_littlefs_io_flash_task(efs, xTaskGetCurrentTaskHandle(), which, bytes, t0);
+}
+
+void esp_littlefs_io_flash_task(esp_littlefs_t *efs, TaskHandle_t task, int which, size_t bytes, int64_t t0) {
+    esp_littlefs_io_state_t *io = &efs->io;
+    int64_t now = esp_timer_get_time();
+    esp_littlefs_io_task_t *t;
+
+    portENTER_CRITICAL(&io->mux);
+    /* Transfers finish on the transfer task, possibly after the task that
+     * queued them was dropped from the table, or deleted. A task the table
+     * has no room for goes uncharged too. */
+    t = esp_littlefs_io_task(io, task, now, task == xTaskGetCurrentTaskHandle());
+    if(t == NULL) {
+        portEXIT_CRITICAL(&io->mux);
+        return;
+    }
+    switch(which) {
+        case ESP_LITTLEFS_LAT_FLASH_READ: t->stats.flash_read_bytes += bytes; break;
+        case ESP_LITTLEFS_LAT_FLASH_PROG: t->stats.flash_prog_bytes += bytes; break;
+        default:                          t->stats.flash_erase_bytes += bytes; break;
+    }
+    t->stats.flash_us += now - t0;
+    t->tokens -= now - t0;
+    portEXIT_CRITICAL(&io->mux);
+}
+
+void esp_littlefs_io_report(esp_littlefs_t *efs, esp_littlefs_top_t *top) {
+    esp_littlefs_io_state_t *io = &efs->io;
+
+    memset(top, 0, sizeof(*top));
+    portENTER_CRITICAL(&io->mux);
+    top->task_count = io->task_count;
+    top->evicted = io->evicted;
+    top->untracked = io->untracked;
+    top->budget_us = io->budget_us;
+    for(uint8_t i=0; i < io->task_count; i++) top->tasks[i] = io->tasks[i].stats;
+    portEXIT_CRITICAL(&io->mux);
+
+    /* Heaviest first */
+    for(uint8_t i=1; i < top->task_count; i++) {
+        esp_littlefs_task_io_t t = top->tasks[i];
+        int j = i;
+        for(; j > 0 && top->tasks[j - 1].flash_us < t.flash_us; j--)
+            top->tasks[j] = top->tasks[j - 1];
+        top->tasks[j] = t;
+    }
+}
+
+void esp_littlefs_io_clear(esp_littlefs_t *efs) {
+    esp_littlefs_io_state_t *io = &efs->io;
+
+    portENTER_CRITICAL(&io->mux);
+    io->task_count = 0;
+    io->evicted = 0;
+    io->untracked = 0;
+    portEXIT_CRITICAL(&io->mux);
+}
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * @file littlefs_mem.c
+ * @brief Placement, accounting and budget of the RAM esp_littlefs buffers use
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_littlefs.h"
+#include "littlefs_api.h"
+
+static const char TAG[] = "esp_littlefs_mem";
+
+/**
+ * @brief Prepended to every buffer so it can be accounted when freed.
+ *        8 bytes, so the buffer keeps the heap's alignment.
+ */
+typedef struct {
+    uint32_t size;
+    uint16_t kind;
+    uint16_t spiram;
+} esp_littlefs_mem_hdr_t;
+
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+/* One pool per kind; the mount cache slots also hold lookahead buffers */
+ESP_LITTLEFS_POOL_DEFINE(mount_cache_pool, sizeof(esp_littlefs_mem_hdr_t)
+        + MAX(CONFIG_LITTLEFS_CACHE_SIZE, CONFIG_LITTLEFS_LOOKAHEAD_SIZE),
+        3 * CONFIG_LITTLEFS_STATIC_INSTANCES);
+ESP_LITTLEFS_POOL_DEFINE(file_cache_pool, sizeof(esp_littlefs_mem_hdr_t)
+        + CONFIG_LITTLEFS_CACHE_SIZE, CONFIG_LITTLEFS_STATIC_MAX_FILES);
+ESP_LITTLEFS_POOL_DEFINE(file_buf_pool, sizeof(esp_littlefs_mem_hdr_t)
+        + CONFIG_LITTLEFS_FILE_BUF_SIZE, CONFIG_LITTLEFS_STATIC_MAX_FILES);
+
+static esp_littlefs_pool_t * const mem_pools[ESP_LITTLEFS_MEM_KIND_MAX] = {
+    [ESP_LITTLEFS_MEM_MOUNT_CACHE] = &mount_cache_pool,
+    [ESP_LITTLEFS_MEM_FILE_CACHE] = &file_cache_pool,
+    [ESP_LITTLEFS_MEM_FILE_BUF] = &file_buf_pool,
+};
+#endif
+
+static portMUX_TYPE mem_mux = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE pool_mux = portMUX_INITIALIZER_UNLOCKED;
+static size_t mem_budget = CONFIG_LITTLEFS_MEM_BUDGET;
+static size_t mem_total;
+static size_t mem_peak;
+static size_t mem_spiram;
+static size_t mem_kind[ESP_LITTLEFS_MEM_KIND_MAX];
+
+/**
+ * @brief Reserve size bytes of the budget.
+ * @return false if that would exceed the budget.
+ */
+static bool esp_littlefs_mem_reserve(esp_littlefs_mem_kind_t kind, size_t size) {
+    bool ok;
+
+    portENTER_CRITICAL(&mem_mux);
+    ok = mem_budget == 0 || mem_total + size <= mem_budget;
+    if(ok) {
+        mem_total += size;
+        mem_kind[kind] += size;
+        if(mem_total > mem_peak) mem_peak = mem_total;
+    }
+    portEXIT_CRITICAL(&mem_mux);
+
+    return ok;
+}
+
+static void esp_littlefs_mem_unreserve(esp_littlefs_mem_kind_t kind, size_t size, bool spiram) {
+    portENTER_CRITICAL(&mem_mux);
+    mem_total -= size;
+    mem_kind[kind] -= size;
+    if(spiram) mem_spiram -= size;
+    portEXIT_CRITICAL(&mem_mux);
+}
+
+void * esp_littlefs_pool_take(esp_littlefs_pool_t *pool) {
+    uint8_t *p = NULL;
+
+    portENTER_CRITICAL(&pool_mux);
+    for(uint16_t i=0; i < pool->count; i++) {
+        if(!(pool->used[i / 32] & (1u << (i % 32)))) {
+            pool->used[i / 32] |= 1u << (i % 32);
+            p = pool->mem + i * pool->size;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&pool_mux);
+
+    return p;
+}
+
+void * esp_littlefs_pool_alloc(esp_littlefs_pool_t *pool, size_t size) {
+    uint8_t *p;
+
+    if(size > pool->size) return NULL;
+    p = esp_littlefs_pool_take(pool);
+    if(p) memset(p, 0, pool->size);
+    return p;
+}
+
+void esp_littlefs_pool_free(esp_littlefs_pool_t *pool, void *p) {
+    if(p == NULL) return;
+    size_t i = ((uint8_t *)p - pool->mem) / pool->size;
+    assert(i < pool->count);
+
+    portENTER_CRITICAL(&pool_mux);
+    pool->used[i / 32] &= ~(1u << (i % 32));
+    portEXIT_CRITICAL(&pool_mux);
+}
+
+/**
+ * @brief Get memory for a buffer and its header from the pool or the heap.
+ */
+static esp_littlefs_mem_hdr_t * esp_littlefs_mem_place(esp_littlefs_mem_kind_t kind, size_t size, bool *spiram) {
+    esp_littlefs_mem_hdr_t *hdr = NULL;
+
+    *spiram = false;
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    hdr = esp_littlefs_pool_alloc(mem_pools[kind], sizeof(*hdr) + size);
+#else
+#if CONFIG_LITTLEFS_MEM_PREFER_SPIRAM
+    hdr = heap_caps_malloc(sizeof(*hdr) + size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    *spiram = hdr != NULL;
+#endif
+    if(hdr == NULL) {
+        hdr = heap_caps_malloc(sizeof(*hdr) + size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+#endif
+    return hdr;
+}
+
+void * esp_littlefs_mem_alloc(esp_littlefs_mem_kind_t kind, size_t size) {
+    esp_littlefs_mem_hdr_t *hdr = NULL;
+    bool spiram = false;
+
+    if(!esp_littlefs_mem_reserve(kind, size)) {
+        /* Evictable buffers make room for anything but more of themselves */
+        if(kind == ESP_LITTLEFS_MEM_FILE_BUF) return NULL;
+        esp_littlefs_mem_reclaim(size);
+        if(!esp_littlefs_mem_reserve(kind, size)) {
+            ESP_LOGW(TAG, "%d bytes would exceed the budget of %d", size, mem_budget);
+            return NULL;
+        }
+    }
+
+    hdr = esp_littlefs_mem_place(kind, size, &spiram);
+#if !CONFIG_LITTLEFS_STATIC_ALLOC
+    if(hdr == NULL && kind != ESP_LITTLEFS_MEM_FILE_BUF) {
+        /* The heap is short even if the budget isn't; read-ahead buffers
+         * give some back. Pools are per kind, so this only helps the heap. */
+        if(esp_littlefs_mem_reclaim(size) > 0) hdr = esp_littlefs_mem_place(kind, size, &spiram);
+    }
+#endif
+    if(hdr == NULL) {
+        esp_littlefs_mem_unreserve(kind, size, false);
+        return NULL;
+    }
+
+    hdr->size = size;
+    hdr->kind = kind;
+    hdr->spiram = spiram;
+    if(spiram) {
+        portENTER_CRITICAL(&mem_mux);
+        mem_spiram += size;
+        portEXIT_CRITICAL(&mem_mux);
+    }
+    return hdr + 1;
+}
+
+void esp_littlefs_mem_free(void *buf) {
+    if(buf == NULL) return;
+    esp_littlefs_mem_hdr_t *hdr = (esp_littlefs_mem_hdr_t *)buf - 1;
+    esp_littlefs_mem_unreserve(hdr->kind, hdr->size, hdr->spiram);
+#if CONFIG_LITTLEFS_STATIC_ALLOC
+    esp_littlefs_pool_free(mem_pools[hdr->kind], hdr);
+#else
+    heap_caps_free(hdr);
+#endif
+}
+
+esp_err_t esp_littlefs_mem_set_budget(size_t bytes) {
+    size_t total;
+
+    portENTER_CRITICAL(&mem_mux);
+    mem_budget = bytes;
+    total = mem_total;
+    portEXIT_CRITICAL(&mem_mux);
+
+    if(bytes == 0 || total <= bytes) return ESP_OK;
+    esp_littlefs_mem_reclaim(total - bytes);
+
+    portENTER_CRITICAL(&mem_mux);
+    total = mem_total;
+    portEXIT_CRITICAL(&mem_mux);
+    return total <= bytes ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void esp_littlefs_mem_usage(esp_littlefs_mem_usage_t *usage) {
+    assert(usage);
+    portENTER_CRITICAL(&mem_mux);
+    usage->budget = mem_budget;
+    usage->total = mem_total;
+    usage->peak = mem_peak;
+    usage->spiram = mem_spiram;
+    usage->mount_caches = mem_kind[ESP_LITTLEFS_MEM_MOUNT_CACHE];
+    usage->file_caches = mem_kind[ESP_LITTLEFS_MEM_FILE_CACHE];
+    usage->file_buffers = mem_kind[ESP_LITTLEFS_MEM_FILE_BUF];
+    portEXIT_CRITICAL(&mem_mux);
+}
@@ -0,0 +1,103 @@
+/**
+ * @file littlefs_trace.c
+ * @brief Ring buffer of VFS and block-device calls of one mount
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_littlefs.h"
+#include "littlefs_api.h"
+
+#if CONFIG_LITTLEFS_TRACE
+
+esp_littlefs_t * volatile esp_littlefs_traced;
+
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+static esp_littlefs_trace_rec_t trace_ring[CONFIG_LITTLEFS_TRACE_ENTRIES];
+static esp_littlefs_trace_hdr_t trace_hdr;
+static uint32_t trace_head;   /* Next record to write */
+static uint32_t trace_count;  /* Records not read yet */
+
+void esp_littlefs_trace_add(uint8_t type, uint8_t op, int64_t t0,
+        uint32_t arg0, uint32_t arg1, uint32_t arg2) {
+    int64_t t1 = esp_timer_get_time();
+    esp_littlefs_trace_rec_t *rec;
+
+    portENTER_CRITICAL(&trace_mux);
+    rec = &trace_ring[trace_head];
+    rec->time = (uint32_t)t0;
+    rec->type = type;
+    rec->op = op;
+    rec->reserved = 0;
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+    rec->arg2 = arg2;
+    rec->duration = (uint32_t)(t1 - t0);
+    trace_head = (trace_head + 1) % CONFIG_LITTLEFS_TRACE_ENTRIES;
+    if(trace_count < CONFIG_LITTLEFS_TRACE_ENTRIES) trace_count++;
+    else trace_hdr.dropped++;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+void esp_littlefs_trace_begin(esp_littlefs_t *efs) {
+    portENTER_CRITICAL(&trace_mux);
+    trace_head = 0;
+    trace_count = 0;
+    trace_hdr.magic = ESP_LITTLEFS_TRACE_MAGIC;
+    trace_hdr.version = ESP_LITTLEFS_TRACE_VERSION;
+    trace_hdr.rec_size = sizeof(esp_littlefs_trace_rec_t);
+    trace_hdr.read_size = efs->cfg.read_size;
+    trace_hdr.prog_size = efs->cfg.prog_size;
+    trace_hdr.block_size = efs->cfg.block_size;
+    trace_hdr.block_count = efs->cfg.block_count;
+    trace_hdr.cache_size = efs->cfg.cache_size;
+    trace_hdr.lookahead_size = efs->cfg.lookahead_size;
+    trace_hdr.block_cycles = efs->cfg.block_cycles;
+    trace_hdr.dropped = 0;
+    esp_littlefs_traced = efs;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+void esp_littlefs_trace_stop(void) {
+    esp_littlefs_traced = NULL;
+}
+
+void esp_littlefs_trace_header(esp_littlefs_trace_hdr_t *hdr) {
+    portENTER_CRITICAL(&trace_mux);
+    *hdr = trace_hdr;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+size_t esp_littlefs_trace_read(esp_littlefs_trace_rec_t *recs, size_t max) {
+    size_t n = 0;
+
+    /* One record per critical section; recording may go on meanwhile */
+    while(n < max) {
+        portENTER_CRITICAL(&trace_mux);
+        if(trace_count == 0) {
+            portEXIT_CRITICAL(&trace_mux);
+            break;
+        }
+        uint32_t tail = (trace_head + CONFIG_LITTLEFS_TRACE_ENTRIES - trace_count)
+                % CONFIG_LITTLEFS_TRACE_ENTRIES;
+        recs[n++] = trace_ring[tail];
+        trace_count--;
+        portEXIT_CRITICAL(&trace_mux);
+    }
+    return n;
+}
+
+#else
+
+void esp_littlefs_trace_stop(void) {
+}
+
+void esp_littlefs_trace_header(esp_littlefs_trace_hdr_t *hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+}
+
+size_t esp_littlefs_trace_read(esp_littlefs_trace_rec_t *recs, size_t max) {
+    return 0;
+}
+
+#endif
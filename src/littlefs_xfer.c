@@ -0,0 +1,236 @@
+/**
+ * @file littlefs_xfer.c
+ * @brief Double-buffered transfers of the external data flash
+ *
+ * A task per mount does every data_spiflash_*() call, from a FIFO of slots:
+ * two ping-pong buffers and one for reads straight into the caller's buffer
+ * and for erases. Being in order, a read queued after a program sees it.
+ * Programs are copied into the next ping-pong buffer and queued, so littlefs
+ * prepares the next page while the last is written. A read that starts where
+ * the previous one ended queues a read of the same size after it, into the
+ * other buffer, which the next sequential read then only copies out.
+ *
+ * data_spiflash_*() is synchronous; with a DMA-capable driver, the task is
+ * where its completion would be awaited.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_littlefs.h"
+#include "littlefs_api.h"
+
+#include "data_spiflash.h"
+#include "config.h"
+#include "alloc.h"
+
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+
+static const char TAG[] = "esp_littlefs_xfer";
+
+#define XFER_DIRECT 2                         /* Slot for caller buffers and erases */
+
+static void xfer_task(void *arg) {
+    esp_littlefs_t *efs = arg;
+    esp_littlefs_xfer_t *xfer = efs->xfer;
+    esp_littlefs_xfer_slot_t *s;
+
+    for(;;) {
+        xQueueReceive(xfer->queue, &s, portMAX_DELAY);
+        if(s == NULL) break;
+        /* bd_prog() and bd_erase() return once these are queued, so they are
+         * timed and charged to the task that queued them here */
+        int64_t t0 = ESP_LITTLEFS_LAT_NOW();
+        switch(s->op) {
+            case ESP_LITTLEFS_XFER_READ:
+                for(uint32_t done=0; done < s->len; done += ESP_LITTLEFS_EXTERNAL_MAX_READ)
+                    data_spiflash_read(s->addr + done, s->buf + done,
+                            MIN(s->len - done, ESP_LITTLEFS_EXTERNAL_MAX_READ));
+                break;
+            case ESP_LITTLEFS_XFER_PROG:
+                data_spiflash_write(s->addr, s->buf, s->len);
+                ESP_LITTLEFS_LAT_RECORD(efs, ESP_LITTLEFS_LAT_FLASH_PROG, t0);
+                ESP_LITTLEFS_IO_FLASH_TASK(efs, s->task, ESP_LITTLEFS_LAT_FLASH_PROG, s->len, t0);
+                break;
+            case ESP_LITTLEFS_XFER_ERASE:
+                data_spiflash_erase(s->addr, s->len);
+                ESP_LITTLEFS_LAT_RECORD(efs, ESP_LITTLEFS_LAT_FLASH_ERASE, t0);
+                ESP_LITTLEFS_IO_FLASH_TASK(efs, s->task, ESP_LITTLEFS_LAT_FLASH_ERASE, s->len, t0);
+                break;
+        }
+        xSemaphoreGive(s->done);
+    }
+    /* esp_littlefs_xfer_free() waits for this */
+    xSemaphoreGive(xfer->slot[XFER_DIRECT].done);
+    vTaskDelete(NULL);
+}
+
+static void xfer_wait(esp_littlefs_xfer_slot_t *s) {
+    if(!s->busy) return;
+    xSemaphoreTake(s->done, portMAX_DELAY);
+    s->busy = false;
+}
+
+static void xfer_submit(esp_littlefs_xfer_t *xfer, esp_littlefs_xfer_slot_t *s,
+        uint8_t op, uint32_t addr, uint32_t len) {
+    s->op = op;
+    s->addr = addr;
+    s->len = len;
+    s->task = xTaskGetCurrentTaskHandle();
+    s->busy = true;
+    xQueueSend(xfer->queue, &s, portMAX_DELAY);
+}
+
+/**
+ * @brief Take the next ping-pong buffer, waiting for what it was last used for.
+ */
+static esp_littlefs_xfer_slot_t * xfer_next(esp_littlefs_xfer_t *xfer) {
+    esp_littlefs_xfer_slot_t *s = &xfer->slot[xfer->next];
+
+    xfer->next ^= 1;
+    xfer_wait(s);
+    s->valid = false;
+    return s;
+}
+
+/**
+ * @brief Forget prefetched data; the flash under it is about to change.
+ */
+static void xfer_invalidate(esp_littlefs_xfer_t *xfer) {
+    xfer->slot[0].valid = false;
+    xfer->slot[1].valid = false;
+    xfer->seq_end = 0;
+}
+
+esp_err_t esp_littlefs_xfer_init(esp_littlefs_t *efs) {
+    esp_littlefs_xfer_t *xfer;
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    xfer = low_calloc(1, sizeof(esp_littlefs_xfer_t));
+    if(xfer == NULL) {
+        ESP_LOGE(TAG, "transfer state could not be malloced");
+        return ESP_ERR_NO_MEM;
+    }
+    efs->xfer = xfer;
+    xfer->end = CONFIG_CLIENT_SIZE_DATA_OFFSET + efs->cfg.block_count * efs->cfg.block_size;
+    for(int i=0; i < 3; i++) {
+        esp_littlefs_xfer_slot_t *s = &xfer->slot[i];
+        if(i != XFER_DIRECT) {
+            s->buf = heap_caps_malloc(CONFIG_LITTLEFS_EXTERNAL_XFER_BUF_SIZE, MALLOC_CAP_DMA);
+            if(s->buf == NULL) {
+                ESP_LOGE(TAG, "transfer buffer could not be malloced");
+                goto exit;
+            }
+        }
+        s->done = xSemaphoreCreateBinary();
+        if(s->done == NULL) {
+            ESP_LOGE(TAG, "transfer semaphore could not be created");
+            goto exit;
+        }
+    }
+    /* At most every slot and the stop request are queued at once */
+    xfer->queue = xQueueCreate(4, sizeof(esp_littlefs_xfer_slot_t *));
+    if(xfer->queue == NULL) {
+        ESP_LOGE(TAG, "transfer queue could not be created");
+        goto exit;
+    }
+    if(xTaskCreate(xfer_task, "lfs_xfer", 2048, efs, CONFIG_LITTLEFS_EXTERNAL_XFER_PRIO,
+            &xfer->task) != pdPASS) {
+        ESP_LOGE(TAG, "transfer task could not be created");
+        xfer->task = NULL;
+        goto exit;
+    }
+    err = ESP_OK;
+
+exit:
+    if(err != ESP_OK) {
+        esp_littlefs_xfer_free(xfer);
+        efs->xfer = NULL;
+    }
+    return err;
+}
+
+void esp_littlefs_xfer_free(esp_littlefs_xfer_t *xfer) {
+    esp_littlefs_xfer_slot_t *stop = NULL;
+
+    if(xfer == NULL) return;
+    if(xfer->task) {
+        esp_littlefs_xfer_drain(xfer);
+        xQueueSend(xfer->queue, &stop, portMAX_DELAY);
+        xSemaphoreTake(xfer->slot[XFER_DIRECT].done, portMAX_DELAY);
+        ESP_LOGD(TAG, "%u reads prefetched, %u not", xfer->hits, xfer->misses);
+    }
+    if(xfer->queue) vQueueDelete(xfer->queue);
+    for(int i=0; i < 3; i++) {
+        if(xfer->slot[i].done) vSemaphoreDelete(xfer->slot[i].done);
+        if(i != XFER_DIRECT) heap_caps_free(xfer->slot[i].buf);
+    }
+    free(xfer);
+}
+
+void esp_littlefs_xfer_read(esp_littlefs_xfer_t *xfer, uint32_t addr, void *buffer, uint32_t size) {
+    esp_littlefs_xfer_slot_t *s = NULL;
+    bool sequential = addr == xfer->seq_end;
+
+    for(int i=0; i < 2; i++) {
+        esp_littlefs_xfer_slot_t *p = &xfer->slot[i];
+        if(p->valid && addr >= p->addr && addr + size <= p->addr + p->len) s = p;
+    }
+    if(s) {
+        xfer_wait(s);
+        memcpy(buffer, s->buf + (addr - s->addr), size);
+        xfer->hits++;
+    }
+    else {
+        /* Straight into the caller's buffer, after everything queued before */
+        s = &xfer->slot[XFER_DIRECT];
+        xfer_wait(s);
+        s->buf = buffer;
+        xfer_submit(xfer, s, ESP_LITTLEFS_XFER_READ, addr, size);
+        xfer_wait(s);
+        s->buf = NULL;
+        xfer->misses++;
+    }
+    xfer->seq_end = addr + size;
+
+    /* Fetch what a sequential reader will want next while littlefs handles this */
+    if(sequential && size <= CONFIG_LITTLEFS_EXTERNAL_XFER_BUF_SIZE && addr + 2 * size <= xfer->end) {
+        for(int i=0; i < 2; i++) {
+            if(xfer->slot[i].valid && xfer->slot[i].addr == addr + size) return;
+        }
+        s = xfer_next(xfer);
+        xfer_submit(xfer, s, ESP_LITTLEFS_XFER_READ, addr + size, size);
+        s->valid = true;
+    }
+}
+
+void esp_littlefs_xfer_prog(esp_littlefs_xfer_t *xfer, uint32_t addr, const void *buffer, uint32_t size) {
+    xfer_invalidate(xfer);
+    for(uint32_t done=0; done < size; done += CONFIG_LITTLEFS_EXTERNAL_XFER_BUF_SIZE) {
+        uint32_t len = MIN(size - done, CONFIG_LITTLEFS_EXTERNAL_XFER_BUF_SIZE);
+        esp_littlefs_xfer_slot_t *s = xfer_next(xfer);
+        memcpy(s->buf, (const uint8_t *)buffer + done, len);
+        xfer_submit(xfer, s, ESP_LITTLEFS_XFER_PROG, addr + done, len);
+    }
+}
+
+void esp_littlefs_xfer_erase(esp_littlefs_xfer_t *xfer, uint32_t addr, uint32_t size) {
+    esp_littlefs_xfer_slot_t *s = &xfer->slot[XFER_DIRECT];
+
+    xfer_invalidate(xfer);
+    xfer_wait(s);
+    xfer_submit(xfer, s, ESP_LITTLEFS_XFER_ERASE, addr, size);
+}
+
+void esp_littlefs_xfer_drain(esp_littlefs_xfer_t *xfer) {
+    for(int i=0; i < 3; i++) xfer_wait(&xfer->slot[i]);
+    xfer_invalidate(xfer);
+}
+
+#endif
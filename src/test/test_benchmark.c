@@ -5,12 +5,26 @@
 #include "esp_timer.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
+#include "esp_heap_caps.h"
 #include "esp_littlefs.h"
+#include "littlefs_crc.h"
+#include "littlefs_api.h"
+#include "esp_spi_flash.h"
+#include "data_spiflash.h"
+#include "config.h"
 #include "unity.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
 static const char TAG[] = "[benchmark]";
 
@@ -218,3 +232,952 @@ TEST_CASE("Write 5 files, then delete 5 files", TAG){
     write_test_1("/littlefs", 5);
     test_teardown();
 }
+
+typedef struct {
+    esp_littlefs_snapshot_t *snap;
+    volatile bool stop;
+    uint32_t passes;
+    uint64_t bytes;
+    int err;                /* First failure; asserted by the test, not the task */
+    SemaphoreHandle_t done;
+} backup_task_arg_t;
+
+/**
+ * @brief Repeatedly reads every file in the snapshot's root, like a backup would.
+ */
+static void backup_task(void *param)
+{
+    backup_task_arg_t *args = param;
+    static uint8_t buf[1024];
+    lfs_dir_t dir;
+    struct lfs_info info;
+
+    while(!args->stop) {
+        int res = esp_littlefs_snapshot_dir_open(args->snap, &dir, "/");
+        if(res < 0) {
+            args->err = res;
+            break;
+        }
+        while(!args->stop && esp_littlefs_snapshot_dir_read(args->snap, &dir, &info) > 0) {
+            if(info.type != LFS_TYPE_REG) continue;
+            char path[LFS_NAME_MAX + 2];
+            snprintf(path, sizeof(path), "/%s", info.name);
+            lfs_file_t file;
+            if(esp_littlefs_snapshot_file_open(args->snap, &file, path) < 0) continue;
+            lfs_ssize_t n;
+            while((n = esp_littlefs_snapshot_file_read(args->snap, &file, buf, sizeof(buf))) > 0) {
+                args->bytes += n;
+            }
+            esp_littlefs_snapshot_file_close(args->snap, &file);
+        }
+        esp_littlefs_snapshot_dir_close(args->snap, &dir);
+        args->passes++;
+    }
+
+    xSemaphoreGive(args->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("Write throughput while a snapshot backup runs", TAG){
+    uint64_t t_start, t_idle, t_backup;
+    const uint32_t n_files = 3;
+
+    setup_littlefs();
+
+    /* Something for the backup to copy */
+    for(uint8_t i=0; i < n_files; i++){
+        char fname[32];
+        snprintf(fname, sizeof(fname), "/littlefs/backup%d.txt", i);
+        FILE* f = fopen(fname, "w");
+        TEST_ASSERT_NOT_NULL(f);
+        for(uint32_t j=0; j < 1000; j++) {
+            fprintf(f, "All work and no play makes Jack a dull boy.\n");
+        }
+        fclose(f);
+    }
+
+    t_start = esp_timer_get_time();
+    write_test_1("/littlefs", n_files);
+    t_idle = esp_timer_get_time() - t_start;
+
+    backup_task_arg_t args = { .done = xSemaphoreCreateBinary() };
+    TEST_ESP_OK(esp_littlefs_snapshot_take("flash_test", &args.snap));
+    xTaskCreatePinnedToCore(&backup_task, "backup", 4096, &args, 3, NULL, portNUM_PROCESSORS - 1);
+
+    t_start = esp_timer_get_time();
+    write_test_1("/littlefs", n_files);
+    t_backup = esp_timer_get_time() - t_start;
+
+    args.stop = true;
+    xSemaphoreTake(args.done, portMAX_DELAY);
+    vSemaphoreDelete(args.done);
+    TEST_ESP_OK(esp_littlefs_snapshot_release(args.snap));
+    TEST_ASSERT_EQUAL(0, args.err);
+
+    printf("Write+delete without backup: %lld us\n", t_idle);
+    printf("Write+delete during backup:  %lld us (%.1f%%)\n", t_backup,
+            100.0 * t_backup / t_idle);
+    printf("Backup: %d passes, %lld bytes read\n", args.passes, args.bytes);
+
+    for(uint8_t i=0; i < n_files; i++){
+        char fname[32];
+        snprintf(fname, sizeof(fname), "/littlefs/backup%d.txt", i);
+        unlink(fname);
+    }
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+}
+
+typedef struct {
+    const char *fname;
+    uint32_t iter;
+    uint64_t bytes;
+    uint32_t errors;        /* Failed calls; Unity can only fail the test task */
+    SemaphoreHandle_t done;
+} read_task_arg_t;
+
+static void read_task(void *param)
+{
+    read_task_arg_t *args = param;
+    static uint8_t bufs[portNUM_PROCESSORS][1024];
+    uint8_t *buf = bufs[xPortGetCoreID()];
+
+    for(uint32_t i=0; i < args->iter; i++) {
+        int fd = open(args->fname, O_RDONLY);
+        if(fd < 0) {
+            args->errors++;
+            continue;
+        }
+        ssize_t n;
+        while((n = read(fd, buf, sizeof(bufs[0]))) > 0) {
+            args->bytes += n;
+        }
+        if(n < 0) args->errors++;
+        close(fd);
+    }
+
+    xSemaphoreGive(args->done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Read fname iter times from each of n_tasks tasks, one per core.
+ * @return aggregate throughput in KB/s
+ */
+static uint32_t read_throughput(const char *fname, int n_tasks, uint32_t iter)
+{
+    read_task_arg_t args[portNUM_PROCESSORS];
+    uint64_t bytes = 0;
+    uint32_t errors = 0;
+
+    uint64_t t_start = esp_timer_get_time();
+    for(int i=0; i < n_tasks; i++) {
+        args[i] = (read_task_arg_t){ .fname = fname, .iter = iter, .done = xSemaphoreCreateBinary() };
+        xTaskCreatePinnedToCore(&read_task, "reader", 4096, &args[i], 3, NULL, i);
+    }
+    for(int i=0; i < n_tasks; i++) {
+        xSemaphoreTake(args[i].done, portMAX_DELAY);
+        vSemaphoreDelete(args[i].done);
+        bytes += args[i].bytes;
+        errors += args[i].errors;
+    }
+    uint64_t t_total = esp_timer_get_time() - t_start;
+    TEST_ASSERT_EQUAL(0, errors);
+
+    return (uint32_t)(bytes * 1000000 / 1024 / t_total);
+}
+
+/* flash_test is on the external data flash, whose reads are serialized even
+ * on read-only mounts; only littlefs' own work runs on both cores here */
+TEST_CASE("Dual-core read throughput on a read-only mount", TAG){
+    const char fname[] = "/littlefs/ro_bench.txt";
+
+    setup_littlefs();
+    FILE* f = fopen(fname, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for(uint32_t j=0; j < 2000; j++) {
+        fprintf(f, "All work and no play makes Jack a dull boy.\n");
+    }
+    fclose(f);
+
+    printf("Read-write mount:\n");
+    printf("  1 task:  %d KB/s\n", read_throughput(fname, 1, 4));
+    printf("  %d tasks: %d KB/s\n", portNUM_PROCESSORS,
+            read_throughput(fname, portNUM_PROCESSORS, 4));
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = "/littlefs",
+        .partition_label = "flash_test",
+        .read_only = true
+    };
+    TEST_ESP_OK(esp_vfs_littlefs_register(&conf));
+    printf("Read-only mount (external flash reads serialized):\n");
+    printf("  1 task:  %d KB/s\n", read_throughput(fname, 1, 4));
+    printf("  %d tasks: %d KB/s\n", portNUM_PROCESSORS,
+            read_throughput(fname, portNUM_PROCESSORS, 4));
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+
+    setup_littlefs();
+    unlink(fname);
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+}
+
+typedef struct {
+    int id;
+    uint32_t iter;
+    uint32_t errors;        /* Failed or short calls; Unity can only fail the test task */
+    SemaphoreHandle_t done;
+} stream_task_arg_t;
+
+static void stream_task(void *param)
+{
+    stream_task_arg_t *args = param;
+    const char line[] = "All work and no play makes Jack a dull boy.\n";
+    char fname[32];
+    char buf[sizeof(line)];
+
+    snprintf(fname, sizeof(fname), "/littlefs/stream%d.txt", args->id);
+    int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC);
+    if(fd < 0) {
+        args->errors++;
+        goto exit;
+    }
+    for(uint32_t i=0; i < args->iter; i++) {
+        if(write(fd, line, sizeof(line) - 1) != sizeof(line) - 1) args->errors++;
+    }
+    lseek(fd, 0, SEEK_SET);
+    uint32_t lines = 0;
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(line) - 1)) == sizeof(line) - 1) lines++;
+    if(n != 0 || lines != args->iter) args->errors++;
+    close(fd);
+    unlink(fname);
+
+exit:
+
+    xSemaphoreGive(args->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("Four tasks streaming four different files", TAG){
+    const int n_tasks = 4;
+    const uint32_t iter = 500;
+    stream_task_arg_t args[4];
+
+    setup_littlefs();
+
+    uint64_t t_start = esp_timer_get_time();
+    stream_task_arg_t single = { .id = 0, .iter = iter * n_tasks, .done = xSemaphoreCreateBinary() };
+    xTaskCreate(&stream_task, "stream", 4096, &single, 3, NULL);
+    xSemaphoreTake(single.done, portMAX_DELAY);
+    vSemaphoreDelete(single.done);
+    uint64_t t_single = esp_timer_get_time() - t_start;
+    TEST_ASSERT_EQUAL(0, single.errors);
+
+    t_start = esp_timer_get_time();
+    for(int i=0; i < n_tasks; i++) {
+        args[i] = (stream_task_arg_t){ .id = i, .iter = iter, .done = xSemaphoreCreateBinary() };
+        xTaskCreatePinnedToCore(&stream_task, "stream", 4096, &args[i], 3, NULL, i % portNUM_PROCESSORS);
+    }
+    uint32_t errors = 0;
+    for(int i=0; i < n_tasks; i++) {
+        xSemaphoreTake(args[i].done, portMAX_DELAY);
+        vSemaphoreDelete(args[i].done);
+        errors += args[i].errors;
+    }
+    uint64_t t_multi = esp_timer_get_time() - t_start;
+    TEST_ASSERT_EQUAL(0, errors);
+
+    printf("File buffer: %d bytes\n", CONFIG_LITTLEFS_FILE_BUF_SIZE);
+    printf("1 task, 1 file:   %lld us\n", t_single);
+    printf("%d tasks, %d files: %lld us\n", n_tasks, n_tasks, t_multi);
+
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+}
+
+/**
+ * @brief Interleave small reads over n_fds FDs, like concurrent downloads.
+ * @return time taken in us
+ */
+static uint64_t interleaved_reads(const int *fds, int n_fds)
+{
+    uint8_t buf[256];
+    int open_fds = n_fds;
+    bool done[8] = { 0 };
+
+    uint64_t t_start = esp_timer_get_time();
+    while(open_fds > 0) {
+        for(int i=0; i < n_fds; i++) {
+            if(done[i]) continue;
+            if(read(fds[i], buf, sizeof(buf)) <= 0) {
+                done[i] = true;
+                open_fds--;
+            }
+        }
+    }
+    return esp_timer_get_time() - t_start;
+}
+
+TEST_CASE("Eight concurrent downloads of the same file", TAG){
+    const int n_fds = 8;
+    int fds[8];
+    char fname[32];
+
+    setup_littlefs();
+    for(int i=0; i < n_fds; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/dl%d.txt", i);
+        FILE* f = fopen(fname, "w");
+        TEST_ASSERT_NOT_NULL(f);
+        for(uint32_t j=0; j < 1000; j++) {
+            fprintf(f, "All work and no play makes Jack a dull boy.\n");
+        }
+        fclose(f);
+    }
+
+    /* Different files can't share anything */
+    size_t heap_start = esp_get_free_heap_size();
+    for(int i=0; i < n_fds; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/dl%d.txt", i);
+        fds[i] = open(fname, O_RDONLY);
+        TEST_ASSERT_TRUE(fds[i] >= 0);
+    }
+    size_t heap_unshared = heap_start - esp_get_free_heap_size();
+    uint64_t t_unshared = interleaved_reads(fds, n_fds);
+    for(int i=0; i < n_fds; i++) close(fds[i]);
+
+    heap_start = esp_get_free_heap_size();
+    for(int i=0; i < n_fds; i++) {
+        fds[i] = open("/littlefs/dl0.txt", O_RDONLY);
+        TEST_ASSERT_TRUE(fds[i] >= 0);
+    }
+    size_t heap_shared = heap_start - esp_get_free_heap_size();
+    uint64_t t_shared = interleaved_reads(fds, n_fds);
+    for(int i=0; i < n_fds; i++) close(fds[i]);
+
+    printf("%d different files: %lld us, %d bytes of heap\n", n_fds, t_unshared, heap_unshared);
+    printf("%d FDs on one file: %lld us, %d bytes of heap\n", n_fds, t_shared, heap_shared);
+
+    for(int i=0; i < n_fds; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/dl%d.txt", i);
+        unlink(fname);
+    }
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+}
+
+#define SCALE_IO_SIZE 1024
+#define SCALE_REGION  (16 * 1024)
+
+typedef struct {
+    int id;
+    int read_pct;
+    const char *fname;
+    off_t base;             /* Of the task's region in fname */
+    volatile bool *stop;
+    uint32_t ops;
+    uint32_t errors;        /* Failed calls; Unity can only fail the test task */
+    SemaphoreHandle_t done;
+} scale_task_arg_t;
+
+static void scale_task(void *param)
+{
+    scale_task_arg_t *args = param;
+    static uint8_t bufs[8][SCALE_IO_SIZE];
+    uint8_t *buf = bufs[args->id];
+    off_t pos = 0;
+
+    int fd = open(args->fname, O_RDWR);
+    if(fd < 0) args->errors++;
+    while(fd >= 0 && !*args->stop) {
+        lseek(fd, args->base + pos, SEEK_SET);
+        if(esp_random() % 100 < args->read_pct) {
+            if(read(fd, buf, SCALE_IO_SIZE) != SCALE_IO_SIZE) args->errors++;
+        }
+        else {
+            if(write(fd, buf, SCALE_IO_SIZE) != SCALE_IO_SIZE) args->errors++;
+            if(args->ops % 16 == 15) fsync(fd);
+        }
+        pos = (pos + SCALE_IO_SIZE) % SCALE_REGION;
+        args->ops++;
+    }
+    if(fd >= 0) close(fd);
+
+    xSemaphoreGive(args->done);
+    vTaskDelete(NULL);
+}
+
+static void scale_file(const char *fname, size_t size)
+{
+    static const char block[256] = { 0 };
+    FILE* f = fopen(fname, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    for(size_t i=0; i < size; i += sizeof(block)) {
+        TEST_ASSERT_EQUAL(1, fwrite(block, sizeof(block), 1, f));
+    }
+    fclose(f);
+}
+
+TEST_CASE("Throughput, fairness and lock wait from 1 to 8 tasks", TAG){
+    const int task_counts[] = { 1, 2, 4, 8 };
+    const int read_pcts[] = { 0, 50, 90 };
+    const uint32_t run_ms = 1000;
+    scale_task_arg_t args[8];
+    char fnames[8][32];
+
+    setup_littlefs();
+    printf("tasks read%% shared pinned     KB/s  fairness  lock wait\n");
+    for(int n_i=0; n_i < sizeof(task_counts) / sizeof(task_counts[0]); n_i++) {
+        int n = task_counts[n_i];
+        for(int r_i=0; r_i < sizeof(read_pcts) / sizeof(read_pcts[0]); r_i++) {
+            for(int shared=0; shared < 2; shared++) {
+                for(int pinned=0; pinned < 2; pinned++) {
+                    volatile bool stop = false;
+                    esp_littlefs_lock_profile_t *prof = calloc(1, sizeof(*prof));
+                    TEST_ASSERT_NOT_NULL(prof);
+
+                    for(int i=0; i < n; i++) {
+                        if(shared) strcpy(fnames[i], "/littlefs/scale_shared.bin");
+                        else snprintf(fnames[i], sizeof(fnames[i]), "/littlefs/scale%d.bin", i);
+                        if(!shared || i == 0) scale_file(fnames[i], shared ? n * SCALE_REGION : SCALE_REGION);
+                    }
+                    bool profiled = esp_littlefs_lock_profile_reset("flash_test") == ESP_OK;
+
+                    uint64_t t_start = esp_timer_get_time();
+                    for(int i=0; i < n; i++) {
+                        args[i] = (scale_task_arg_t){ .id = i, .read_pct = read_pcts[r_i], .fname = fnames[i],
+                                .base = shared ? i * SCALE_REGION : 0, .stop = &stop, .done = xSemaphoreCreateBinary() };
+                        xTaskCreatePinnedToCore(&scale_task, "scale", 4096, &args[i], 3, NULL,
+                                pinned ? i % portNUM_PROCESSORS : tskNO_AFFINITY);
+                    }
+                    vTaskDelay(pdMS_TO_TICKS(run_ms));
+                    stop = true;
+                    double sum = 0, sum_sq = 0;
+                    uint32_t errors = 0;
+                    for(int i=0; i < n; i++) {
+                        xSemaphoreTake(args[i].done, portMAX_DELAY);
+                        vSemaphoreDelete(args[i].done);
+                        sum += args[i].ops;
+                        sum_sq += (double)args[i].ops * args[i].ops;
+                        errors += args[i].errors;
+                    }
+                    uint64_t t_total = esp_timer_get_time() - t_start;
+
+                    /* Jain's index: 1 is perfectly fair, 1/n is one task getting everything */
+                    printf("%5d %5d %6s %6s %8u %9.3f", n, read_pcts[r_i], shared ? "yes" : "no",
+                            pinned ? "yes" : "no", (uint32_t)(sum * SCALE_IO_SIZE * 1000000 / 1024 / t_total),
+                            sum_sq > 0 ? sum * sum / (n * sum_sq) : 1.0);
+                    if(profiled && esp_littlefs_lock_profile("flash_test", prof) == ESP_OK) {
+                        uint64_t wait_us = 0;
+                        for(int i=0; i <= ESP_LITTLEFS_OP_MAX; i++) wait_us += prof->wait_us[i];
+                        printf(" %9.1f%%\n", 100.0 * wait_us / (n * t_total));
+                    }
+                    else {
+                        printf("         -\n");
+                    }
+                    free(prof);
+                    TEST_ASSERT_EQUAL(0, errors);
+
+                    for(int i=0; i < n; i++) {
+                        if(!shared || i == 0) unlink(fnames[i]);
+                    }
+                }
+            }
+        }
+    }
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+}
+
+/*
+ * Application workload generator, after the file traffic of a JavaScript
+ * runtime serving a web UI: module resolution probes a handful of paths
+ * that don't exist before opening the one that does, static assets are
+ * read whole, telemetry is appended with an fsync every few records, and
+ * the config is rewritten now and then. Every mix is reproducible from its
+ * seed.
+ */
+
+#define WL_MODULES     16
+#define WL_ASSETS      12
+#define WL_PROBES      5        /* Paths tried per module before the real one */
+
+typedef enum {
+    WL_PROBE,
+    WL_ASSET,
+    WL_TELEMETRY,
+    WL_CONFIG,
+    WL_KINDS
+} wl_kind_t;
+
+static const char * const wl_kind_names[WL_KINDS] = { "probe", "asset", "telemetry", "config" };
+
+typedef struct {
+    const char *name;
+    uint8_t weight[WL_KINDS];   /* Relative frequency of each kind */
+    uint16_t telemetry_size;    /* Bytes per record */
+    uint8_t fsync_every;        /* Telemetry records per fsync */
+    uint16_t config_size;
+    uint32_t asset_max;         /* Assets are 256 bytes up to this, log-uniformly */
+} wl_mix_t;
+
+static const wl_mix_t wl_mixes[] = {
+    { "boot",      { 70, 20,  5,  5 },  96,  8, 1024,  16 * 1024 },
+    { "web",       { 10, 75, 10,  5 },  96,  8, 1024,  64 * 1024 },
+    { "telemetry", {  5,  5, 85,  5 }, 128,  4,  512,  16 * 1024 },
+    { "balanced",  { 25, 25, 25, 25 },  96,  8, 2048,  32 * 1024 },
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t *us;               /* One sample per operation */
+    uint64_t bytes;
+} wl_class_t;
+
+static uint32_t wl_rand(uint32_t *state)
+{
+    /* xorshift32, so mixes replay the same on any build */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int wl_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void wl_setup(const wl_mix_t *mix, uint32_t seed)
+{
+    char fname[64];
+    static uint8_t buf[1024];
+
+    mkdir("/littlefs/app", 0755);
+    mkdir("/littlefs/app/node_modules", 0755);
+    mkdir("/littlefs/www", 0755);
+    for(int i=0; i < WL_MODULES; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/app/node_modules/m%d", i);
+        mkdir(fname, 0755);
+        snprintf(fname, sizeof(fname), "/littlefs/app/node_modules/m%d/index.js", i);
+        FILE *f = fopen(fname, "w");
+        TEST_ASSERT_NOT_NULL(f);
+        fwrite(buf, 1, 512 + wl_rand(&seed) % 2048, f);
+        fclose(f);
+    }
+    for(int i=0; i < WL_ASSETS; i++) {
+        /* Log-uniform between 256 bytes and asset_max */
+        uint32_t size = 256;
+        while(size < mix->asset_max && wl_rand(&seed) % 3) size *= 2;
+        size += wl_rand(&seed) % size;
+        if(size > mix->asset_max) size = mix->asset_max;
+        snprintf(fname, sizeof(fname), "/littlefs/www/a%d", i);
+        FILE *f = fopen(fname, "w");
+        TEST_ASSERT_NOT_NULL(f);
+        for(uint32_t done=0; done < size; done += sizeof(buf)) {
+            fwrite(buf, 1, MIN(sizeof(buf), size - done), f);
+        }
+        fclose(f);
+    }
+}
+
+static void wl_teardown(void)
+{
+    char fname[64];
+
+    for(int i=0; i < WL_MODULES; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/app/node_modules/m%d/index.js", i);
+        unlink(fname);
+        snprintf(fname, sizeof(fname), "/littlefs/app/node_modules/m%d", i);
+        rmdir(fname);
+    }
+    for(int i=0; i < WL_ASSETS; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/www/a%d", i);
+        unlink(fname);
+    }
+    unlink("/littlefs/app/config.json");
+    unlink("/littlefs/telemetry.log");
+    rmdir("/littlefs/app/node_modules");
+    rmdir("/littlefs/app");
+    rmdir("/littlefs/www");
+}
+
+/**
+ * @brief Run ops operations drawn from mix with seed, timing each.
+ * @param[out] classes Per kind; us arrays of ops entries each, allocated by the caller
+ */
+static void wl_run(const wl_mix_t *mix, uint32_t seed, uint32_t ops, wl_class_t classes[WL_KINDS])
+{
+    static const char * const probe_fmt[WL_PROBES] = {
+        "/littlefs/app/m%d", "/littlefs/app/m%d.js", "/littlefs/app/m%d.json",
+        "/littlefs/app/node_modules/m%d.js", "/littlefs/app/node_modules/m%d/package.json",
+    };
+    static uint8_t buf[1024];
+    uint32_t total = 0, telemetry_records = 0;
+    char fname[64];
+    struct stat st;
+    int log_fd;
+
+    for(int k=0; k < WL_KINDS; k++) total += mix->weight[k];
+    log_fd = open("/littlefs/telemetry.log", O_WRONLY | O_CREAT | O_APPEND);
+    TEST_ASSERT_TRUE(log_fd >= 0);
+
+    for(uint32_t i=0; i < ops; i++) {
+        uint32_t pick = wl_rand(&seed) % total;
+        wl_kind_t kind = 0;
+        while(pick >= mix->weight[kind]) pick -= mix->weight[kind++];
+
+        uint64_t t_start = esp_timer_get_time();
+        switch(kind) {
+            case WL_PROBE: {
+                int m = wl_rand(&seed) % WL_MODULES;
+                for(int p=0; p < WL_PROBES; p++) {
+                    snprintf(fname, sizeof(fname), probe_fmt[p], m);
+                    TEST_ASSERT_EQUAL(-1, stat(fname, &st));
+                }
+                snprintf(fname, sizeof(fname), "/littlefs/app/node_modules/m%d/index.js", m);
+                int fd = open(fname, O_RDONLY);
+                TEST_ASSERT_TRUE(fd >= 0);
+                ssize_t n;
+                while((n = read(fd, buf, sizeof(buf))) > 0) classes[kind].bytes += n;
+                close(fd);
+                break;
+            }
+            case WL_ASSET: {
+                snprintf(fname, sizeof(fname), "/littlefs/www/a%d", wl_rand(&seed) % WL_ASSETS);
+                int fd = open(fname, O_RDONLY);
+                TEST_ASSERT_TRUE(fd >= 0);
+                ssize_t n;
+                while((n = read(fd, buf, sizeof(buf))) > 0) classes[kind].bytes += n;
+                close(fd);
+                break;
+            }
+            case WL_TELEMETRY:
+                TEST_ASSERT_EQUAL(mix->telemetry_size, write(log_fd, buf, mix->telemetry_size));
+                if(++telemetry_records % mix->fsync_every == 0) fsync(log_fd);
+                classes[kind].bytes += mix->telemetry_size;
+                break;
+            case WL_CONFIG: {
+                int fd = open("/littlefs/app/config.json", O_WRONLY | O_CREAT | O_TRUNC);
+                TEST_ASSERT_TRUE(fd >= 0);
+                for(uint32_t done=0; done < mix->config_size; done += sizeof(buf)) {
+                    write(fd, buf, MIN(sizeof(buf), mix->config_size - done));
+                }
+                close(fd);
+                classes[kind].bytes += mix->config_size;
+                break;
+            }
+            default:
+                break;
+        }
+        classes[kind].us[classes[kind].count++] = esp_timer_get_time() - t_start;
+    }
+    close(log_fd);
+}
+
+TEST_CASE("Application workload mixes", TAG){
+    const uint32_t seed = 1;
+    const uint32_t ops = 500;
+    wl_class_t classes[WL_KINDS];
+
+    setup_littlefs();
+    printf("mix        kind       count  p50 us  p99 us  max us     KB/s\n");
+    for(int m=0; m < sizeof(wl_mixes) / sizeof(wl_mixes[0]); m++) {
+        const wl_mix_t *mix = &wl_mixes[m];
+
+        memset(classes, 0, sizeof(classes));
+        for(int k=0; k < WL_KINDS; k++) {
+            classes[k].us = calloc(ops, sizeof(uint32_t));
+            TEST_ASSERT_NOT_NULL(classes[k].us);
+        }
+        wl_setup(mix, seed);
+        uint64_t t_start = esp_timer_get_time();
+        wl_run(mix, seed, ops, classes);
+        uint64_t t_total = esp_timer_get_time() - t_start;
+        wl_teardown();
+
+        for(int k=0; k < WL_KINDS; k++) {
+            wl_class_t *c = &classes[k];
+            uint64_t us = 0;
+            if(c->count) {
+                qsort(c->us, c->count, sizeof(uint32_t), wl_cmp_u32);
+                for(uint32_t i=0; i < c->count; i++) us += c->us[i];
+                printf("%-10s %-10s %5u %7u %7u %7u %8u\n", mix->name, wl_kind_names[k], c->count,
+                        c->us[(c->count - 1) / 2], c->us[(c->count * 99 + 99) / 100 - 1], c->us[c->count - 1],
+                        us ? (uint32_t)(c->bytes * 1000000 / 1024 / us) : 0);
+            }
+            free(c->us);
+        }
+        printf("%-10s total      %5u ops in %lld us\n", mix->name, ops, t_total);
+    }
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+}
+
+typedef uint32_t (*crc_fn_t)(uint32_t crc, const void *buffer, size_t size);
+
+/**
+ * @brief MB/s of crc over size-byte buffers, about 1 MB in total
+ */
+static uint32_t crc_throughput(crc_fn_t crc, const uint8_t *buf, size_t size)
+{
+    uint32_t iter = 1024 * 1024 / size;
+    volatile uint32_t sink = 0;
+
+    uint64_t t_start = esp_timer_get_time();
+    for(uint32_t i=0; i < iter; i++) sink = crc(sink, buf, size);
+    uint64_t t_total = esp_timer_get_time() - t_start;
+    return (uint64_t)iter * size / t_total;
+}
+
+TEST_CASE("CRC32 backends and metadata operations", TAG){
+    static const struct {
+        const char *name;
+        crc_fn_t crc;
+    } backends[] = {
+        {"reference", lfs_crc_reference},
+        {"rom", esp_littlefs_crc_rom},
+#if CONFIG_LITTLEFS_CRC_SLICE8
+        {"slice8", esp_littlefs_crc_slice8},
+#endif
+    };
+    /* A metadata tag, a typical entry, the cache and a block */
+    static const size_t sizes[] = {4, 32, 512, 4096};
+    const int n_files = 64;
+    char fname[64];
+    struct stat st;
+
+    uint8_t *buf = malloc(4096);
+    TEST_ASSERT_NOT_NULL(buf);
+    for(int i=0; i < 4096; i++) buf[i] = esp_random();
+    printf("backend         4 B    32 B   512 B  4096 B (MB/s)\n");
+    for(int b=0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        printf("%-10s", backends[b].name);
+        for(int s=0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            printf(" %7u", crc_throughput(backends[b].crc, buf, sizes[s]));
+        }
+        printf("\n");
+    }
+    free(buf);
+
+    /* End to end, for comparing builds with different CONFIG_LITTLEFS_CRC_* */
+    setup_littlefs();
+    mkdir("/littlefs/crc", 0755);
+    for(int i=0; i < n_files; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/crc/f%d", i);
+        FILE *f = fopen(fname, "w");
+        TEST_ASSERT_NOT_NULL(f);
+        fprintf(f, "%d", i);
+        fclose(f);
+    }
+
+    uint64_t t_start = esp_timer_get_time();
+    for(int i=0; i < n_files; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/crc/f%d", i);
+        TEST_ASSERT_EQUAL(0, stat(fname, &st));
+    }
+    uint64_t t_stat = esp_timer_get_time() - t_start;
+
+    t_start = esp_timer_get_time();
+    for(int i=0; i < n_files; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/crc/f%d", i);
+        int fd = open(fname, O_RDONLY);
+        TEST_ASSERT_TRUE(fd >= 0);
+        close(fd);
+    }
+    uint64_t t_open = esp_timer_get_time() - t_start;
+
+    t_start = esp_timer_get_time();
+    DIR *dir = opendir("/littlefs/crc");
+    TEST_ASSERT_NOT_NULL(dir);
+    while(readdir(dir) != NULL);
+    closedir(dir);
+    uint64_t t_readdir = esp_timer_get_time() - t_start;
+
+    printf("lfs_crc is %s: stat %llu us, open+close %llu us, readdir %llu us per file\n",
+            ESP_LITTLEFS_CRC_NAME, t_stat / n_files, t_open / n_files, t_readdir / n_files);
+
+    for(int i=0; i < n_files; i++) {
+        snprintf(fname, sizeof(fname), "/littlefs/crc/f%d", i);
+        unlink(fname);
+    }
+    rmdir("/littlefs/crc");
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+}
+
+extern int gFSPos;
+
+#define BD_CALLS 2000
+#define BD_READ  16        /* A metadata tag and a bit */
+
+/**
+ * @brief Mean ns per call of read, and of the driver call it wraps, on the same 16 bytes
+ */
+static void bd_overhead(const char *name, lfs_block_t block,
+        int (*read)(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size),
+        void (*raw)(uint32_t addr, void *buffer))
+{
+    esp_littlefs_t *efs = calloc(1, sizeof(esp_littlefs_t));
+    uint8_t buf[BD_READ];
+    TEST_ASSERT_NOT_NULL(efs);
+    efs->cfg.context = efs;
+    efs->cfg.block_size = CONFIG_LITTLEFS_BLOCK_SIZE;
+#if CONFIG_LITTLEFS_TASK_IO
+    vPortCPUInitializeMutex(&efs->io.mux);
+#endif
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    efs->cfg.block_count = block + 1;
+    if(read == littlefs_api_external_read) TEST_ESP_OK(esp_littlefs_xfer_init(efs));
+#endif
+
+    uint64_t t_start = esp_timer_get_time();
+    for(int i=0; i < BD_CALLS; i++) raw(block * CONFIG_LITTLEFS_BLOCK_SIZE, buf);
+    uint64_t t_raw = esp_timer_get_time() - t_start;
+
+    t_start = esp_timer_get_time();
+    for(int i=0; i < BD_CALLS; i++) TEST_ASSERT_EQUAL(0, read(&efs->cfg, block, 0, buf, BD_READ));
+    uint64_t t_bd = esp_timer_get_time() - t_start;
+
+    printf("%-9s driver %6llu ns  block device %6llu ns  overhead %6lld ns per %d-byte read\n", name,
+            t_raw * 1000 / BD_CALLS, t_bd * 1000 / BD_CALLS,
+            ((int64_t)t_bd - (int64_t)t_raw) * 1000 / BD_CALLS, BD_READ);
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    esp_littlefs_xfer_free(efs->xfer);
+#endif
+    free(efs);
+}
+
+#ifndef CONFIG_NEONIOUS_ONE
+static void bd_raw_internal(uint32_t addr, void *buffer)
+{
+    spi_flash_read(gFSPos + addr, buffer, BD_READ);
+}
+#endif
+
+static void bd_raw_external(uint32_t addr, void *buffer)
+{
+    data_spiflash_read(addr + CONFIG_CLIENT_SIZE_DATA_OFFSET, buffer, BD_READ);
+}
+
+TEST_CASE("Block device per-call overhead", TAG){
+    /* Block 0 is the superblock, which every backend has; reading it changes nothing */
+#ifndef CONFIG_NEONIOUS_ONE
+    bd_overhead("internal", 0, littlefs_api_internal_read, bd_raw_internal);
+#endif
+    bd_overhead("external", 0, littlefs_api_external_read, bd_raw_external);
+}
+
+#define XFER_FILE_SIZE (64 * 1024)
+#define XFER_CHUNK     4096
+
+/**
+ * @brief Stand in for what an application does with each chunk
+ */
+static void xfer_work(uint32_t us)
+{
+    uint64_t until = esp_timer_get_time() + us;
+    while(esp_timer_get_time() < until);
+}
+
+TEST_CASE("Sequential transfers with work between chunks", TAG){
+    /* Compare builds with and without CONFIG_LITTLEFS_EXTERNAL_XFER */
+    static const uint32_t work_us[] = {0, 200, 1000};
+    const char fname[] = "/littlefs/xfer.bin";
+    uint8_t *buf = malloc(XFER_CHUNK);
+    TEST_ASSERT_NOT_NULL(buf);
+    memset(buf, 0xa5, XFER_CHUNK);
+
+    setup_littlefs();
+#if CONFIG_LITTLEFS_EXTERNAL_XFER
+    printf("external transfers double-buffered\n");
+#else
+    printf("external transfers synchronous\n");
+#endif
+    printf("work us/chunk  write KB/s  read KB/s\n");
+    for(int w=0; w < sizeof(work_us) / sizeof(work_us[0]); w++) {
+        int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC);
+        TEST_ASSERT_TRUE(fd >= 0);
+        uint64_t t_start = esp_timer_get_time();
+        for(size_t done=0; done < XFER_FILE_SIZE; done += XFER_CHUNK) {
+            xfer_work(work_us[w]);
+            TEST_ASSERT_EQUAL(XFER_CHUNK, write(fd, buf, XFER_CHUNK));
+        }
+        TEST_ASSERT_EQUAL(0, close(fd));
+        uint64_t t_write = esp_timer_get_time() - t_start;
+
+        fd = open(fname, O_RDONLY);
+        TEST_ASSERT_TRUE(fd >= 0);
+        t_start = esp_timer_get_time();
+        for(size_t done=0; done < XFER_FILE_SIZE; done += XFER_CHUNK) {
+            TEST_ASSERT_EQUAL(XFER_CHUNK, read(fd, buf, XFER_CHUNK));
+            xfer_work(work_us[w]);
+        }
+        TEST_ASSERT_EQUAL(0, close(fd));
+        uint64_t t_read = esp_timer_get_time() - t_start;
+
+        printf("%13u %11llu %10llu\n", work_us[w],
+                (uint64_t)XFER_FILE_SIZE * 1000000 / 1024 / t_write,
+                (uint64_t)XFER_FILE_SIZE * 1000000 / 1024 / t_read);
+    }
+    unlink(fname);
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+    free(buf);
+}
+
+#define BOUNCE_FILE_SIZE (64 * 1024)
+#define BOUNCE_CHUNK_MAX (16 * 1024)
+
+/**
+ * @brief KB/s reading fname whole, chunk bytes at a time, into buf
+ */
+static uint32_t bounce_read_kbs(const char *fname, uint8_t *buf, size_t chunk)
+{
+    int fd = open(fname, O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    uint64_t t_start = esp_timer_get_time();
+    for(size_t done=0; done < BOUNCE_FILE_SIZE; done += chunk)
+        TEST_ASSERT_EQUAL(chunk, read(fd, buf, chunk));
+    uint64_t t_read = esp_timer_get_time() - t_start;
+    TEST_ASSERT_EQUAL(0, close(fd));
+    return (uint64_t)BOUNCE_FILE_SIZE * 1000000 / 1024 / t_read;
+}
+
+TEST_CASE("Read throughput into PSRAM buffers", TAG){
+    /* Compare builds with and without CONFIG_LITTLEFS_BOUNCE */
+    static const size_t chunks[] = {512, 4096, BOUNCE_CHUNK_MAX};
+    const char fname[] = "/littlefs/bounce.bin";
+    uint8_t *psram = heap_caps_malloc(BOUNCE_CHUNK_MAX, MALLOC_CAP_SPIRAM);
+    uint8_t *dram = heap_caps_malloc(BOUNCE_CHUNK_MAX, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    if(psram == NULL) {
+        printf("no PSRAM\n");
+        free(dram);
+        return;
+    }
+    TEST_ASSERT_NOT_NULL(dram);
+    memset(dram, 0x5a, BOUNCE_CHUNK_MAX);
+
+    setup_littlefs();
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    for(size_t done=0; done < BOUNCE_FILE_SIZE; done += BOUNCE_CHUNK_MAX)
+        TEST_ASSERT_EQUAL(BOUNCE_CHUNK_MAX, write(fd, dram, BOUNCE_CHUNK_MAX));
+    TEST_ASSERT_EQUAL(0, close(fd));
+
+#if CONFIG_LITTLEFS_BOUNCE
+    printf("PSRAM transfers bounced through %d x %d bytes\n",
+            CONFIG_LITTLEFS_BOUNCE_BUFS, CONFIG_LITTLEFS_BOUNCE_BUF_SIZE);
+#else
+    printf("PSRAM transfers unbounced\n");
+#endif
+    printf("read size  internal KB/s  PSRAM KB/s\n");
+    for(int i=0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        uint32_t kbs_dram = bounce_read_kbs(fname, dram, chunks[i]);
+        uint32_t kbs_psram = bounce_read_kbs(fname, psram, chunks[i]);
+        printf("%9u %14u %11u\n", chunks[i], kbs_dram, kbs_psram);
+    }
+    TEST_ASSERT_EQUAL(0x5a, psram[0]);
+    TEST_ASSERT_EQUAL(0x5a, psram[BOUNCE_CHUNK_MAX - 1]);
+
+    unlink(fname);
+    TEST_ESP_OK(esp_vfs_littlefs_unregister("flash_test"));
+    free(psram);
+    free(dram);
+}
@@ -7,7 +7,9 @@
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/param.h>
 #include <sys/unistd.h>
+#include <fcntl.h>
 #include "unity.h"
 #include "test_utils.h"
 #include "esp_log.h"
@@ -21,6 +23,10 @@
 #include "esp_heap_caps.h"
 #include "esp_partition.h"
 #include "errno.h"
+#include "littlefs_crc.h"
+#if CONFIG_LITTLEFS_STATIC_ALLOC && CONFIG_HEAP_TRACING_STANDALONE
+#include "esp_heap_trace.h"
+#endif
 
 
 static const char littlefs_test_partition_label[] = "flash_test";
@@ -50,6 +56,38 @@ TEST_CASE("can initialize LittleFS in erased partition", "[littlefs]")
     test_teardown();
 }
 
+TEST_CASE("mount timing breaks down each phase", "[littlefs]")
+{
+    esp_littlefs_mount_timing_t timing;
+    const esp_partition_t* part = get_test_data_partition();
+    TEST_ASSERT_NOT_NULL(part);
+
+    /* An erased partition gets formatted */
+    TEST_ESP_OK(esp_partition_erase_range(part, 0, part->size));
+    test_setup();
+    TEST_ESP_OK(esp_littlefs_mount_timing(littlefs_test_partition_label, &timing));
+    TEST_ASSERT_TRUE(timing.format_us > 0);
+    TEST_ASSERT_TRUE(timing.erase_us > 0);
+    test_teardown();
+
+    test_setup();
+    TEST_ESP_OK(esp_littlefs_mount_timing(littlefs_test_partition_label, &timing));
+    TEST_ASSERT_EQUAL(0, timing.format_us);
+    TEST_ASSERT_TRUE(timing.mount_us > 0);
+    TEST_ASSERT_TRUE(timing.mount_reads > 0);
+    TEST_ASSERT_EQUAL(timing.mount_us, timing.superblock_us + timing.metadata_us);
+    TEST_ASSERT_TRUE(timing.total_us >= timing.alloc_us + timing.lock_us + timing.buffers_us + timing.mount_us);
+#if CONFIG_LITTLEFS_MOUNT_TRAVERSE
+    TEST_ASSERT_EQUAL(2, timing.used_blocks);
+#endif
+#if CONFIG_LITTLEFS_STATS
+    esp_littlefs_stats_t stats;
+    TEST_ESP_OK(esp_littlefs_stats(littlefs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(timing.total_us, stats.mount_us);
+#endif
+    test_teardown();
+}
+
 TEST_CASE("can format mounted partition", "[littlefs]")
 {
     // Mount LittleFS, create file, format, check that the file does not exist.
@@ -150,6 +188,526 @@ TEST_CASE("can lseek", "[littlefs]")
     test_teardown();
 }
 
+TEST_CASE("small writes and reads through the file buffer", "[littlefs]")
+{
+    const char filename[] = littlefs_base_path "/buffered.bin";
+    test_setup();
+
+    /* Odd-sized chunks, so reads straddle every read-ahead boundary */
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    for(int i=0; i < 3000; i += 7) {
+        uint8_t chunk[7];
+        for(int j=0; j < sizeof(chunk); j++) chunk[j] = (uint8_t)(i + j);
+        TEST_ASSERT_EQUAL(sizeof(chunk), write(fd, chunk, sizeof(chunk)));
+    }
+
+    /* Overwrite in the middle; the tail must survive */
+    TEST_ASSERT_EQUAL(1000, lseek(fd, 1000, SEEK_SET));
+    TEST_ASSERT_EQUAL(3, write(fd, "abc", 3));
+    TEST_ASSERT_EQUAL(1003, lseek(fd, 0, SEEK_CUR));
+    TEST_ASSERT_EQUAL(3003, lseek(fd, 0, SEEK_END));
+
+    TEST_ASSERT_EQUAL(0, lseek(fd, 0, SEEK_SET));
+    for(int i=0; i < 3003; i += 5) {
+        uint8_t chunk[5];
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        TEST_ASSERT_EQUAL(3003 - i < 5 ? 3003 - i : 5, n);
+        for(int j=0; j < n; j++) {
+            int pos = i + j;
+            uint8_t expected = (pos >= 1000 && pos < 1003) ? "abc"[pos - 1000] : (uint8_t)pos;
+            TEST_ASSERT_EQUAL_HEX8(expected, chunk[j]);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, read(fd, &fd, 1));
+    TEST_ASSERT_EQUAL(0, close(fd));
+
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, stat(filename, &st));
+    TEST_ASSERT_EQUAL(3003, st.st_size);
+
+    test_teardown();
+}
+
+TEST_CASE("write reports ENOSPC itself", "[littlefs][timeout=120]")
+{
+    const char filename[] = littlefs_base_path "/fill.bin";
+    static uint8_t chunk[4096];
+    size_t total, used;
+    ssize_t n;
+    test_setup();
+
+    TEST_ESP_OK(esp_littlefs_info(littlefs_test_partition_label, &total, &used));
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+
+    /* Most of the free space in big writes, the rest in writes small enough
+     * to have been buffered; the one that doesn't fit must fail, not close */
+    for(size_t done=0; done < (total - used) * 9 / 10; done += sizeof(chunk)) {
+        TEST_ASSERT_EQUAL(sizeof(chunk), write(fd, chunk, sizeof(chunk)));
+    }
+    do {
+        n = write(fd, chunk, 100);
+    } while(n == 100);
+    TEST_ASSERT_EQUAL(-1, n);
+    TEST_ASSERT_EQUAL(ENOSPC, errno);
+
+    close(fd);
+    TEST_ASSERT_EQUAL(0, unlink(filename));
+    test_teardown();
+}
+
+TEST_CASE("read-only opens of the same file keep their own position", "[littlefs]")
+{
+    const char filename[] = littlefs_base_path "/shared.txt";
+    char buf[16] = { 0 };
+    test_setup();
+    test_littlefs_create_file_with_text(filename, "0123456789");
+
+    int fd1 = open(filename, O_RDONLY);
+    int fd2 = open(filename, O_RDONLY);
+    TEST_ASSERT_TRUE(fd1 >= 0);
+    TEST_ASSERT_TRUE(fd2 >= 0);
+    TEST_ASSERT_EQUAL(3, read(fd1, buf, 3));
+    TEST_ASSERT_EQUAL_STRING_LEN("012", buf, 3);
+    TEST_ASSERT_EQUAL(5, read(fd2, buf, 5));
+    TEST_ASSERT_EQUAL_STRING_LEN("01234", buf, 5);
+    TEST_ASSERT_EQUAL(2, read(fd1, buf, 2));
+    TEST_ASSERT_EQUAL_STRING_LEN("34", buf, 2);
+    TEST_ASSERT_EQUAL(10, lseek(fd2, 0, SEEK_END));
+
+    /* The other FD keeps working after one is closed */
+    TEST_ASSERT_EQUAL(0, close(fd1));
+    TEST_ASSERT_EQUAL(7, lseek(fd2, -3, SEEK_CUR));
+    TEST_ASSERT_EQUAL(3, read(fd2, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING_LEN("789", buf, 3);
+
+    /* Opens after a rewrite see the new contents */
+    test_littlefs_create_file_with_text(filename, "abc");
+    int fd3 = open(filename, O_RDONLY);
+    TEST_ASSERT_TRUE(fd3 >= 0);
+    TEST_ASSERT_EQUAL(3, read(fd3, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING_LEN("abc", buf, 3);
+    TEST_ASSERT_EQUAL(0, close(fd3));
+    TEST_ASSERT_EQUAL(0, close(fd2));
+
+    test_teardown();
+}
+
+TEST_CASE("buffer memory is accounted, budgeted and reclaimable", "[littlefs]")
+{
+    esp_littlefs_mem_usage_t idle, busy, usage;
+    char buf[4];
+    test_setup();
+    test_littlefs_create_file_with_text(littlefs_base_path "/mem1.txt", "01234567");
+    test_littlefs_create_file_with_text(littlefs_base_path "/mem2.txt", "01234567");
+
+    esp_littlefs_mem_usage(&idle);
+    TEST_ASSERT_TRUE(idle.mount_caches > 0);
+    TEST_ASSERT_EQUAL(0, idle.file_buffers);
+
+    int fd = open(littlefs_base_path "/mem1.txt", O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(4, read(fd, buf, 4));
+    esp_littlefs_mem_usage(&busy);
+    TEST_ASSERT_TRUE(busy.file_caches > idle.file_caches);
+    TEST_ASSERT_EQUAL(CONFIG_LITTLEFS_FILE_BUF_SIZE, busy.file_buffers);
+    TEST_ASSERT_TRUE(busy.peak >= busy.total);
+
+    /* Shrinking the budget evicts the file buffer; reads keep working */
+    TEST_ESP_OK(esp_littlefs_mem_set_budget(busy.total - busy.file_buffers));
+    esp_littlefs_mem_usage(&usage);
+    TEST_ASSERT_EQUAL(0, usage.file_buffers);
+    TEST_ASSERT_EQUAL(4, read(fd, buf, 4));
+    TEST_ASSERT_EQUAL_STRING_LEN("4567", buf, 4);
+
+    /* Nothing evictable is left for another open file's cache */
+    TEST_ASSERT_EQUAL(-1, open(littlefs_base_path "/mem2.txt", O_RDONLY));
+    TEST_ASSERT_EQUAL(ENOMEM, errno);
+
+    TEST_ESP_OK(esp_littlefs_mem_set_budget(0));
+    TEST_ASSERT_EQUAL(0, close(fd));
+    esp_littlefs_mem_usage(&usage);
+    TEST_ASSERT_EQUAL(idle.total, usage.total);
+
+    test_teardown();
+}
+
+#if CONFIG_LITTLEFS_STATIC_ALLOC && CONFIG_HEAP_TRACING_STANDALONE
+TEST_CASE("static mode doesn't touch the heap after mount", "[littlefs]")
+{
+    static heap_trace_record_t records[16];
+    const char filename[] = littlefs_base_path "/static.txt";
+    char buf[16];
+    struct stat st;
+    test_setup();
+    TEST_ESP_OK(heap_trace_init_standalone(records, sizeof(records) / sizeof(records[0])));
+
+    TEST_ESP_OK(heap_trace_start(HEAP_TRACE_ALL));
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(11, write(fd, "hello world", 11));
+    TEST_ASSERT_EQUAL(0, lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL(11, read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(0, fsync(fd));
+    TEST_ASSERT_EQUAL(0, close(fd));
+    TEST_ASSERT_EQUAL(0, stat(filename, &st));
+    DIR *dir = opendir(littlefs_base_path);
+    TEST_ASSERT_NOT_NULL(dir);
+    TEST_ASSERT_NOT_NULL(readdir(dir));
+    TEST_ASSERT_EQUAL(0, closedir(dir));
+    TEST_ASSERT_EQUAL(0, unlink(filename));
+    TEST_ESP_OK(heap_trace_stop());
+
+    if(heap_trace_get_count() > 0) heap_trace_dump();
+    TEST_ASSERT_EQUAL(0, heap_trace_get_count());
+
+    test_teardown();
+}
+#endif
+
+#if CONFIG_LITTLEFS_STATS
+TEST_CASE("stats count operations, bytes and errors", "[littlefs]")
+{
+    esp_littlefs_stats_t stats;
+    char buf[16];
+    test_setup();
+    TEST_ESP_OK(esp_littlefs_stats_reset(littlefs_test_partition_label));
+
+    int fd = open(littlefs_base_path "/stats.txt", O_RDWR | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(11, write(fd, "hello world", 11));
+    TEST_ASSERT_EQUAL(0, lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL(11, read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(-1, unlink(littlefs_base_path "/stats.txt"));
+    TEST_ASSERT_EQUAL(EBUSY, errno);
+    TEST_ASSERT_EQUAL(0, close(fd));
+    TEST_ASSERT_EQUAL(-1, open(littlefs_base_path "/missing.txt", O_RDONLY));
+
+    TEST_ESP_OK(esp_littlefs_stats(littlefs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(2, stats.ops[ESP_LITTLEFS_OP_OPEN]);
+    TEST_ASSERT_EQUAL(1, stats.ops[ESP_LITTLEFS_OP_WRITE]);
+    TEST_ASSERT_EQUAL(1, stats.ops[ESP_LITTLEFS_OP_READ]);
+    TEST_ASSERT_EQUAL(1, stats.ops[ESP_LITTLEFS_OP_LSEEK]);
+    TEST_ASSERT_EQUAL(1, stats.ops[ESP_LITTLEFS_OP_CLOSE]);
+    TEST_ASSERT_EQUAL(11, stats.write_bytes);
+    TEST_ASSERT_EQUAL(11, stats.read_bytes);
+    TEST_ASSERT_TRUE(stats.flash_progs > 0);
+    TEST_ASSERT_EQUAL(1, stats.errors[ESP_LITTLEFS_ERR_NOENT]);
+    TEST_ASSERT_EQUAL(1, stats.errors[ESP_LITTLEFS_ERR_BUSY]);
+
+    TEST_ESP_OK(esp_littlefs_stats_reset(littlefs_test_partition_label));
+    TEST_ESP_OK(esp_littlefs_stats(littlefs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(0, stats.ops[ESP_LITTLEFS_OP_OPEN]);
+    TEST_ASSERT_EQUAL(0, stats.write_bytes);
+
+    test_teardown();
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_littlefs_stats(littlefs_test_partition_label, &stats));
+}
+#endif
+
+#if CONFIG_LITTLEFS_LATENCY
+TEST_CASE("latency histograms time calls and flash operations", "[littlefs]")
+{
+    esp_littlefs_latency_t lat;
+    char buf[16];
+    test_setup();
+    TEST_ESP_OK(esp_littlefs_latency_reset(littlefs_test_partition_label));
+
+    for(int i=0; i < 10; i++) {
+        test_littlefs_create_file_with_text(littlefs_base_path "/lat.txt", "hello world");
+        int fd = open(littlefs_base_path "/lat.txt", O_RDONLY);
+        TEST_ASSERT_TRUE(fd >= 0);
+        TEST_ASSERT_EQUAL(11, read(fd, buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL(0, close(fd));
+    }
+
+    TEST_ESP_OK(esp_littlefs_latency(littlefs_test_partition_label, ESP_LITTLEFS_OP_OPEN, &lat));
+    TEST_ASSERT_EQUAL(20, lat.count);
+    TEST_ASSERT_TRUE(lat.p50 <= lat.p90);
+    TEST_ASSERT_TRUE(lat.p90 <= lat.p99);
+    TEST_ASSERT_TRUE(lat.p99 <= lat.max);
+
+    TEST_ESP_OK(esp_littlefs_latency(littlefs_test_partition_label, ESP_LITTLEFS_LAT_FLASH_PROG, &lat));
+    TEST_ASSERT_TRUE(lat.count > 0);
+    TEST_ESP_OK(esp_littlefs_latency(littlefs_test_partition_label, ESP_LITTLEFS_LAT_LOCK_WAIT, &lat));
+    TEST_ASSERT_TRUE(lat.count > 0);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+            esp_littlefs_latency(littlefs_test_partition_label, ESP_LITTLEFS_LAT_MAX, &lat));
+
+    TEST_ESP_OK(esp_littlefs_latency_reset(littlefs_test_partition_label));
+    TEST_ESP_OK(esp_littlefs_latency(littlefs_test_partition_label, ESP_LITTLEFS_OP_OPEN, &lat));
+    TEST_ASSERT_EQUAL(0, lat.count);
+    TEST_ASSERT_EQUAL(0, lat.max);
+
+    test_teardown();
+}
+#endif
+
+#if CONFIG_LITTLEFS_TRACE
+TEST_CASE("trace records VFS and flash calls", "[littlefs]")
+{
+    static esp_littlefs_trace_rec_t recs[CONFIG_LITTLEFS_TRACE_ENTRIES];
+    esp_littlefs_trace_hdr_t hdr;
+    bool open_seen = false, write_seen = false, prog_seen = false;
+    test_setup();
+
+    TEST_ESP_OK(esp_littlefs_trace_start(littlefs_test_partition_label));
+    int fd = open(littlefs_base_path "/trace.txt", O_WRONLY | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(5, write(fd, "hello", 5));
+    TEST_ASSERT_EQUAL(0, close(fd));
+    esp_littlefs_trace_stop();
+
+    esp_littlefs_trace_header(&hdr);
+    TEST_ASSERT_EQUAL_HEX32(ESP_LITTLEFS_TRACE_MAGIC, hdr.magic);
+    TEST_ASSERT_EQUAL(sizeof(esp_littlefs_trace_rec_t), hdr.rec_size);
+    TEST_ASSERT_TRUE(hdr.block_size > 0);
+
+    size_t n = esp_littlefs_trace_read(recs, CONFIG_LITTLEFS_TRACE_ENTRIES);
+    TEST_ASSERT_TRUE(n > 0);
+    for(size_t i=0; i < n; i++) {
+        if(recs[i].type == ESP_LITTLEFS_TRACE_VFS && recs[i].op == ESP_LITTLEFS_OP_OPEN) {
+            open_seen = true;
+            TEST_ASSERT_EQUAL(fd, (int32_t)recs[i].arg2);
+        }
+        if(recs[i].type == ESP_LITTLEFS_TRACE_VFS && recs[i].op == ESP_LITTLEFS_OP_WRITE) {
+            write_seen = true;
+            TEST_ASSERT_EQUAL(fd, recs[i].arg0);
+            TEST_ASSERT_EQUAL(5, recs[i].arg1);
+        }
+        if(recs[i].type == ESP_LITTLEFS_TRACE_PROG) prog_seen = true;
+    }
+    TEST_ASSERT_TRUE(open_seen);
+    TEST_ASSERT_TRUE(write_seen);
+    TEST_ASSERT_TRUE(prog_seen);
+    TEST_ASSERT_EQUAL(0, esp_littlefs_trace_read(recs, CONFIG_LITTLEFS_TRACE_ENTRIES));
+
+    test_teardown();
+}
+#endif
+
+#if CONFIG_LITTLEFS_LOCK_PROFILE
+TEST_CASE("lock profile attributes holds to tasks and calls", "[littlefs]")
+{
+    esp_littlefs_lock_profile_t prof;
+    test_setup();
+    TEST_ESP_OK(esp_littlefs_lock_profile_reset(littlefs_test_partition_label));
+
+    test_littlefs_create_file_with_text(littlefs_base_path "/prof.txt", littlefs_test_hello_str);
+
+    TEST_ESP_OK(esp_littlefs_lock_profile(littlefs_test_partition_label, &prof));
+    TEST_ASSERT_EQUAL(1, prof.task_count);
+    TEST_ASSERT_EQUAL_STRING(pcTaskGetTaskName(NULL), prof.tasks[0].task);
+    TEST_ASSERT_TRUE(prof.tasks[0].acquisitions >= 2);
+    TEST_ASSERT_EQUAL(0, prof.tasks[0].contended);
+    TEST_ASSERT_TRUE(prof.hold_us[ESP_LITTLEFS_OP_OPEN] > 0);
+    TEST_ASSERT_TRUE(prof.worst[0].hold_us > 0);
+    TEST_ASSERT_TRUE(prof.worst[0].hold_us >= prof.worst[1].hold_us);
+    TEST_ASSERT_TRUE(prof.worst[0].op <= ESP_LITTLEFS_OP_MAX);
+
+    test_teardown();
+}
+#endif
+
+#if CONFIG_LITTLEFS_AMP
+TEST_CASE("amplification is charged to the file written", "[littlefs]")
+{
+    esp_littlefs_amp_t amp;
+    char buf[100];
+    test_setup();
+    TEST_ESP_OK(esp_littlefs_amp_reset(littlefs_test_partition_label));
+
+    /* Small synced appends cost far more flash than they carry */
+    memset(buf, 'a', sizeof(buf));
+    int fd = open(littlefs_base_path "/amp.txt", O_WRONLY | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    for(int i=0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(sizeof(buf), write(fd, buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL(0, fsync(fd));
+    }
+    TEST_ASSERT_EQUAL(0, close(fd));
+
+    TEST_ESP_OK(esp_littlefs_amp(littlefs_test_partition_label, &amp));
+    TEST_ASSERT_EQUAL(10 * sizeof(buf), amp.user_bytes);
+    TEST_ASSERT_TRUE(amp.write_amp > 1.0f);
+    TEST_ASSERT_EQUAL(1, amp.file_count);
+    TEST_ASSERT_EQUAL(10 * sizeof(buf), amp.files[0].user_bytes);
+    TEST_ASSERT_TRUE(amp.files[0].prog_bytes > 0);
+    TEST_ASSERT_EQUAL(amp.prog_bytes, amp.files[0].prog_bytes + amp.other_prog_bytes);
+    TEST_ASSERT_TRUE(amp.files[0].erase_amp == (float)amp.files[0].erase_bytes / amp.files[0].user_bytes);
+
+    test_teardown();
+}
+#endif
+
+typedef struct {
+    uint32_t blocks[3];
+    uint32_t big_blocks;
+} test_block_map_t;
+
+static void test_block_map_block(void *arg, uint32_t block, esp_littlefs_block_type_t type, const char *path)
+{
+    test_block_map_t *t = arg;
+    t->blocks[type]++;
+}
+
+static void test_block_map_file(void *arg, const char *path, uint32_t size, uint32_t blocks, uint32_t extents)
+{
+    test_block_map_t *t = arg;
+    if(!strcmp(path, "/big.bin")) t->big_blocks = blocks;
+    TEST_ASSERT_TRUE(extents <= blocks);
+}
+
+TEST_CASE("block map classifies every block", "[littlefs]")
+{
+    test_block_map_t t = { 0 };
+    const esp_littlefs_block_map_cb_t cb = {
+        .block = test_block_map_block,
+        .file = test_block_map_file,
+        .arg = &t,
+    };
+    esp_littlefs_block_map_t map;
+    char buf[512];
+    test_setup();
+
+    memset(buf, 0x55, sizeof(buf));
+    int fd = open(littlefs_base_path "/big.bin", O_WRONLY | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    for(int i=0; i < 24; i++) TEST_ASSERT_EQUAL(sizeof(buf), write(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(0, close(fd));
+    test_littlefs_create_file_with_text(littlefs_base_path "/small.txt", littlefs_test_hello_str);
+
+    TEST_ESP_OK(esp_littlefs_block_map(littlefs_test_partition_label, &cb, &map));
+    TEST_ASSERT_EQUAL(2, map.files);
+    TEST_ASSERT_TRUE(t.big_blocks >= 3);
+    TEST_ASSERT_EQUAL(t.big_blocks, map.data_blocks);
+    TEST_ASSERT_EQUAL(map.block_count, map.free_blocks + map.meta_blocks + map.data_blocks);
+    TEST_ASSERT_EQUAL(map.free_blocks, t.blocks[ESP_LITTLEFS_BLOCK_FREE]);
+    TEST_ASSERT_EQUAL(map.meta_blocks, t.blocks[ESP_LITTLEFS_BLOCK_META]);
+    TEST_ASSERT_EQUAL(map.data_blocks, t.blocks[ESP_LITTLEFS_BLOCK_DATA]);
+    TEST_ASSERT_TRUE(map.largest_free_run <= map.free_blocks);
+
+    /* The bitmap export agrees */
+    size_t bitmap_size = (map.block_count + 3) / 4;
+    uint8_t *bitmap = malloc(bitmap_size);
+    TEST_ASSERT_NOT_NULL(bitmap);
+    TEST_ESP_OK(esp_littlefs_block_bitmap(littlefs_test_partition_label, bitmap, bitmap_size));
+    uint32_t data = 0;
+    for(uint32_t b=0; b < map.block_count; b++) {
+        if(((bitmap[b / 4] >> (b % 4 * 2)) & 3) == ESP_LITTLEFS_BLOCK_DATA) data++;
+    }
+    TEST_ASSERT_EQUAL(map.data_blocks, data);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, esp_littlefs_block_bitmap(littlefs_test_partition_label, bitmap, 1));
+    free(bitmap);
+
+    test_teardown();
+}
+
+#if CONFIG_LITTLEFS_TASK_IO
+TEST_CASE("task I/O is charged to the caller and budgeted", "[littlefs]")
+{
+    esp_littlefs_top_t top;
+    char buf[512];
+    test_setup();
+
+    TEST_ESP_OK(esp_littlefs_top_reset(littlefs_test_partition_label));
+    memset(buf, 0x5a, sizeof(buf));
+    int fd = open(littlefs_base_path "/top.bin", O_WRONLY | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    for(int i=0; i < 16; i++) TEST_ASSERT_EQUAL(sizeof(buf), write(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(0, close(fd));
+
+    TEST_ESP_OK(esp_littlefs_top(littlefs_test_partition_label, &top));
+    TEST_ASSERT_EQUAL(1, top.task_count);
+    TEST_ASSERT_EQUAL_STRING(pcTaskGetTaskName(NULL), top.tasks[0].task);
+    TEST_ASSERT_EQUAL(18, top.tasks[0].ops);
+    TEST_ASSERT_EQUAL(16 * sizeof(buf), top.tasks[0].write_bytes);
+    TEST_ASSERT_TRUE(top.tasks[0].flash_prog_bytes >= 16 * sizeof(buf));
+    TEST_ASSERT_TRUE(top.tasks[0].flash_us > 0);
+    TEST_ASSERT_EQUAL(0, top.tasks[0].throttled);
+
+    /* A budget far below what rewriting the file costs holds the task back */
+    TEST_ESP_OK(esp_littlefs_io_budget(littlefs_test_partition_label, 100));
+    for(int n=0; n < 2; n++) {
+        fd = open(littlefs_base_path "/top.bin", O_WRONLY | O_TRUNC);
+        TEST_ASSERT_TRUE(fd >= 0);
+        for(int i=0; i < 16; i++) TEST_ASSERT_EQUAL(sizeof(buf), write(fd, buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL(0, close(fd));
+    }
+    TEST_ESP_OK(esp_littlefs_top(littlefs_test_partition_label, &top));
+    TEST_ASSERT_TRUE(top.tasks[0].throttled > 0);
+    TEST_ASSERT_TRUE(top.tasks[0].throttled_us > 0);
+    TEST_ESP_OK(esp_littlefs_io_budget(littlefs_test_partition_label, 0));
+
+    test_teardown();
+}
+#endif
+
+#if CONFIG_LITTLEFS_INTROSPECT
+TEST_CASE("introspection files are read-only renderings", "[littlefs]")
+{
+    char buf[512];
+    struct stat st;
+    test_setup();
+
+    test_littlefs_create_file_with_text(littlefs_base_path "/hello.txt", littlefs_test_hello_str);
+
+    int fd = open(littlefs_base_path "/.lfs/config", O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    TEST_ASSERT_TRUE(len > 0);
+    buf[len] = '\0';
+    TEST_ASSERT_NOT_NULL(strstr(buf, "block_size "));
+    TEST_ASSERT_EQUAL(-1, write(fd, "x", 1));
+    TEST_ASSERT_EQUAL(0, lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL(len, read(fd, buf, sizeof(buf) - 1));
+    TEST_ASSERT_EQUAL(0, read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL(0, fstat(fd, &st));
+    TEST_ASSERT_EQUAL(len, st.st_size);
+    TEST_ASSERT_EQUAL(0, close(fd));
+
+    /* open_fds lists the file open at the time */
+    int file_fd = open(littlefs_base_path "/hello.txt", O_RDONLY);
+    TEST_ASSERT_TRUE(file_fd >= 0);
+    fd = open(littlefs_base_path "/.lfs/open_fds", O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    len = read(fd, buf, sizeof(buf) - 1);
+    TEST_ASSERT_TRUE(len > 0);
+    buf[len] = '\0';
+#ifndef CONFIG_LITTLEFS_USE_ONLY_HASH
+    TEST_ASSERT_NOT_NULL(strstr(buf, "/hello.txt"));
+#endif
+    TEST_ASSERT_EQUAL(0, close(fd));
+    TEST_ASSERT_EQUAL(0, close(file_fd));
+
+    TEST_ASSERT_EQUAL(-1, open(littlefs_base_path "/.lfs/stats", O_WRONLY));
+    TEST_ASSERT_EQUAL(EROFS, errno);
+    TEST_ASSERT_EQUAL(-1, open(littlefs_base_path "/.lfs/nope", O_RDONLY));
+    TEST_ASSERT_EQUAL(ENOENT, errno);
+    TEST_ASSERT_EQUAL(0, stat(littlefs_base_path "/.lfs", &st));
+    TEST_ASSERT_TRUE(S_ISDIR(st.st_mode));
+
+    /* The directory lists every file, and isn't in the root listing */
+    int found = 0;
+    DIR *dir = opendir(littlefs_base_path "/.lfs");
+    TEST_ASSERT_NOT_NULL(dir);
+    for(struct dirent *e; (e = readdir(dir)) != NULL; found++) {
+        TEST_ASSERT_EQUAL(DT_REG, e->d_type);
+    }
+    TEST_ASSERT_EQUAL(6, found);
+    TEST_ASSERT_EQUAL(0, closedir(dir));
+    dir = opendir(littlefs_base_path);
+    TEST_ASSERT_NOT_NULL(dir);
+    for(struct dirent *e; (e = readdir(dir)) != NULL;) {
+        TEST_ASSERT_NOT_EQUAL(0, strcmp(e->d_name, ".lfs"));
+    }
+    TEST_ASSERT_EQUAL(0, closedir(dir));
+
+    test_teardown();
+}
+#endif
+
 
 TEST_CASE("stat/fstat returns correct values", "[littlefs]")
 {
@@ -394,6 +952,194 @@ TEST_CASE("multiple tasks can use same volume", "[littlefs]")
     test_teardown();
 }
 
+TEST_CASE("read-only mount rejects writes", "[littlefs]")
+{
+    const char filename[] = littlefs_base_path "/ro.txt";
+    test_setup();
+    test_littlefs_create_file_with_text(filename, littlefs_test_hello_str);
+    test_teardown();
+
+    const esp_vfs_littlefs_conf_t conf = {
+        .base_path = littlefs_base_path,
+        .partition_label = littlefs_test_partition_label,
+        .read_only = true
+    };
+    TEST_ESP_OK(esp_vfs_littlefs_register(&conf));
+
+    test_littlefs_read_file(filename);
+    TEST_ASSERT_NULL(fopen(filename, "w"));
+    TEST_ASSERT_EQUAL(EROFS, errno);
+    TEST_ASSERT_NULL(fopen(littlefs_base_path "/ro_new.txt", "w"));
+    TEST_ASSERT_EQUAL(-1, unlink(filename));
+    TEST_ASSERT_EQUAL(EROFS, errno);
+    TEST_ASSERT_EQUAL(-1, rename(filename, littlefs_base_path "/ro2.txt"));
+    TEST_ASSERT_EQUAL(-1, mkdir(littlefs_base_path "/ro_dir", 0755));
+#if CONFIG_LITTLEFS_STATS
+    esp_littlefs_stats_t stats;
+    TEST_ESP_OK(esp_littlefs_stats(littlefs_test_partition_label, &stats));
+    TEST_ASSERT_EQUAL(5, stats.errors[ESP_LITTLEFS_ERR_ROFS]);
+#endif
+    test_teardown();
+
+    test_setup();
+    TEST_ASSERT_EQUAL(0, unlink(filename));
+    test_teardown();
+}
+
+TEST_CASE("snapshot is a point-in-time view", "[littlefs]")
+{
+    test_setup();
+    const char kept[] = littlefs_base_path "/snap_kept.txt";
+    const char removed[] = littlefs_base_path "/snap_removed.txt";
+    test_littlefs_create_file_with_text(kept, "before");
+    test_littlefs_create_file_with_text(removed, "gone");
+
+    esp_littlefs_snapshot_t *snap;
+    TEST_ESP_OK(esp_littlefs_snapshot_take(littlefs_test_partition_label, &snap));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+            esp_littlefs_snapshot_take(littlefs_test_partition_label, &snap));
+
+    /* Change the live tree underneath the snapshot */
+    test_littlefs_create_file_with_text(kept, "after, and longer");
+    TEST_ASSERT_EQUAL(0, unlink(removed));
+    test_littlefs_create_file_with_text(littlefs_base_path "/snap_new.txt", "new");
+
+    struct lfs_info info;
+    TEST_ASSERT_EQUAL(LFS_ERR_NOENT, esp_littlefs_snapshot_stat(snap, "/snap_new.txt", &info));
+    TEST_ASSERT_EQUAL(0, esp_littlefs_snapshot_stat(snap, "/snap_removed.txt", &info));
+    TEST_ASSERT_EQUAL(4, info.size);
+
+    lfs_file_t file;
+    char buf[32] = { 0 };
+    TEST_ASSERT_EQUAL(0, esp_littlefs_snapshot_file_open(snap, &file, "/snap_kept.txt"));
+    TEST_ASSERT_EQUAL(6, esp_littlefs_snapshot_file_read(snap, &file, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("before", buf);
+    TEST_ASSERT_EQUAL(0, esp_littlefs_snapshot_file_close(snap, &file));
+
+    TEST_ESP_OK(esp_littlefs_snapshot_release(snap));
+
+    /* The live tree is unaffected */
+    FILE* f = fopen(kept, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(17, fread(buf, 1, sizeof(buf), f));
+    TEST_ASSERT_EQUAL(0, fclose(f));
+    TEST_ASSERT_NULL(fopen(removed, "r"));
+
+    TEST_ASSERT_EQUAL(0, unlink(kept));
+    TEST_ASSERT_EQUAL(0, unlink(littlefs_base_path "/snap_new.txt"));
+    test_teardown();
+}
+
+TEST_CASE("crc backends match littlefs' reference", "[littlefs]")
+{
+    static uint8_t buf[1100];
+    for (int i = 0; i < sizeof(buf); i++) {
+        buf[i] = esp_random();
+    }
+    /* Every length and alignment the 8-byte steps and the tail can see */
+    for (int size = 0; size <= 1024; size += size < 40 ? 1 : 61) {
+        for (int off = 0; off < 8; off++) {
+            uint32_t seed = esp_random();
+            uint32_t expected = lfs_crc_reference(seed, buf + off, size);
+            TEST_ASSERT_EQUAL_HEX32(expected, lfs_crc(seed, buf + off, size));
+            TEST_ASSERT_EQUAL_HEX32(expected, esp_littlefs_crc_rom(seed, buf + off, size));
+#if CONFIG_LITTLEFS_CRC_SLICE8
+            TEST_ASSERT_EQUAL_HEX32(expected, esp_littlefs_crc_slice8(seed, buf + off, size));
+#endif
+            /* littlefs chains the CRC over a commit's pieces */
+            int split = size / 3;
+            TEST_ASSERT_EQUAL_HEX32(expected,
+                    lfs_crc(lfs_crc(seed, buf + off, split), buf + off + split, size - split));
+        }
+    }
+}
+
+TEST_CASE("reads see earlier writes through sequential reads and rewrites", "[littlefs]")
+{
+    /* Sequential reads are what the external backend prefetches; the
+     * rewrite in between must not be hidden by data fetched before it */
+    const char* filename = littlefs_base_path "/seq.bin";
+    const size_t size = 16 * 1024;
+    uint8_t *data = malloc(size), *buf = malloc(size);
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_NOT_NULL(buf);
+    for (int i = 0; i < size; i++) {
+        data[i] = esp_random();
+    }
+    test_setup();
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    for (size_t done = 0; done < size; done += 1000) {
+        size_t n = MIN(1000, size - done);
+        TEST_ASSERT_EQUAL(n, write(fd, data + done, n));
+    }
+    TEST_ASSERT_EQUAL(0, fsync(fd));
+
+    for (int pass = 0; pass < 3; pass++) {
+        TEST_ASSERT_EQUAL(0, lseek(fd, 0, SEEK_SET));
+        for (size_t done = 0; done < size; done += 512) {
+            TEST_ASSERT_EQUAL(512, read(fd, buf + done, 512));
+        }
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(data, buf, size);
+
+        /* Rewrite the middle, then read it all again */
+        for (size_t i = size / 4; i < size / 2; i++) {
+            data[i] ^= 0x5a;
+        }
+        TEST_ASSERT_EQUAL(size / 4, lseek(fd, size / 4, SEEK_SET));
+        TEST_ASSERT_EQUAL(size / 4, write(fd, data + size / 4, size / 4));
+        TEST_ASSERT_EQUAL(0, fsync(fd));
+    }
+    TEST_ASSERT_EQUAL(0, close(fd));
+
+    FILE* f = fopen(filename, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(size, fread(buf, 1, size, f));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, buf, size);
+    TEST_ASSERT_EQUAL(0, fclose(f));
+
+    TEST_ASSERT_EQUAL(0, unlink(filename));
+    test_teardown();
+    free(data);
+    free(buf);
+}
+
+TEST_CASE("files read and written through PSRAM buffers", "[littlefs]")
+{
+    /* Whole blocks go between the caller's buffer and flash without
+     * littlefs' caches, so these take the bounced path */
+    const char* filename = littlefs_base_path "/psram.bin";
+    const size_t size = 3 * 4096 + 100;
+    uint8_t *data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    uint8_t *buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (data == NULL || buf == NULL) {
+        free(data);
+        free(buf);
+        TEST_IGNORE_MESSAGE("no PSRAM");
+    }
+    for (int i = 0; i < size; i++) {
+        data[i] = esp_random();
+    }
+    test_setup();
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(size, write(fd, data, size));
+    TEST_ASSERT_EQUAL(0, close(fd));
+
+    fd = open(filename, O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL(size, read(fd, buf, size));
+    TEST_ASSERT_EQUAL(0, close(fd));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, buf, size);
+
+    TEST_ASSERT_EQUAL(0, unlink(filename));
+    test_teardown();
+    free(data);
+    free(buf);
+}
+
 #if CONFIG_LITTLEFS_USE_MTIME
 
 #if CONFIG_LITTLEFS_MTIME_USE_SECONDS
@@ -0,0 +1,1668 @@
+/**
+ * @file bench.c
+ * @brief Benchmark littlefs workloads on the host against an emulated flash.
+ *
+ * Runs littlefs over a RAM block device that can sleep for the time a SPI
+ * NOR flash would take, behind one mutex per mount like esp_littlefs, and
+ * prints the results as JSON so configurations can be compared. Build from
+ * the repository root with
+ *
+ *   cc -O2 -pthread -Iinclude -Isrc -Isrc/littlefs tools/bench.c src/littlefs_crc.c \
+ *      src/littlefs/lfs.c src/littlefs/lfs_util.c -o bench
+ *
+ * and run
+ *
+ *   ./bench [--flash nor|ram] [--only SCENARIO] [--seed N] [--read N] [--prog N]
+ *           [--block-size N] [--block-count N] [--cache N] [--lookahead N]
+ *           [--block-cycles N] > results.json
+ *
+ * To run littlefs on the slicing-by-8 CRC instead of its own, leave out
+ * src/littlefs/lfs_util.c and define CONFIG_LITTLEFS_CRC_SLICE8:
+ *
+ *   cc -O2 -pthread -Iinclude -Isrc -Isrc/littlefs -DCONFIG_LITTLEFS_CRC_SLICE8 \
+ *      tools/bench.c src/littlefs_crc.c src/littlefs/lfs.c -o bench
+ *
+ * Progress goes to stderr. Every result has the scenario, its parameters,
+ * operations and bytes done, elapsed time, latency percentiles per
+ * operation and the flash traffic it caused.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lfs.h"
+#include "littlefs_crc.h"
+
+/**
+ * @brief How long flash operations take; sleeps are skipped if all are 0.
+ */
+typedef struct {
+    const char *name;
+    uint32_t read_ns_per_byte;
+    uint32_t prog_ns_per_byte;
+    uint32_t erase_us;            /* Per block */
+} flash_model_t;
+
+static const flash_model_t flash_models[] = {
+    {"ram", 0, 0, 0},
+    /* Quad SPI NOR at 40 MHz: ~20 MB/s reads, 256 B pages in ~0.7 ms, 4 KB sectors in ~45 ms */
+    {"nor", 50, 2700, 45000},
+};
+
+typedef struct {
+    uint32_t reads, progs, erases;
+    uint64_t read_bytes, prog_bytes, erase_bytes;
+} flash_counts_t;
+
+static const flash_model_t *flash = &flash_models[1];
+static uint8_t *ram;
+static uint32_t *block_erases;    /* Per block */
+static flash_counts_t counts;
+
+static struct lfs_config cfg = {
+    .read_size = 128,
+    .prog_size = 128,
+    .block_size = 4096,
+    .block_count = 256,
+    .cache_size = 128,
+    .lookahead_size = 128,
+    .block_cycles = 512,
+};
+static lfs_t lfs;
+static pthread_mutex_t fs_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *out;
+static int results;
+static const char *only;
+static uint8_t pattern[64 * 1024];
+
+/*** Time ***/
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void flash_wait(uint64_t ns) {
+    struct timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+    if(ns) while(nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+/*** Block device ***/
+
+/* Power cut injection for bench_powerloss() */
+static struct {
+    uint32_t countdown;           /* Programs and erases until the power goes, 0 for never */
+    int off;                      /* Gone: every call fails */
+    int torn;                     /* The interrupted program or erase does part of its work */
+    unsigned seed;
+} power;
+
+/** Count down one program or erase; true if the power goes during it */
+static int power_cut(void) {
+    if(power.countdown == 0 || --power.countdown > 0) return 0;
+    power.off = 1;
+    return 1;
+}
+
+static int bd_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    if(power.off) return LFS_ERR_IO;
+    memcpy(buffer, ram + block * c->block_size + off, size);
+    counts.reads++;
+    counts.read_bytes += size;
+    flash_wait((uint64_t)size * flash->read_ns_per_byte);
+    return 0;
+}
+
+static int bd_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    if(power.off) return LFS_ERR_IO;
+    if(power_cut()) {
+        /* Torn: only the start of the data made it */
+        if(power.torn) memcpy(ram + block * c->block_size + off, buffer, rand_r(&power.seed) % size);
+        return LFS_ERR_IO;
+    }
+    memcpy(ram + block * c->block_size + off, buffer, size);
+    counts.progs++;
+    counts.prog_bytes += size;
+    flash_wait((uint64_t)size * flash->prog_ns_per_byte);
+    return 0;
+}
+
+static int bd_erase(const struct lfs_config *c, lfs_block_t block) {
+    if(power.off) return LFS_ERR_IO;
+    if(power_cut()) {
+        /* Partial: the rest of the block keeps its old contents */
+        if(power.torn) memset(ram + block * c->block_size, 0xff, rand_r(&power.seed) % c->block_size);
+        return LFS_ERR_IO;
+    }
+    memset(ram + block * c->block_size, 0xff, c->block_size);
+    counts.erases++;
+    counts.erase_bytes += c->block_size;
+    block_erases[block]++;
+    flash_wait((uint64_t)flash->erase_us * 1000);
+    return 0;
+}
+
+static int bd_sync(const struct lfs_config *c) {
+    return 0;
+}
+
+/*
+ * Double-buffered transfers, as littlefs_xfer.c does them on target: a
+ * thread does every flash call, taking as long as the model says, from a
+ * FIFO of two ping-pong buffers and a slot for caller buffers and erases.
+ * Programs and erases return once queued, and a read that follows the
+ * previous one queues a read of what comes after it. Sync waits for all.
+ */
+
+enum { XFER_READ, XFER_PROG, XFER_ERASE };
+
+#define XFER_BUF_SIZE 4096
+#define XFER_DIRECT   2
+
+typedef struct {
+    int op;
+    int busy;                     /* Queued or running */
+    int valid;                    /* buf holds the flash at [addr, addr + len) */
+    uint64_t addr;
+    lfs_size_t len;
+    uint8_t *buf;
+    int res;
+} xfer_slot_t;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    xfer_slot_t slot[3];
+    xfer_slot_t *queue[4];
+    unsigned head, tail;
+    int stop;
+    int next;                     /* Ping-pong slot to fill next */
+    uint64_t seq_end;             /* End of the last read */
+    int err;                      /* First failed program or erase, for the next sync */
+    uint64_t hits, misses;
+} xfer = {.mu = PTHREAD_MUTEX_INITIALIZER, .cv = PTHREAD_COND_INITIALIZER};
+static uint8_t xfer_bufs[2][XFER_BUF_SIZE];
+
+static void * xfer_thread(void *arg) {
+    const struct lfs_config *c = arg;
+
+    pthread_mutex_lock(&xfer.mu);
+    for(;;) {
+        while(xfer.head == xfer.tail && !xfer.stop) pthread_cond_wait(&xfer.cv, &xfer.mu);
+        if(xfer.head == xfer.tail) break;
+        xfer_slot_t *s = xfer.queue[xfer.head++ % 4];
+        pthread_mutex_unlock(&xfer.mu);
+
+        lfs_block_t block = s->addr / c->block_size;
+        lfs_off_t off = s->addr % c->block_size;
+        lfs_size_t n;
+        int res = 0;
+        switch(s->op) {
+            case XFER_READ:
+                /* A prefetch may run into the next block */
+                for(lfs_size_t done=0; done < s->len && res == 0; done += n, block++, off = 0) {
+                    n = c->block_size - off < s->len - done ? c->block_size - off : s->len - done;
+                    res = bd_read(c, block, off, s->buf + done, n);
+                }
+                break;
+            case XFER_PROG:
+                res = bd_prog(c, block, off, s->buf, s->len);
+                break;
+            case XFER_ERASE:
+                res = bd_erase(c, block);
+                break;
+        }
+
+        pthread_mutex_lock(&xfer.mu);
+        s->res = res;
+        s->busy = 0;
+        pthread_cond_broadcast(&xfer.cv);
+    }
+    pthread_mutex_unlock(&xfer.mu);
+    return NULL;
+}
+
+static int xfer_wait(xfer_slot_t *s) {
+    int res;
+
+    pthread_mutex_lock(&xfer.mu);
+    while(s->busy) pthread_cond_wait(&xfer.cv, &xfer.mu);
+    res = s->res;
+    s->res = 0;
+    pthread_mutex_unlock(&xfer.mu);
+    if(res && s->op != XFER_READ && xfer.err == 0) xfer.err = res;
+    return res;
+}
+
+static void xfer_submit(xfer_slot_t *s, int op, uint64_t addr, lfs_size_t len) {
+    s->op = op;
+    s->addr = addr;
+    s->len = len;
+    pthread_mutex_lock(&xfer.mu);
+    s->busy = 1;
+    xfer.queue[xfer.tail++ % 4] = s;
+    pthread_cond_broadcast(&xfer.cv);
+    pthread_mutex_unlock(&xfer.mu);
+}
+
+static xfer_slot_t * xfer_next(void) {
+    xfer_slot_t *s = &xfer.slot[xfer.next];
+
+    xfer.next ^= 1;
+    xfer_wait(s);
+    s->valid = 0;
+    return s;
+}
+
+static void xfer_invalidate(void) {
+    xfer.slot[0].valid = 0;
+    xfer.slot[1].valid = 0;
+    xfer.seq_end = UINT64_MAX;
+}
+
+static int xfer_bd_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    uint64_t addr = (uint64_t)block * c->block_size + off;
+    int sequential = addr == xfer.seq_end;
+    xfer_slot_t *s = NULL;
+    int res;
+
+    for(int i=0; i < 2; i++) {
+        xfer_slot_t *p = &xfer.slot[i];
+        if(p->valid && addr >= p->addr && addr + size <= p->addr + p->len) s = p;
+    }
+    if(s) {
+        res = xfer_wait(s);
+        memcpy(buffer, s->buf + (addr - s->addr), size);
+        xfer.hits++;
+    }
+    else {
+        s = &xfer.slot[XFER_DIRECT];
+        xfer_wait(s);
+        s->buf = buffer;
+        xfer_submit(s, XFER_READ, addr, size);
+        res = xfer_wait(s);
+        xfer.misses++;
+    }
+    xfer.seq_end = addr + size;
+    if(res) return res;
+
+    if(sequential && size <= XFER_BUF_SIZE
+            && addr + 2 * size <= (uint64_t)c->block_size * c->block_count) {
+        for(int i=0; i < 2; i++) {
+            if(xfer.slot[i].valid && xfer.slot[i].addr == addr + size) return 0;
+        }
+        s = xfer_next();
+        xfer_submit(s, XFER_READ, addr + size, size);
+        s->valid = 1;
+    }
+    return 0;
+}
+
+static int xfer_bd_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    uint64_t addr = (uint64_t)block * c->block_size + off;
+
+    xfer_invalidate();
+    for(lfs_size_t done=0; done < size; done += XFER_BUF_SIZE) {
+        lfs_size_t len = size - done < XFER_BUF_SIZE ? size - done : XFER_BUF_SIZE;
+        xfer_slot_t *s = xfer_next();
+        memcpy(s->buf, (const uint8_t *)buffer + done, len);
+        xfer_submit(s, XFER_PROG, addr + done, len);
+    }
+    return 0;
+}
+
+static int xfer_bd_erase(const struct lfs_config *c, lfs_block_t block) {
+    xfer_slot_t *s = &xfer.slot[XFER_DIRECT];
+
+    xfer_invalidate();
+    xfer_wait(s);
+    xfer_submit(s, XFER_ERASE, (uint64_t)block * c->block_size, c->block_size);
+    return 0;
+}
+
+static int xfer_bd_sync(const struct lfs_config *c) {
+    int err;
+
+    for(int i=0; i < 3; i++) xfer_wait(&xfer.slot[i]);
+    xfer_invalidate();
+    err = xfer.err;
+    xfer.err = 0;
+    return err;
+}
+
+/** Route flash calls through the transfer thread, or back to direct calls */
+static void xfer_enable(int on) {
+    if(on) {
+        xfer.slot[0].buf = xfer_bufs[0];
+        xfer.slot[1].buf = xfer_bufs[1];
+        xfer.stop = 0;
+        xfer.hits = xfer.misses = 0;
+        xfer_invalidate();
+        pthread_create(&xfer.thread, NULL, xfer_thread, &cfg);
+        cfg.read = xfer_bd_read;
+        cfg.prog = xfer_bd_prog;
+        cfg.erase = xfer_bd_erase;
+        cfg.sync = xfer_bd_sync;
+    }
+    else {
+        xfer_bd_sync(&cfg);
+        pthread_mutex_lock(&xfer.mu);
+        xfer.stop = 1;
+        pthread_cond_broadcast(&xfer.cv);
+        pthread_mutex_unlock(&xfer.mu);
+        pthread_join(xfer.thread, NULL);
+        cfg.read = bd_read;
+        cfg.prog = bd_prog;
+        cfg.erase = bd_erase;
+        cfg.sync = bd_sync;
+    }
+}
+
+/*** Latency samples ***/
+
+typedef struct {
+    const char *op;
+    uint32_t *us;
+    size_t n, cap;
+} lat_t;
+
+static void lat_add(lat_t *l, uint64_t us) {
+    if(l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        l->us = realloc(l->us, l->cap * sizeof(*l->us));
+    }
+    l->us[l->n++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/** Sorts the samples */
+static uint32_t lat_pct(lat_t *l, unsigned pct) {
+    if(l->n == 0) return 0;
+    qsort(l->us, l->n, sizeof(*l->us), cmp_u32);
+    size_t rank = (l->n * pct + 99) / 100;
+    return l->us[rank ? rank - 1 : 0];
+}
+
+static void lat_free(lat_t *l) {
+    free(l->us);
+    memset(l, 0, sizeof(*l));
+}
+
+/*** Calls, each under the mount lock like a VFS call ***/
+
+static uint64_t timed_wait_us;   /* Lock wait of the last call */
+
+static void fs_take(void) {
+    uint64_t t0 = now_us();
+    pthread_mutex_lock(&fs_lock);
+    timed_wait_us = now_us() - t0;
+}
+
+static void fs_give(void) {
+    pthread_mutex_unlock(&fs_lock);
+}
+
+#define FS_CALL(res, call) do { fs_take(); res = (call); fs_give(); } while(0)
+
+static void check(int res, const char *what) {
+    if(res < 0) {
+        fprintf(stderr, "%s failed: %d\n", what, res);
+        exit(1);
+    }
+}
+
+/*** Results ***/
+
+typedef struct {
+    const char *scenario;
+    char params[256];             /* JSON members, without braces */
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t us;
+    lat_t *lats;
+    size_t lat_count;
+    flash_counts_t flash;
+    char extra[1024];             /* More JSON members, without braces */
+} result_t;
+
+static void result_begin(result_t *r, const char *scenario, lat_t *lats, size_t lat_count,
+        const char *fmt, ...) {
+    va_list args;
+
+    memset(r, 0, sizeof(*r));
+    r->scenario = scenario;
+    r->lats = lats;
+    r->lat_count = lat_count;
+    va_start(args, fmt);
+    vsnprintf(r->params, sizeof(r->params), fmt, args);
+    va_end(args);
+    r->flash = counts;
+    r->us = now_us();
+}
+
+static void result_end(result_t *r) {
+    r->us = now_us() - r->us;
+    r->flash.reads = counts.reads - r->flash.reads;
+    r->flash.progs = counts.progs - r->flash.progs;
+    r->flash.erases = counts.erases - r->flash.erases;
+    r->flash.read_bytes = counts.read_bytes - r->flash.read_bytes;
+    r->flash.prog_bytes = counts.prog_bytes - r->flash.prog_bytes;
+    r->flash.erase_bytes = counts.erase_bytes - r->flash.erase_bytes;
+}
+
+static void result_extra(result_t *r, const char *fmt, ...) {
+    size_t len = strlen(r->extra);
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(r->extra + len, sizeof(r->extra) - len, fmt, args);
+    va_end(args);
+}
+
+static void result_emit(result_t *r) {
+    double s = r->us / 1e6;
+
+    fprintf(out, "%s\n    {\"scenario\": \"%s\", \"params\": {%s},\n", results++ ? "," : "",
+            r->scenario, r->params);
+    fprintf(out, "     \"ops\": %llu, \"bytes\": %llu, \"us\": %llu, \"ops_per_s\": %.1f, \"kb_per_s\": %.1f,\n",
+            (unsigned long long)r->ops, (unsigned long long)r->bytes, (unsigned long long)r->us,
+            s > 0 ? r->ops / s : 0, s > 0 ? r->bytes / 1024.0 / s : 0);
+    fprintf(out, "     \"latency_us\": {");
+    for(size_t i=0; i < r->lat_count; i++) {
+        lat_t *l = &r->lats[i];
+        fprintf(out, "%s\"%s\": {\"n\": %zu, \"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}",
+                i ? ", " : "", l->op, l->n, lat_pct(l, 50), lat_pct(l, 90), lat_pct(l, 99),
+                l->n ? l->us[l->n - 1] : 0);
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "     \"flash\": {\"reads\": %u, \"progs\": %u, \"erases\": %u, "
+            "\"read_bytes\": %llu, \"prog_bytes\": %llu, \"erase_bytes\": %llu}%s%s}",
+            r->flash.reads, r->flash.progs, r->flash.erases,
+            (unsigned long long)r->flash.read_bytes, (unsigned long long)r->flash.prog_bytes,
+            (unsigned long long)r->flash.erase_bytes, r->extra[0] ? ",\n     " : "", r->extra);
+    fflush(out);
+    for(size_t i=0; i < r->lat_count; i++) lat_free(&r->lats[i]);
+    fprintf(stderr, "  %-12s %-40s %10.1f ops/s %10.1f KB/s\n", r->scenario, r->params,
+            s > 0 ? r->ops / s : 0, s > 0 ? r->bytes / 1024.0 / s : 0);
+}
+
+/*** Helpers ***/
+
+static void fresh_fs(void) {
+    memset(ram, 0xff, (size_t)cfg.block_size * cfg.block_count);
+    check(lfs_format(&lfs, &cfg), "format");
+    check(lfs_mount(&lfs, &cfg), "mount");
+}
+
+/** Returns a littlefs error instead of exiting, for when the partition may be full */
+static int put_file(const char *path, size_t size, size_t chunk) {
+    lfs_file_t f;
+    int res, err;
+
+    FS_CALL(res, lfs_file_open(&lfs, &f, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+    if(res < 0) return res;
+    for(size_t done=0; done < size && res >= 0; done += chunk) {
+        FS_CALL(res, lfs_file_write(&lfs, &f, pattern, chunk < size - done ? chunk : size - done));
+    }
+    FS_CALL(err, lfs_file_close(&lfs, &f));
+    return res < 0 ? res : err;
+}
+
+static void write_file(const char *path, size_t size, size_t chunk) {
+    check(put_file(path, size, chunk), path);
+}
+
+static const size_t block_sizes[] = {256, 1024, 4096, 16384};
+#define SEQ_FILE_SIZE  (128 * 1024)
+#define RAND_OPS       64
+#define SMALL_FILES    200
+#define SMALL_SIZE     64
+#define LIST_FILES     500
+#define LIST_PASSES    5
+#define LOG_RECORDS    1000
+#define LOG_RECORD     64
+
+/*** Scenarios ***/
+
+static void bench_seq(void) {
+    for(size_t b=0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++) {
+        size_t bs = block_sizes[b];
+        lat_t lat[1] = {{.op = "write"}};
+        result_t r;
+        lfs_file_t f;
+        int res;
+
+        fresh_fs();
+        result_begin(&r, "seq_write", lat, 1, "\"io_size\": %zu, \"file_size\": %d", bs, SEQ_FILE_SIZE);
+        FS_CALL(res, lfs_file_open(&lfs, &f, "/seq.bin", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+        check(res, "open");
+        for(size_t done=0; done < SEQ_FILE_SIZE; done += bs) {
+            uint64_t t0 = now_us();
+            FS_CALL(res, lfs_file_write(&lfs, &f, pattern, bs));
+            check(res, "write");
+            lat_add(&lat[0], now_us() - t0);
+            r.ops++;
+            r.bytes += bs;
+        }
+        FS_CALL(res, lfs_file_close(&lfs, &f));
+        check(res, "close");
+        result_end(&r);
+        result_emit(&r);
+
+        lat[0].op = "read";
+        result_begin(&r, "seq_read", lat, 1, "\"io_size\": %zu, \"file_size\": %d", bs, SEQ_FILE_SIZE);
+        FS_CALL(res, lfs_file_open(&lfs, &f, "/seq.bin", LFS_O_RDONLY));
+        check(res, "open");
+        for(size_t done=0; done < SEQ_FILE_SIZE; done += bs) {
+            uint64_t t0 = now_us();
+            FS_CALL(res, lfs_file_read(&lfs, &f, pattern, bs));
+            check(res, "read");
+            lat_add(&lat[0], now_us() - t0);
+            r.ops++;
+            r.bytes += res;
+        }
+        FS_CALL(res, lfs_file_close(&lfs, &f));
+        result_end(&r);
+        result_emit(&r);
+        lfs_unmount(&lfs);
+    }
+}
+
+static void bench_random(void) {
+    for(size_t b=0; b < sizeof(block_sizes) / sizeof(block_sizes[0]); b++) {
+        size_t bs = block_sizes[b];
+        size_t slots = SEQ_FILE_SIZE / bs;
+        lat_t lat[1] = {{.op = "read"}};
+        result_t r;
+        lfs_file_t f;
+        int res;
+
+        fresh_fs();
+        write_file("/rand.bin", SEQ_FILE_SIZE, 4096);
+
+        result_begin(&r, "rand_read", lat, 1, "\"io_size\": %zu, \"file_size\": %d", bs, SEQ_FILE_SIZE);
+        FS_CALL(res, lfs_file_open(&lfs, &f, "/rand.bin", LFS_O_RDONLY));
+        check(res, "open");
+        for(int i=0; i < RAND_OPS; i++) {
+            uint64_t t0 = now_us();
+            fs_take();
+            check(lfs_file_seek(&lfs, &f, (rand() % slots) * bs, LFS_SEEK_SET), "seek");
+            res = lfs_file_read(&lfs, &f, pattern, bs);
+            fs_give();
+            check(res, "read");
+            lat_add(&lat[0], now_us() - t0);
+            r.ops++;
+            r.bytes += res;
+        }
+        FS_CALL(res, lfs_file_close(&lfs, &f));
+        result_end(&r);
+        result_emit(&r);
+
+        /* Each write is synced; otherwise littlefs would only rewrite the file at close */
+        lat[0].op = "write";
+        result_begin(&r, "rand_write", lat, 1, "\"io_size\": %zu, \"file_size\": %d", bs, SEQ_FILE_SIZE);
+        FS_CALL(res, lfs_file_open(&lfs, &f, "/rand.bin", LFS_O_RDWR));
+        check(res, "open");
+        for(int i=0; i < RAND_OPS; i++) {
+            uint64_t t0 = now_us();
+            fs_take();
+            check(lfs_file_seek(&lfs, &f, (rand() % slots) * bs, LFS_SEEK_SET), "seek");
+            res = lfs_file_write(&lfs, &f, pattern, bs);
+            if(res >= 0) res = lfs_file_sync(&lfs, &f);
+            fs_give();
+            check(res, "write");
+            lat_add(&lat[0], now_us() - t0);
+            r.ops++;
+            r.bytes += bs;
+        }
+        FS_CALL(res, lfs_file_close(&lfs, &f));
+        result_end(&r);
+        result_emit(&r);
+        lfs_unmount(&lfs);
+    }
+}
+
+static void bench_small_files(void) {
+    lat_t lat[1];
+    struct lfs_info info;
+    result_t r;
+    char path[32];
+    int res;
+
+    fresh_fs();
+    lat[0] = (lat_t){.op = "create"};
+    result_begin(&r, "small_create", lat, 1, "\"files\": %d, \"file_size\": %d", SMALL_FILES, SMALL_SIZE);
+    for(int i=0; i < SMALL_FILES; i++) {
+        uint64_t t0 = now_us();
+        snprintf(path, sizeof(path), "/s%04d", i);
+        write_file(path, SMALL_SIZE, SMALL_SIZE);
+        lat_add(&lat[0], now_us() - t0);
+        r.ops++;
+        r.bytes += SMALL_SIZE;
+    }
+    result_end(&r);
+    result_emit(&r);
+
+    lat[0] = (lat_t){.op = "stat"};
+    result_begin(&r, "small_stat", lat, 1, "\"files\": %d", SMALL_FILES);
+    for(int i=0; i < SMALL_FILES; i++) {
+        uint64_t t0 = now_us();
+        snprintf(path, sizeof(path), "/s%04d", rand() % SMALL_FILES);
+        FS_CALL(res, lfs_stat(&lfs, path, &info));
+        check(res, "stat");
+        lat_add(&lat[0], now_us() - t0);
+        r.ops++;
+    }
+    result_end(&r);
+    result_emit(&r);
+
+    lat[0] = (lat_t){.op = "delete"};
+    result_begin(&r, "small_delete", lat, 1, "\"files\": %d", SMALL_FILES);
+    for(int i=0; i < SMALL_FILES; i++) {
+        uint64_t t0 = now_us();
+        snprintf(path, sizeof(path), "/s%04d", i);
+        FS_CALL(res, lfs_remove(&lfs, path));
+        check(res, "remove");
+        lat_add(&lat[0], now_us() - t0);
+        r.ops++;
+    }
+    result_end(&r);
+    result_emit(&r);
+    lfs_unmount(&lfs);
+}
+
+static void bench_dir_list(void) {
+    lat_t lat[1] = {{.op = "readdir"}};
+    struct lfs_info info;
+    result_t r;
+    lfs_dir_t dir;
+    char path[32];
+    int res;
+
+    fresh_fs();
+    check(lfs_mkdir(&lfs, "/dir"), "mkdir");
+    for(int i=0; i < LIST_FILES; i++) {
+        snprintf(path, sizeof(path), "/dir/f%04d", i);
+        write_file(path, 16, 16);
+    }
+
+    result_begin(&r, "dir_list", lat, 1, "\"entries\": %d, \"passes\": %d", LIST_FILES, LIST_PASSES);
+    for(int pass=0; pass < LIST_PASSES; pass++) {
+        FS_CALL(res, lfs_dir_open(&lfs, &dir, "/dir"));
+        check(res, "opendir");
+        for(;;) {
+            uint64_t t0 = now_us();
+            FS_CALL(res, lfs_dir_read(&lfs, &dir, &info));
+            check(res, "readdir");
+            if(res == 0) break;
+            lat_add(&lat[0], now_us() - t0);
+            r.ops++;
+        }
+        FS_CALL(res, lfs_dir_close(&lfs, &dir));
+    }
+    result_end(&r);
+    result_emit(&r);
+    lfs_unmount(&lfs);
+}
+
+static void bench_append_log(void) {
+    lat_t lat[1] = {{.op = "append"}};
+    result_t r;
+    lfs_file_t f;
+    int res;
+
+    fresh_fs();
+    result_begin(&r, "append_log", lat, 1, "\"records\": %d, \"record_size\": %d, \"sync\": true",
+            LOG_RECORDS, LOG_RECORD);
+    FS_CALL(res, lfs_file_open(&lfs, &f, "/log.txt", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND));
+    check(res, "open");
+    for(int i=0; i < LOG_RECORDS; i++) {
+        uint64_t t0 = now_us();
+        fs_take();
+        res = lfs_file_write(&lfs, &f, pattern, LOG_RECORD);
+        if(res >= 0) res = lfs_file_sync(&lfs, &f);
+        fs_give();
+        check(res, "append");
+        lat_add(&lat[0], now_us() - t0);
+        r.ops++;
+        r.bytes += LOG_RECORD;
+    }
+    FS_CALL(res, lfs_file_close(&lfs, &f));
+    result_end(&r);
+    result_emit(&r);
+    lfs_unmount(&lfs);
+}
+
+/*** Mixed multi-task workload ***/
+
+#define MIXED_OPS     200
+#define MIXED_IO_SIZE 1024
+
+typedef struct {
+    int id;
+    int writer;
+    lat_t lat;
+    uint64_t bytes;
+    uint64_t wait_us;
+} mixed_task_t;
+
+static void * mixed_task(void *arg) {
+    mixed_task_t *t = arg;
+    char path[32];
+    lfs_file_t f;
+    int res;
+
+    if(t->writer) snprintf(path, sizeof(path), "/w%d.bin", t->id);
+    else snprintf(path, sizeof(path), "/shared.bin");
+    FS_CALL(res, lfs_file_open(&lfs, &f, path, t->writer ? LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC : LFS_O_RDONLY));
+    check(res, path);
+    for(int i=0; i < MIXED_OPS; i++) {
+        uint64_t t0 = now_us();
+        fs_take();
+        t->wait_us += timed_wait_us;
+        if(t->writer) {
+            res = lfs_file_write(&lfs, &f, pattern, MIXED_IO_SIZE);
+            if(res >= 0 && i % 16 == 15) res = lfs_file_sync(&lfs, &f);
+        }
+        else {
+            res = lfs_file_read(&lfs, &f, pattern, MIXED_IO_SIZE);
+            if(res == 0) {
+                lfs_file_rewind(&lfs, &f);
+                res = lfs_file_read(&lfs, &f, pattern, MIXED_IO_SIZE);
+            }
+        }
+        fs_give();
+        check(res, t->writer ? "write" : "read");
+        lat_add(&t->lat, now_us() - t0);
+        t->bytes += MIXED_IO_SIZE;
+    }
+    FS_CALL(res, lfs_file_close(&lfs, &f));
+    return NULL;
+}
+
+static void bench_mixed(void) {
+    enum { TASKS = 4 };
+    mixed_task_t tasks[TASKS];
+    pthread_t threads[TASKS];
+    lat_t lat[2] = {{.op = "write"}, {.op = "read"}};
+    uint64_t wait_us = 0;
+    result_t r;
+
+    fresh_fs();
+    write_file("/shared.bin", 64 * 1024, 4096);
+
+    result_begin(&r, "mixed", lat, 2, "\"tasks\": %d, \"writers\": %d, \"io_size\": %d",
+            TASKS, TASKS / 2, MIXED_IO_SIZE);
+    for(int i=0; i < TASKS; i++) {
+        tasks[i] = (mixed_task_t){.id = i, .writer = i < TASKS / 2};
+        tasks[i].lat.op = tasks[i].writer ? "write" : "read";
+        pthread_create(&threads[i], NULL, mixed_task, &tasks[i]);
+    }
+    for(int i=0; i < TASKS; i++) {
+        pthread_join(threads[i], NULL);
+        lat_t *l = &lat[tasks[i].writer ? 0 : 1];
+        for(size_t j=0; j < tasks[i].lat.n; j++) lat_add(l, tasks[i].lat.us[j]);
+        lat_free(&tasks[i].lat);
+        r.ops += MIXED_OPS;
+        r.bytes += tasks[i].bytes;
+        wait_us += tasks[i].wait_us;
+    }
+    result_end(&r);
+    result_extra(&r, "\"lock_wait_us\": %llu", (unsigned long long)wait_us);
+    result_emit(&r);
+    lfs_unmount(&lfs);
+}
+
+/*** Concurrency scaling ***/
+
+#define SCALE_MAX_TASKS 8
+#define SCALE_IO_SIZE   1024
+#define SCALE_REGION    (32 * 1024)  /* Per task, in its own file or the shared one */
+#define SCALE_RUN_MS    300
+
+static const int scale_tasks[] = {1, 2, 4, 8};
+static const int scale_read_pct[] = {0, 50, 90};
+
+typedef struct {
+    int id;
+    int read_pct;
+    int pinned;
+    lfs_file_t file;              /* Own handle, like each read-write fd on target */
+    lfs_off_t base;               /* Of the task's region in the file */
+    pthread_barrier_t *start;
+    volatile int *stop;
+    lat_t lat[2];                 /* Write, read */
+    uint64_t ops, bytes, wait_us, us;
+} scale_task_t;
+
+static void * scale_task(void *arg) {
+    scale_task_t *t = arg;
+    unsigned seed = t->id + 1;
+    lfs_off_t pos = 0;
+    uint64_t start;
+    int res;
+
+    if(t->pinned) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(t->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    pthread_barrier_wait(t->start);
+    start = now_us();
+    while(!__atomic_load_n(t->stop, __ATOMIC_RELAXED)) {
+        int read = rand_r(&seed) % 100 < t->read_pct;
+        uint64_t t0 = now_us();
+
+        fs_take();
+        t->wait_us += timed_wait_us;
+        res = lfs_file_seek(&lfs, &t->file, t->base + pos, LFS_SEEK_SET);
+        if(res >= 0 && read) res = lfs_file_read(&lfs, &t->file, pattern, SCALE_IO_SIZE);
+        else if(res >= 0) {
+            res = lfs_file_write(&lfs, &t->file, pattern, SCALE_IO_SIZE);
+            if(res >= 0 && t->ops % 16 == 15) res = lfs_file_sync(&lfs, &t->file);
+        }
+        fs_give();
+        check(res, read ? "read" : "write");
+        lat_add(&t->lat[read], now_us() - t0);
+        pos = (pos + SCALE_IO_SIZE) % SCALE_REGION;
+        t->ops++;
+        t->bytes += SCALE_IO_SIZE;
+    }
+    t->us = now_us() - start;
+    return NULL;
+}
+
+static void scale_run(int n, int read_pct, int shared, int pinned) {
+    scale_task_t tasks[SCALE_MAX_TASKS];
+    pthread_t threads[SCALE_MAX_TASKS];
+    pthread_barrier_t start;
+    lat_t lat[2] = {{.op = "write"}, {.op = "read"}};
+    volatile int stop = 0;
+    uint64_t wait_us = 0, busy_us = 0;
+    double sum = 0, sum_sq = 0;
+    char path[32];
+    result_t r;
+    int res;
+
+    fresh_fs();
+    /* The port only shares read-only opens, so writers of a shared file
+     * each have their own handle on it, and their own region in it */
+    if(shared) write_file("/shared.bin", n * SCALE_REGION, 4096);
+    pthread_barrier_init(&start, NULL, n + 1);
+    for(int i=0; i < n; i++) {
+        tasks[i] = (scale_task_t){.id = i, .read_pct = read_pct, .pinned = pinned,
+                .base = shared ? i * SCALE_REGION : 0,
+                .start = &start, .stop = &stop, .lat = {{.op = "write"}, {.op = "read"}}};
+        if(shared) strcpy(path, "/shared.bin");
+        else {
+            snprintf(path, sizeof(path), "/t%d.bin", i);
+            write_file(path, SCALE_REGION, 4096);
+        }
+        check(lfs_file_open(&lfs, &tasks[i].file, path, LFS_O_RDWR), path);
+        pthread_create(&threads[i], NULL, scale_task, &tasks[i]);
+    }
+
+    result_begin(&r, "scaling", lat, 2, "\"tasks\": %d, \"read_pct\": %d, \"shared\": %s, \"pinned\": %s",
+            n, read_pct, shared ? "true" : "false", pinned ? "true" : "false");
+    pthread_barrier_wait(&start);
+    flash_wait((uint64_t)SCALE_RUN_MS * 1000000);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for(int i=0; i < n; i++) pthread_join(threads[i], NULL);
+    result_end(&r);
+    pthread_barrier_destroy(&start);
+
+    for(int i=0; i < n; i++) {
+        scale_task_t *t = &tasks[i];
+        double rate = t->us ? t->ops * 1e6 / t->us : 0;
+
+        for(int k=0; k < 2; k++) {
+            for(size_t j=0; j < t->lat[k].n; j++) lat_add(&lat[k], t->lat[k].us[j]);
+            lat_free(&t->lat[k]);
+        }
+        r.ops += t->ops;
+        r.bytes += t->bytes;
+        wait_us += t->wait_us;
+        busy_us += t->us;
+        sum += rate;
+        sum_sq += rate * rate;
+        FS_CALL(res, lfs_file_close(&lfs, &t->file));
+    }
+    (void)res;
+
+    /* Jain's index over per-task op rates: 1 is perfectly fair, 1/n is one task getting everything */
+    result_extra(&r, "\"fairness\": %.3f, \"lock_wait_frac\": %.3f, \"task_ops\": [",
+            sum_sq > 0 ? sum * sum / (n * sum_sq) : 1.0, busy_us ? (double)wait_us / busy_us : 0);
+    for(int i=0; i < n; i++) result_extra(&r, "%s%llu", i ? ", " : "", (unsigned long long)tasks[i].ops);
+    result_extra(&r, "]");
+    result_emit(&r);
+    lfs_unmount(&lfs);
+}
+
+static void bench_scaling(void) {
+    for(size_t n=0; n < sizeof(scale_tasks) / sizeof(scale_tasks[0]); n++) {
+        for(size_t rp=0; rp < sizeof(scale_read_pct) / sizeof(scale_read_pct[0]); rp++) {
+            for(int shared=0; shared < 2; shared++) {
+                for(int pinned=0; pinned < 2; pinned++) {
+                    scale_run(scale_tasks[n], scale_read_pct[rp], shared, pinned);
+                }
+            }
+        }
+    }
+}
+
+/*** Fill levels ***/
+
+/*
+ * littlefs refills its lookahead window of free blocks by walking the whole
+ * tree. Nothing reports that, so it is inferred from the window: it moved,
+ * its cursor went back or its bitmap changed. Several walks within one call
+ * count as one.
+ */
+#if LFS_VERSION >= 0x00020009
+#define LOOKAHEAD_START(lfs)  ((lfs)->lookahead.start)
+#define LOOKAHEAD_NEXT(lfs)   ((lfs)->lookahead.next)
+#define LOOKAHEAD_BUFFER(lfs) ((const void *)(lfs)->lookahead.buffer)
+#else
+#define LOOKAHEAD_START(lfs)  ((lfs)->free.off)
+#define LOOKAHEAD_NEXT(lfs)   ((lfs)->free.i)
+#define LOOKAHEAD_BUFFER(lfs) ((const void *)(lfs)->free.buffer)
+#endif
+
+static struct {
+    lfs_block_t start, next;
+    uint8_t *buffer;
+} lookahead;
+
+static void lookahead_save(void) {
+    lookahead.start = LOOKAHEAD_START(&lfs);
+    lookahead.next = LOOKAHEAD_NEXT(&lfs);
+    memcpy(lookahead.buffer, LOOKAHEAD_BUFFER(&lfs), cfg.lookahead_size);
+}
+
+static int lookahead_scanned(void) {
+    return LOOKAHEAD_START(&lfs) != lookahead.start || LOOKAHEAD_NEXT(&lfs) < lookahead.next
+            || memcmp(lookahead.buffer, LOOKAHEAD_BUFFER(&lfs), cfg.lookahead_size);
+}
+
+static int mark_used(void *data, lfs_block_t block) {
+    if(block < cfg.block_count) ((uint8_t *)data)[block] = 1;
+    return 0;
+}
+
+/** Clear the data blocks of a file by following its CTZ skip-list in RAM, like esp_littlefs_map_file() */
+static void unmark_file(uint8_t *meta, const char *path) {
+    lfs_file_t file;
+
+    check(lfs_file_open(&lfs, &file, path, LFS_O_RDONLY), path);
+    if(!(file.flags & LFS_F_INLINE) && file.ctz.size > 0) {
+        lfs_off_t b = cfg.block_size - 2 * 4;
+        lfs_off_t size = file.ctz.size - 1;
+        lfs_off_t index = size / b;
+        if(index > 0) index = (size - 4 * (__builtin_popcount(index - 1) + 2)) / b;
+
+        for(lfs_block_t head = file.ctz.head; head < cfg.block_count; index--) {
+            const uint8_t *ptr = ram + head * cfg.block_size;
+            meta[head] = 0;
+            if(index == 0) break;
+            head = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+        }
+    }
+    lfs_file_close(&lfs, &file);
+}
+
+static void unmark_dir(uint8_t *meta, char *path, size_t len) {
+    struct lfs_info info;
+    lfs_dir_t dir;
+    int res;
+
+    check(lfs_dir_open(&lfs, &dir, len ? path : "/"), path);
+    while((res = lfs_dir_read(&lfs, &dir, &info)) > 0) {
+        if(!strcmp(info.name, ".") || !strcmp(info.name, "..")) continue;
+        snprintf(path + len, 64 - len, "/%s", info.name);
+        if(info.type == LFS_TYPE_DIR) unmark_dir(meta, path, strlen(path));
+        else unmark_file(meta, path);
+        path[len] = '\0';
+    }
+    check(res, "readdir");
+    lfs_dir_close(&lfs, &dir);
+}
+
+/**
+ * @brief Flag the metadata blocks: everything in use that is no file's data.
+ * @return How many there are
+ */
+static uint32_t map_metadata(uint8_t *meta) {
+    flash_counts_t saved = counts;
+    char path[64] = "";
+    uint32_t n = 0;
+
+    memset(meta, 0, cfg.block_count);
+    check(lfs_fs_traverse(&lfs, mark_used, meta), "traverse");
+    unmark_dir(meta, path, 0);
+    /* Not part of any measurement */
+    counts = saved;
+    for(lfs_block_t b=0; b < cfg.block_count; b++) n += meta[b];
+    return n;
+}
+
+static const unsigned fill_levels[] = {50, 75, 90, 95, 99};
+#define FILL_LEVELS   (sizeof(fill_levels) / sizeof(fill_levels[0]))
+#define FILL_DIRS     8
+#define FILL_PROBES   64
+#define FILL_MAX_FILES 4096
+#define FILL_PROBE_MAX (8 * 1024)    /* Largest file a probe rewrites */
+
+/** Mostly small configs and logs, some medium blobs, a few large ones */
+static uint32_t fill_size(void) {
+    int r = rand() % 100;
+    if(r < 60) return 32 + rand() % 224;
+    if(r < 90) return 1024 + rand() % (7 * 1024);
+    return 16 * 1024 + rand() % (48 * 1024);
+}
+
+typedef struct {
+    unsigned target;
+    double reached;
+    double ops_per_s;
+    uint32_t rewrite_p99;
+    uint32_t alloc_scans;
+    uint32_t compactions;
+} fill_level_t;
+
+static double fill_used(void) {
+    lfs_ssize_t used;
+    FS_CALL(used, lfs_fs_size(&lfs));
+    check(used, "fs_size");
+    return 100.0 * used / cfg.block_count;
+}
+
+static void bench_fill(void) {
+    static struct { char path[24]; uint32_t size; } files[FILL_MAX_FILES];
+    fill_level_t levels[FILL_LEVELS];
+    uint8_t *meta_before = malloc(cfg.block_count), *meta_after = malloc(cfg.block_count);
+    uint32_t *erases = malloc(cfg.block_count * sizeof(*erases));
+    uint32_t nfiles = 0, cap = UINT32_MAX;
+    char path[32];
+    int degraded = -1;
+
+    lookahead.buffer = malloc(cfg.lookahead_size);
+    if(!meta_before || !meta_after || !erases || !lookahead.buffer) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    fresh_fs();
+    for(int d=0; d < FILL_DIRS; d++) {
+        snprintf(path, sizeof(path), "/d%d", d);
+        check(lfs_mkdir(&lfs, path), path);
+    }
+
+    for(size_t level=0; level < FILL_LEVELS; level++) {
+        lat_t lat[2] = {{.op = "rewrite"}, {.op = "create"}};
+        uint32_t nospc = 0, scans = 0, compactions = 0, meta;
+        uint64_t fill_us = now_us();
+        result_t r;
+
+        /* Fill up to the level, halving the largest size each time the space runs out */
+        while(fill_used() < fill_levels[level] && cap >= 32 && nfiles < FILL_MAX_FILES) {
+            uint32_t size = fill_size();
+            if(size > cap) size = cap;
+            snprintf(files[nfiles].path, sizeof(files[nfiles].path), "/d%d/f%05u",
+                    (int)(nfiles % FILL_DIRS), (unsigned)nfiles);
+            int res = put_file(files[nfiles].path, size, 4096);
+            if(res == LFS_ERR_NOSPC) {
+                lfs_remove(&lfs, files[nfiles].path);
+                cap = size / 2;
+                continue;
+            }
+            check(res, files[nfiles].path);
+            files[nfiles++].size = size;
+        }
+        fill_us = now_us() - fill_us;
+
+        /* Probe at this level with rewrites in place and short-lived files, which keep it level */
+        meta = map_metadata(meta_before);
+        memcpy(erases, block_erases, cfg.block_count * sizeof(*erases));
+        result_begin(&r, "fill", lat, 2, "\"target_pct\": %u", fill_levels[level]);
+        for(int i=0; i < FILL_PROBES; i++) {
+            uint64_t t0;
+            int res;
+
+            lookahead_save();
+            t0 = now_us();
+            if(i % 2 == 0) {
+                uint32_t f = rand() % nfiles;
+                for(int tries=0; files[f].size > FILL_PROBE_MAX && tries < 16; tries++) f = rand() % nfiles;
+                /* Rewriting a large file needs as much free space again; shrink it instead */
+                if(files[f].size > FILL_PROBE_MAX) files[f].size = FILL_PROBE_MAX;
+                res = put_file(files[f].path, files[f].size, 4096);
+                r.bytes += files[f].size;
+            }
+            else {
+                res = put_file("/probe.tmp", 512, 512);
+                if(res >= 0) FS_CALL(res, lfs_remove(&lfs, "/probe.tmp"));
+                else lfs_remove(&lfs, "/probe.tmp");
+                r.bytes += 512;
+            }
+            if(res == LFS_ERR_NOSPC) nospc++;
+            else check(res, "probe");
+            lat_add(&lat[i % 2], now_us() - t0);
+            scans += lookahead_scanned();
+            r.ops++;
+        }
+        result_end(&r);
+
+        /* Erases of blocks that held metadata before or after were compactions */
+        map_metadata(meta_after);
+        for(lfs_block_t b=0; b < cfg.block_count; b++) {
+            if(meta_before[b] || meta_after[b]) compactions += block_erases[b] - erases[b];
+        }
+
+        levels[level] = (fill_level_t){
+            .target = fill_levels[level],
+            .reached = fill_used(),
+            .ops_per_s = r.us ? r.ops * 1e6 / r.us : 0,
+            .rewrite_p99 = lat_pct(&lat[0], 99),
+            .alloc_scans = scans,
+            .compactions = compactions,
+        };
+        result_extra(&r, "\"reached_pct\": %.1f, \"files\": %u, \"fill_us\": %llu, \"alloc_scans\": %u, "
+                "\"compactions\": %u, \"metadata_blocks\": %u, \"nospc\": %u",
+                levels[level].reached, (unsigned)nfiles, (unsigned long long)fill_us,
+                (unsigned)scans, (unsigned)compactions, (unsigned)meta, (unsigned)nospc);
+        result_emit(&r);
+    }
+
+    /* Degraded: p99 of rewrites doubled or throughput halved against the first level */
+    fprintf(out, ",\n    {\"scenario\": \"fill_summary\", \"baseline_pct\": %u, \"levels\": [", levels[0].target);
+    fprintf(stderr, "  %8s %8s %12s %12s %12s %12s\n", "target", "reached", "p99 x", "ops/s x", "scans", "compactions");
+    for(size_t i=0; i < FILL_LEVELS; i++) {
+        double p99_x = levels[0].rewrite_p99 ? (double)levels[i].rewrite_p99 / levels[0].rewrite_p99 : 0;
+        double ops_x = levels[0].ops_per_s > 0 ? levels[i].ops_per_s / levels[0].ops_per_s : 0;
+
+        if(degraded < 0 && (p99_x > 2.0 || (ops_x > 0 && ops_x < 0.5))) degraded = levels[i].target;
+        fprintf(out, "%s\n      {\"target_pct\": %u, \"reached_pct\": %.1f, \"rewrite_p99_x\": %.2f, "
+                "\"ops_per_s_x\": %.2f, \"alloc_scans\": %u, \"compactions\": %u}", i ? "," : "",
+                levels[i].target, levels[i].reached, p99_x, ops_x,
+                (unsigned)levels[i].alloc_scans, (unsigned)levels[i].compactions);
+        fprintf(stderr, "  %7u%% %7.1f%% %12.2f %12.2f %12u %12u\n", levels[i].target, levels[i].reached,
+                p99_x, ops_x, (unsigned)levels[i].alloc_scans, (unsigned)levels[i].compactions);
+    }
+    if(degraded < 0) fprintf(out, "],\n     \"degrades_at_pct\": null}");
+    else fprintf(out, "],\n     \"degrades_at_pct\": %d}", degraded);
+    if(degraded < 0) fprintf(stderr, "  no degradation up to %u%%\n", levels[FILL_LEVELS - 1].target);
+    else fprintf(stderr, "  degrades at %d%%\n", degraded);
+    results++;
+
+    lfs_unmount(&lfs);
+    free(lookahead.buffer);
+    free(erases);
+    free(meta_after);
+    free(meta_before);
+}
+
+/*** Power loss ***/
+
+/*
+ * Orphans and a pending move left for the first write to repair, from
+ * littlefs' global state. lfs_gstate_t is internal, but its tag layout is
+ * the same across v2.
+ */
+#define GSTATE_ORPHANS(lfs) ((lfs)->gstate.tag & 0x1ff)
+#define GSTATE_MOVE(lfs)    (((lfs)->gstate.tag & 0x70000000) != 0)
+
+static const unsigned powerloss_levels[] = {25, 50, 75, 90};
+#define POWERLOSS_CUTS  256       /* Per level and cut kind */
+#define POWERLOSS_STEPS 16
+
+/** Flash time the traffic since "since" would take on the "nor" model */
+static uint64_t modeled_us(const flash_counts_t *since) {
+    const flash_model_t *m = &flash_models[1];
+    return ((counts.read_bytes - since->read_bytes) * m->read_ns_per_byte
+            + (counts.prog_bytes - since->prog_bytes) * m->prog_ns_per_byte) / 1000
+            + (uint64_t)(counts.erases - since->erases) * m->erase_us;
+}
+
+/** Work to cut the power in: creates, synced appends, renames, mkdirs and removes */
+static int powerloss_work(void) {
+    unsigned seed = 7;
+    char from[24], to[24];
+    lfs_file_t log;
+    int res, err;
+
+    FS_CALL(res, lfs_file_open(&lfs, &log, "/pl.log", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND));
+    if(res < 0) return res;
+    for(int i=0; i < POWERLOSS_STEPS && res >= 0; i++) {
+        snprintf(to, sizeof(to), "/pl%d", i);
+        res = put_file(to, 64 + rand_r(&seed) % 6000, 1024);
+        if(res >= 0) FS_CALL(res, lfs_file_write(&lfs, &log, pattern, 64));
+        if(res >= 0) FS_CALL(res, lfs_file_sync(&lfs, &log));
+        if(res >= 0) {
+            snprintf(to, sizeof(to), "/pld%d", i);
+            FS_CALL(res, lfs_mkdir(&lfs, to));
+        }
+        if(res >= 0 && i >= 1) {
+            snprintf(from, sizeof(from), "/pld%d", i - 1);
+            FS_CALL(res, lfs_remove(&lfs, from));
+        }
+        if(res >= 0 && i >= 2) {
+            snprintf(from, sizeof(from), "/pl%d", i - 2);
+            snprintf(to, sizeof(to), "/old%d", i - 2);
+            FS_CALL(res, lfs_rename(&lfs, from, to));
+        }
+        if(res >= 0 && i >= 4) {
+            snprintf(from, sizeof(from), "/old%d", i - 4);
+            FS_CALL(res, lfs_remove(&lfs, from));
+        }
+    }
+    FS_CALL(err, lfs_file_close(&lfs, &log));
+    return res < 0 ? res : err;
+}
+
+static void bench_powerloss(void) {
+    const flash_model_t *saved = flash;
+    size_t size = (size_t)cfg.block_size * cfg.block_count;
+    uint8_t *image = malloc(size);
+    char path[24];
+
+    if(image == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    /* Thousands of runs: model the flash time from the traffic instead of waiting for it */
+    flash = &flash_models[0];
+    for(size_t level=0; level < sizeof(powerloss_levels) / sizeof(powerloss_levels[0]); level++) {
+        flash_counts_t before;
+        uint32_t writes;
+
+        fresh_fs();
+        for(uint32_t i=0; fill_used() < powerloss_levels[level]; i++) {
+            uint32_t n = fill_size();
+            snprintf(path, sizeof(path), "/f%05u", (unsigned)i);
+            check(put_file(path, n < 16384 ? n : 16384, 4096), path);
+        }
+        lfs_unmount(&lfs);
+        memcpy(image, ram, size);
+
+        /* How many programs and erases there are to cut into */
+        check(lfs_mount(&lfs, &cfg), "mount");
+        before = counts;
+        check(powerloss_work(), "work");
+        writes = counts.progs - before.progs + counts.erases - before.erases;
+        lfs_unmount(&lfs);
+
+        for(int torn=0; torn < 2; torn++) {
+            lat_t lat[2] = {{.op = "mount"}, {.op = "first_write"}};
+            uint32_t orphans = 0, moves = 0, failed = 0, worst_cut = 0;
+            uint64_t worst_us = 0;
+            result_t r;
+
+            result_begin(&r, "powerloss", lat, 2, "\"fill_pct\": %u, \"torn\": %s, \"writes\": %u",
+                    powerloss_levels[level], torn ? "true" : "false", (unsigned)writes);
+            for(int i=0; i < POWERLOSS_CUTS; i++) {
+                uint32_t cut = 1 + (uint64_t)i * writes / POWERLOSS_CUTS;
+                uint64_t mount_us, write_us;
+                int res;
+
+                memcpy(ram, image, size);
+                check(lfs_mount(&lfs, &cfg), "mount");
+                power.countdown = cut;
+                power.torn = torn;
+                power.seed = i + 1;
+                powerloss_work();
+                lfs_unmount(&lfs);
+                memset(&power, 0, sizeof(power));
+
+                /* Power is back */
+                before = counts;
+                res = lfs_mount(&lfs, &cfg);
+                mount_us = modeled_us(&before);
+                if(res < 0) {
+                    failed++;
+                    continue;
+                }
+                orphans += GSTATE_ORPHANS(&lfs);
+                moves += GSTATE_MOVE(&lfs);
+
+                /* The first write repairs what the cut left and scans for free blocks */
+                before = counts;
+                res = put_file("/first.bin", cfg.block_size, cfg.block_size);
+                write_us = modeled_us(&before);
+                lfs_unmount(&lfs);
+                if(res < 0) {
+                    failed++;
+                    continue;
+                }
+                lat_add(&lat[0], mount_us);
+                lat_add(&lat[1], write_us);
+                if(mount_us + write_us > worst_us) {
+                    worst_us = mount_us + write_us;
+                    worst_cut = cut;
+                }
+                r.ops++;
+            }
+            result_end(&r);
+            result_extra(&r, "\"modeled\": true, \"orphans\": %u, \"pending_moves\": %u, "
+                    "\"failed\": %u, \"worst_us\": %llu, \"worst_cut\": %u",
+                    (unsigned)orphans, (unsigned)moves, (unsigned)failed,
+                    (unsigned long long)worst_us, (unsigned)worst_cut);
+            result_emit(&r);
+        }
+    }
+    flash = saved;
+    free(image);
+}
+
+/* One bit per step: the definition the table-driven CRCs must match */
+static uint32_t crc_bitwise(uint32_t crc, const void *buffer, size_t size) {
+    const uint8_t *p = buffer;
+
+    while(size--) {
+        crc ^= *p++;
+        for(int k=0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+    return crc;
+}
+
+static const size_t crc_sizes[] = {4, 32, 128, 512, 4096};
+#define CRC_BYTES     (64 * 1024 * 1024)
+
+static void bench_crc(void) {
+    static const struct {
+        const char *name;
+        uint32_t (*crc)(uint32_t crc, const void *buffer, size_t size);
+    } impls[] = {
+        {"bitwise", crc_bitwise},
+        {"lfs_crc", lfs_crc},
+        {"slice8", esp_littlefs_crc_slice8},
+    };
+
+    /* Every length up to 64 at every alignment, chained from a nonzero CRC */
+    for(size_t size=0; size <= 64; size++) {
+        for(size_t off=0; off < 8; off++) {
+            uint32_t expected = crc_bitwise(0x12345678, pattern + off, size);
+            for(size_t i=1; i < sizeof(impls) / sizeof(impls[0]); i++) {
+                if(impls[i].crc(0x12345678, pattern + off, size) != expected) {
+                    fprintf(stderr, "%s differs at size %zu offset %zu\n", impls[i].name, size, off);
+                    exit(1);
+                }
+            }
+        }
+    }
+
+    for(size_t i=0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        for(size_t s=0; s < sizeof(crc_sizes) / sizeof(crc_sizes[0]); s++) {
+            size_t size = crc_sizes[s];
+            /* The bitwise CRC is only the baseline; a slice of the bytes will do */
+            uint64_t iter = (i == 0 ? CRC_BYTES / 16 : CRC_BYTES) / size;
+            volatile uint32_t sink = 0;
+            result_t r;
+
+            result_begin(&r, "crc", NULL, 0, "\"impl\": \"%s\", \"size\": %zu", impls[i].name, size);
+            for(uint64_t n=0; n < iter; n++) sink = impls[i].crc(sink, pattern, size);
+            result_end(&r);
+            r.ops = iter;
+            r.bytes = iter * size;
+            result_extra(&r, "\"mb_per_s\": %.1f", r.us ? (double)r.bytes / r.us : 0);
+            result_emit(&r);
+        }
+    }
+}
+
+/* The two shapes of esp_littlefs' block device read, for bench_bd() */
+typedef struct {
+    int internal;                 /* Which backend, chosen per call */
+    size_t base;                  /* Where the internal partition starts, known at run time */
+    uint32_t reads;
+    uint64_t read_bytes;
+} bd_ctx_t;
+
+#define BD_FIXED_BLOCK_SIZE 4096
+#define BD_MAX_READ         1024
+#define BD_CALLS            (4 * 1024 * 1024)
+
+/* Geometry from the config, backend and size split decided on every call */
+static int bd_generic_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    if(size > BD_MAX_READ) {
+        for(lfs_size_t i=0; i < size; i += BD_MAX_READ) {
+            int res = bd_generic_read(c, block, off + i, (uint8_t *)buffer + i,
+                    size - i < BD_MAX_READ ? size - i : BD_MAX_READ);
+            if(res) return res;
+        }
+        return 0;
+    }
+    bd_ctx_t *ctx = c->context;
+    size_t part_off = (size_t)block * c->block_size + off;
+    ctx->reads++;
+    ctx->read_bytes += size;
+    if(ctx->internal) {
+        memcpy(buffer, ram + ctx->base + part_off, size);
+        return 0;
+    }
+    memcpy(buffer, ram + part_off, size);
+    return 0;
+}
+
+/* One backend's read, its geometry compile-time constants */
+static int bd_fixed_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    bd_ctx_t *ctx = c->context;
+    size_t part_off = (size_t)block * BD_FIXED_BLOCK_SIZE + off;
+    ctx->reads++;
+    ctx->read_bytes += size;
+    memcpy(buffer, ram + ctx->base + part_off, size);
+    return 0;
+}
+
+static void bench_bd(void) {
+    static const lfs_size_t sizes[] = {16, 256, 4096};
+    static uint8_t buf[4096];
+    static const struct {
+        const char *name;
+        int (*read)(const struct lfs_config *c, lfs_block_t block,
+                lfs_off_t off, void *buffer, lfs_size_t size);
+    } shapes[] = {
+        {"memcpy", NULL},
+        {"generic", bd_generic_read},
+        {"fixed", bd_fixed_read},
+    };
+    lfs_block_t blocks = (uint64_t)cfg.block_size * cfg.block_count / BD_FIXED_BLOCK_SIZE;
+    struct lfs_config c = cfg;
+    bd_ctx_t ctx = {.internal = 1};
+
+    c.context = &ctx;
+    c.block_size = BD_FIXED_BLOCK_SIZE;
+    for(size_t s=0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        double memcpy_ns = 0;
+        for(size_t i=0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+            /* Called through a pointer the compiler can't see through, as littlefs does */
+            int (* volatile read)(const struct lfs_config *, lfs_block_t, lfs_off_t, void *, lfs_size_t)
+                    = shapes[i].read;
+            lfs_size_t size = sizes[s];
+            uint64_t calls = BD_CALLS / (size / 16);
+            result_t r;
+
+            result_begin(&r, "bd", NULL, 0, "\"shape\": \"%s\", \"size\": %u", shapes[i].name, size);
+            for(uint64_t n=0; n < calls; n++) {
+                lfs_block_t block = n % blocks;
+                if(read) check(read(&c, block, 0, buf, size), "read");
+                else memcpy(buf, ram + (size_t)block * BD_FIXED_BLOCK_SIZE, size);
+            }
+            result_end(&r);
+            r.ops = calls;
+            r.bytes = calls * size;
+            double ns = r.us * 1000.0 / calls;
+            if(read == NULL) memcpy_ns = ns;
+            result_extra(&r, "\"ns_per_call\": %.2f, \"overhead_ns\": %.2f", ns, ns - memcpy_ns);
+            result_emit(&r);
+        }
+    }
+}
+
+static const unsigned xfer_work_us[] = {0, 200, 1000};
+
+/* What the application does with each chunk, while transfers may run */
+static void xfer_work(unsigned us) {
+    flash_wait((uint64_t)us * 1000);
+}
+
+static void bench_xfer(void) {
+    for(int mode=0; mode < 2; mode++) {
+        for(size_t w=0; w < sizeof(xfer_work_us) / sizeof(xfer_work_us[0]); w++) {
+            unsigned work = xfer_work_us[w];
+            lat_t lat[1] = {{.op = "write"}};
+            result_t r;
+            lfs_file_t f;
+            int res;
+
+            fresh_fs();
+            if(mode) xfer_enable(1);
+            result_begin(&r, "xfer_write", lat, 1, "\"double_buffered\": %s, \"work_us\": %u, "
+                    "\"io_size\": %d, \"file_size\": %d", mode ? "true" : "false", work,
+                    XFER_BUF_SIZE, SEQ_FILE_SIZE);
+            FS_CALL(res, lfs_file_open(&lfs, &f, "/xfer.bin", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC));
+            check(res, "open");
+            for(size_t done=0; done < SEQ_FILE_SIZE; done += XFER_BUF_SIZE) {
+                xfer_work(work);
+                uint64_t t0 = now_us();
+                FS_CALL(res, lfs_file_write(&lfs, &f, pattern, XFER_BUF_SIZE));
+                check(res, "write");
+                lat_add(&lat[0], now_us() - t0);
+                r.ops++;
+                r.bytes += XFER_BUF_SIZE;
+            }
+            FS_CALL(res, lfs_file_close(&lfs, &f));
+            check(res, "close");
+            result_end(&r);
+            result_emit(&r);
+
+            lat[0].op = "read";
+            xfer.hits = xfer.misses = 0;
+            result_begin(&r, "xfer_read", lat, 1, "\"double_buffered\": %s, \"work_us\": %u, "
+                    "\"io_size\": %d, \"file_size\": %d", mode ? "true" : "false", work,
+                    XFER_BUF_SIZE, SEQ_FILE_SIZE);
+            FS_CALL(res, lfs_file_open(&lfs, &f, "/xfer.bin", LFS_O_RDONLY));
+            check(res, "open");
+            for(size_t done=0; done < SEQ_FILE_SIZE; done += XFER_BUF_SIZE) {
+                uint64_t t0 = now_us();
+                FS_CALL(res, lfs_file_read(&lfs, &f, pattern, XFER_BUF_SIZE));
+                check(res, "read");
+                lat_add(&lat[0], now_us() - t0);
+                xfer_work(work);
+                r.ops++;
+                r.bytes += res;
+            }
+            FS_CALL(res, lfs_file_close(&lfs, &f));
+            result_end(&r);
+            if(mode) result_extra(&r, "\"prefetch_hits\": %llu, \"prefetch_misses\": %llu",
+                    (unsigned long long)xfer.hits, (unsigned long long)xfer.misses);
+            result_emit(&r);
+            lfs_unmount(&lfs);
+            if(mode) xfer_enable(0);
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} scenarios[] = {
+    {"seq", bench_seq},
+    {"random", bench_random},
+    {"small_files", bench_small_files},
+    {"dir_list", bench_dir_list},
+    {"append_log", bench_append_log},
+    {"mixed", bench_mixed},
+    {"fill", bench_fill},
+    {"scaling", bench_scaling},
+    {"powerloss", bench_powerloss},
+    {"crc", bench_crc},
+    {"bd", bench_bd},
+    {"xfer", bench_xfer},
+};
+
+int main(int argc, char **argv) {
+    unsigned seed = 1;
+
+    for(int i=1; i < argc; i++) {
+        const char *opt = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+        long v = val ? strtol(val, NULL, 0) : 0;
+
+        if(val == NULL) {
+            fprintf(stderr, "%s needs a value\n", opt);
+            return 2;
+        }
+        i++;
+        if(!strcmp(opt, "--flash")) {
+            flash = NULL;
+            for(size_t m=0; m < sizeof(flash_models) / sizeof(flash_models[0]); m++) {
+                if(!strcmp(val, flash_models[m].name)) flash = &flash_models[m];
+            }
+            if(flash == NULL) {
+                fprintf(stderr, "unknown flash model %s\n", val);
+                return 2;
+            }
+        }
+        else if(!strcmp(opt, "--only")) only = val;
+        else if(!strcmp(opt, "--seed")) seed = v;
+        else if(!strcmp(opt, "--read")) cfg.read_size = v;
+        else if(!strcmp(opt, "--prog")) cfg.prog_size = v;
+        else if(!strcmp(opt, "--block-size")) cfg.block_size = v;
+        else if(!strcmp(opt, "--block-count")) cfg.block_count = v;
+        else if(!strcmp(opt, "--cache")) cfg.cache_size = v;
+        else if(!strcmp(opt, "--lookahead")) cfg.lookahead_size = v;
+        else if(!strcmp(opt, "--block-cycles")) cfg.block_cycles = v;
+        else {
+            fprintf(stderr, "unknown option %s\n", opt);
+            return 2;
+        }
+    }
+    cfg.read = bd_read;
+    cfg.prog = bd_prog;
+    cfg.erase = bd_erase;
+    cfg.sync = bd_sync;
+
+    ram = malloc((size_t)cfg.block_size * cfg.block_count);
+    block_erases = calloc(cfg.block_count, sizeof(*block_erases));
+    if(ram == NULL || block_erases == NULL) {
+        fprintf(stderr, "can't allocate %u blocks\n", cfg.block_count);
+        return 1;
+    }
+    srand(seed);
+    for(size_t i=0; i < sizeof(pattern); i++) pattern[i] = rand();
+
+    out = stdout;
+    fprintf(out, "{\"config\": {\"flash\": \"%s\", \"read_size\": %u, \"prog_size\": %u, "
+            "\"block_size\": %u, \"block_count\": %u, \"cache_size\": %u, \"lookahead_size\": %u, "
+            "\"block_cycles\": %d, \"seed\": %u, \"lfs_crc\": \"%s\"},\n \"results\": [",
+            flash->name, cfg.read_size, cfg.prog_size, cfg.block_size, cfg.block_count,
+            cfg.cache_size, cfg.lookahead_size, (int)cfg.block_cycles, seed, ESP_LITTLEFS_CRC_NAME);
+    for(size_t i=0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if(only && strcmp(only, scenarios[i].name)) continue;
+        fprintf(stderr, "%s\n", scenarios[i].name);
+        scenarios[i].run();
+    }
+    fprintf(out, "\n]}\n");
+
+    free(block_erases);
+    free(ram);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Render a block bitmap exported with esp_littlefs_block_bitmap().
+
+The bitmap holds 2 bits per block, block 0 in the low bits of the first
+byte: 0 free, 1 metadata, 2 file data.
+
+    python3 tools/block_map.py map.bin --blocks 128 [--width 64]
+"""
+
+import argparse
+import sys
+
+GLYPHS = {0: ".", 1: "M", 2: "#", 3: "?"}
+
+
+def blocks_of(data, count):
+    for block in range(count):
+        yield (data[block // 4] >> (block % 4 * 2)) & 3
+
+
+def free_runs(types):
+    runs, run = [], 0
+    for t in types + [2]:
+        if t == 0:
+            run += 1
+        elif run:
+            runs.append(run)
+            run = 0
+    return runs
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("bitmap", help="file written from esp_littlefs_block_bitmap()")
+    parser.add_argument("--blocks", type=int, help="block count (default: all of the file)")
+    parser.add_argument("--width", type=int, default=64, help="blocks per line")
+    args = parser.parse_args()
+
+    with open(args.bitmap, "rb") as f:
+        data = f.read()
+    count = args.blocks if args.blocks is not None else len(data) * 4
+    if count > len(data) * 4:
+        sys.exit("%s only holds %d blocks" % (args.bitmap, len(data) * 4))
+
+    types = list(blocks_of(data, count))
+    for start in range(0, count, args.width):
+        row = "".join(GLYPHS[t] for t in types[start:start + args.width])
+        print("%6d  %s" % (start, row))
+
+    runs = free_runs(types)
+    free = types.count(0)
+    print()
+    print("free %d  metadata %d  data %d  of %d blocks" % (free, types.count(1), types.count(2), count))
+    if free:
+        print("free runs %d, largest %d, fragmentation %.2f" % (len(runs), max(runs), 1 - max(runs) / free))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,265 @@
+/**
+ * @file replay.h
+ * @brief Replay the VFS calls of an esp_littlefs trace through littlefs on a RAM block device.
+ *
+ * Shared by the host tools that include it (trace_replay.c, tune.c); each
+ * is still built as a single file. Paths are only known by their hash, so
+ * each traced path becomes a file named after it in the root directory.
+ * Files the trace reads without having written are created, as large as
+ * the trace reads them, by create_preexisting().
+ */
+
+#ifndef REPLAY_H__
+#define REPLAY_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lfs.h"
+#include "esp_littlefs_trace.h"
+
+#define MAX_FDS   256
+#define MAX_PATHS 1024
+
+typedef struct {
+    uint32_t reads, progs, erases;
+    uint64_t read_bytes, prog_bytes, erase_bytes;
+    uint64_t us;
+} flash_counts_t;
+
+static uint8_t *ram;
+static flash_counts_t replayed;
+
+static int ram_read(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, void *buffer, lfs_size_t size) {
+    memcpy(buffer, ram + block * c->block_size + off, size);
+    replayed.reads++;
+    replayed.read_bytes += size;
+    return 0;
+}
+
+static int ram_prog(const struct lfs_config *c, lfs_block_t block,
+        lfs_off_t off, const void *buffer, lfs_size_t size) {
+    memcpy(ram + block * c->block_size + off, buffer, size);
+    replayed.progs++;
+    replayed.prog_bytes += size;
+    return 0;
+}
+
+static int ram_erase(const struct lfs_config *c, lfs_block_t block) {
+    memset(ram + block * c->block_size, 0xff, c->block_size);
+    replayed.erases++;
+    replayed.erase_bytes += c->block_size;
+    return 0;
+}
+
+static int ram_sync(const struct lfs_config *c) {
+    return 0;
+}
+
+/**
+ * @brief Read a trace written as esp_littlefs_trace_header() followed by records.
+ * @return The records, to be freed, or NULL after printing why not
+ */
+static esp_littlefs_trace_rec_t * load_trace(const char *path, esp_littlefs_trace_hdr_t *hdr, size_t *n) {
+    esp_littlefs_trace_rec_t *recs = NULL;
+    size_t cap = 0;
+    FILE *f;
+
+    *n = 0;
+    f = fopen(path, "rb");
+    if(f == NULL || fread(hdr, sizeof(*hdr), 1, f) != 1) {
+        fprintf(stderr, "can't read %s\n", path);
+        if(f) fclose(f);
+        return NULL;
+    }
+    if(hdr->magic != ESP_LITTLEFS_TRACE_MAGIC || hdr->version != ESP_LITTLEFS_TRACE_VERSION
+            || hdr->rec_size != sizeof(esp_littlefs_trace_rec_t)) {
+        fprintf(stderr, "%s is not a version %d trace\n", path, ESP_LITTLEFS_TRACE_VERSION);
+        fclose(f);
+        return NULL;
+    }
+    for(;;) {
+        if(*n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            recs = realloc(recs, cap * sizeof(*recs));
+        }
+        if(fread(&recs[*n], sizeof(*recs), 1, f) != 1) break;
+        (*n)++;
+    }
+    fclose(f);
+    if(hdr->dropped) fprintf(stderr, "warning: %u records were dropped on the device\n", hdr->dropped);
+    return recs;
+}
+
+/* Size each traced path must have for the trace's reads to succeed */
+static struct {
+    uint32_t hash;
+    uint32_t size;
+    int written;
+} paths[MAX_PATHS];
+static size_t path_count;
+
+static size_t path_index(uint32_t hash) {
+    for(size_t i=0; i < path_count; i++) {
+        if(paths[i].hash == hash) return i;
+    }
+    if(path_count == MAX_PATHS) {
+        fprintf(stderr, "more than %d paths\n", MAX_PATHS);
+        exit(1);
+    }
+    paths[path_count].hash = hash;
+    return path_count++;
+}
+
+static void path_name(char *name, uint32_t hash) {
+    sprintf(name, "/%08x", hash);
+}
+
+/**
+ * @brief Follow positions through the trace to find how large each file
+ *        it reads must already be.
+ */
+static void find_preexisting(const esp_littlefs_trace_rec_t *recs, size_t n) {
+    struct { long path; uint32_t pos; } fds[MAX_FDS];
+
+    for(int i=0; i < MAX_FDS; i++) fds[i].path = -1;
+    for(size_t i=0; i < n; i++) {
+        const esp_littlefs_trace_rec_t *r = &recs[i];
+        int32_t res = (int32_t)r->arg2;
+        uint32_t fd = r->arg0;
+
+        if(r->type != ESP_LITTLEFS_TRACE_VFS) continue;
+        switch(r->op) {
+            case ESP_LITTLEFS_OP_OPEN:
+                if(res < 0 || res >= MAX_FDS) break;
+                fds[res].path = path_index(r->arg0);
+                fds[res].pos = 0;
+                if(r->arg1 & (LFS_O_CREAT | LFS_O_TRUNC)) paths[fds[res].path].written = 1;
+                break;
+            case ESP_LITTLEFS_OP_READ:
+                if(fd >= MAX_FDS || fds[fd].path < 0 || res <= 0) break;
+                fds[fd].pos += res;
+                if(!paths[fds[fd].path].written && fds[fd].pos > paths[fds[fd].path].size)
+                    paths[fds[fd].path].size = fds[fd].pos;
+                break;
+            case ESP_LITTLEFS_OP_WRITE:
+                if(fd >= MAX_FDS || fds[fd].path < 0 || res <= 0) break;
+                fds[fd].pos += res;
+                paths[fds[fd].path].written = 1;
+                break;
+            case ESP_LITTLEFS_OP_LSEEK:
+                if(fd >= MAX_FDS || fds[fd].path < 0 || res < 0) break;
+                fds[fd].pos = res;
+                break;
+            case ESP_LITTLEFS_OP_CLOSE:
+                if(fd < MAX_FDS) fds[fd].path = -1;
+                break;
+        }
+    }
+}
+
+static int create_preexisting(lfs_t *lfs) {
+    static uint8_t chunk[4096];
+    char name[16];
+    lfs_file_t file;
+
+    memset(chunk, 0x5a, sizeof(chunk));
+    for(size_t i=0; i < path_count; i++) {
+        if(paths[i].size == 0) continue;
+        path_name(name, paths[i].hash);
+        int res = lfs_file_open(lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+        if(res < 0) return res;
+        for(uint32_t done=0; done < paths[i].size; done += sizeof(chunk)) {
+            uint32_t n = paths[i].size - done;
+            res = lfs_file_write(lfs, &file, chunk, n < sizeof(chunk) ? n : sizeof(chunk));
+            if(res < 0) return res;
+        }
+        res = lfs_file_close(lfs, &file);
+        if(res < 0) return res;
+    }
+    return 0;
+}
+
+/** Called after each replayed VFS call, with the number of files then open */
+typedef void (*replay_cb_t)(const esp_littlefs_trace_rec_t *r, int open_files, void *arg);
+
+static void replay(lfs_t *lfs, const esp_littlefs_trace_rec_t *recs, size_t n,
+        replay_cb_t cb, void *arg) {
+    static lfs_file_t files[MAX_FDS];
+    static uint8_t open[MAX_FDS];
+    static uint8_t data[64 * 1024];
+    char name[16], name2[16];
+    struct lfs_info info;
+    int open_files = 0;
+
+    memset(data, 0xa5, sizeof(data));
+    for(size_t i=0; i < n; i++) {
+        const esp_littlefs_trace_rec_t *r = &recs[i];
+        int32_t res = (int32_t)r->arg2;
+        uint32_t fd = r->arg0;
+        uint32_t size;
+
+        if(r->type != ESP_LITTLEFS_TRACE_VFS) continue;
+        /* Calls that failed on the device are not replayed, except lookups of missing paths */
+        if(res < 0 && r->op != ESP_LITTLEFS_OP_STAT) continue;
+        path_name(name, r->arg0);
+        switch(r->op) {
+            case ESP_LITTLEFS_OP_OPEN:
+                if(res >= MAX_FDS) break;
+                if(open[res]) {
+                    lfs_file_close(lfs, &files[res]);
+                    open_files--;
+                }
+                open[res] = lfs_file_open(lfs, &files[res], name, r->arg1) >= 0;
+                open_files += open[res];
+                break;
+            case ESP_LITTLEFS_OP_READ:
+            case ESP_LITTLEFS_OP_WRITE:
+                if(fd >= MAX_FDS || !open[fd]) break;
+                for(uint32_t done=0; done < (uint32_t)res; done += size) {
+                    size = res - done < sizeof(data) ? res - done : sizeof(data);
+                    if(r->op == ESP_LITTLEFS_OP_READ) lfs_file_read(lfs, &files[fd], data, size);
+                    else lfs_file_write(lfs, &files[fd], data, size);
+                }
+                break;
+            case ESP_LITTLEFS_OP_LSEEK:
+                if(fd < MAX_FDS && open[fd]) lfs_file_seek(lfs, &files[fd], res, LFS_SEEK_SET);
+                break;
+            case ESP_LITTLEFS_OP_FSYNC:
+                if(fd < MAX_FDS && open[fd]) lfs_file_sync(lfs, &files[fd]);
+                break;
+            case ESP_LITTLEFS_OP_CLOSE:
+                if(fd < MAX_FDS && open[fd]) {
+                    lfs_file_close(lfs, &files[fd]);
+                    open_files--;
+                }
+                if(fd < MAX_FDS) open[fd] = 0;
+                break;
+            case ESP_LITTLEFS_OP_STAT:
+                lfs_stat(lfs, name, &info);
+                break;
+            case ESP_LITTLEFS_OP_UNLINK:
+            case ESP_LITTLEFS_OP_RMDIR:
+                lfs_remove(lfs, name);
+                break;
+            case ESP_LITTLEFS_OP_RENAME:
+                path_name(name2, r->arg1);
+                lfs_rename(lfs, name, name2);
+                break;
+            case ESP_LITTLEFS_OP_MKDIR:
+                lfs_mkdir(lfs, name);
+                break;
+            default:
+                /* Directory handles aren't traced */
+                break;
+        }
+        if(cb) cb(r, open_files, arg);
+    }
+    for(int i=0; i < MAX_FDS; i++) {
+        if(open[i]) lfs_file_close(lfs, &files[i]);
+        open[i] = 0;
+    }
+}
+
+#endif
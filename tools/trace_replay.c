@@ -0,0 +1,127 @@
+/**
+ * @file trace_replay.c
+ * @brief Replay an esp_littlefs trace on the host against a RAM block device.
+ *
+ * Runs the VFS calls of a trace recorded with esp_littlefs_trace_start()
+ * through littlefs with the traced configuration, or with the sizes given
+ * on the command line, and compares the flash traffic with what the device
+ * recorded. Build from the repository root with
+ *
+ *   cc -O2 -Iinclude -Isrc/littlefs tools/trace_replay.c \
+ *      src/littlefs/lfs.c src/littlefs/lfs_util.c -o trace_replay
+ *
+ * and run
+ *
+ *   ./trace_replay trace.bin [--read N] [--prog N] [--block-size N]
+ *                  [--block-count N] [--cache N] [--lookahead N] [--block-cycles N]
+ *
+ * Paths are only known by their hash, so each traced path becomes a file
+ * named after it in the root directory (see replay.h). Files the trace
+ * reads without having written are created before counting starts.
+ */
+
+#include "replay.h"
+
+static void print_counts(const char *what, const flash_counts_t *c) {
+    printf("%-9s reads %8u (%10llu B)  progs %8u (%10llu B)  erases %6u (%10llu B)",
+            what, c->reads, (unsigned long long)c->read_bytes,
+            c->progs, (unsigned long long)c->prog_bytes,
+            c->erases, (unsigned long long)c->erase_bytes);
+    if(c->us) printf("  %llu us", (unsigned long long)c->us);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    esp_littlefs_trace_hdr_t hdr;
+    esp_littlefs_trace_rec_t *recs;
+    flash_counts_t recorded = {0};
+    struct lfs_config cfg = {0};
+    lfs_t lfs;
+    size_t n;
+    int res;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s trace.bin [--read N] [--prog N] [--block-size N] [--block-count N]\n"
+                        "       [--cache N] [--lookahead N] [--block-cycles N]\n", argv[0]);
+        return 2;
+    }
+    recs = load_trace(argv[1], &hdr, &n);
+    if(recs == NULL) return 1;
+
+    cfg.read_size = hdr.read_size;
+    cfg.prog_size = hdr.prog_size;
+    cfg.block_size = hdr.block_size;
+    cfg.block_count = hdr.block_count;
+    cfg.cache_size = hdr.cache_size;
+    cfg.lookahead_size = hdr.lookahead_size;
+    cfg.block_cycles = hdr.block_cycles;
+    for(int i=2; i + 1 < argc; i += 2) {
+        long v = strtol(argv[i + 1], NULL, 0);
+        if(!strcmp(argv[i], "--read")) cfg.read_size = v;
+        else if(!strcmp(argv[i], "--prog")) cfg.prog_size = v;
+        else if(!strcmp(argv[i], "--block-size")) cfg.block_size = v;
+        else if(!strcmp(argv[i], "--block-count")) cfg.block_count = v;
+        else if(!strcmp(argv[i], "--cache")) cfg.cache_size = v;
+        else if(!strcmp(argv[i], "--lookahead")) cfg.lookahead_size = v;
+        else if(!strcmp(argv[i], "--block-cycles")) cfg.block_cycles = v;
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    cfg.read = ram_read;
+    cfg.prog = ram_prog;
+    cfg.erase = ram_erase;
+    cfg.sync = ram_sync;
+
+    for(size_t i=0; i < n; i++) {
+        const esp_littlefs_trace_rec_t *r = &recs[i];
+        switch(r->type) {
+            case ESP_LITTLEFS_TRACE_READ:
+                recorded.reads++;
+                recorded.read_bytes += r->arg2;
+                recorded.us += r->duration;
+                break;
+            case ESP_LITTLEFS_TRACE_PROG:
+                recorded.progs++;
+                recorded.prog_bytes += r->arg2;
+                recorded.us += r->duration;
+                break;
+            case ESP_LITTLEFS_TRACE_ERASE:
+                recorded.erases++;
+                recorded.erase_bytes += r->arg2;
+                recorded.us += r->duration;
+                break;
+        }
+    }
+
+    ram = malloc((size_t)cfg.block_size * cfg.block_count);
+    if(ram == NULL) {
+        fprintf(stderr, "can't allocate %u blocks\n", cfg.block_count);
+        return 1;
+    }
+    memset(ram, 0xff, (size_t)cfg.block_size * cfg.block_count);
+
+    find_preexisting(recs, n);
+    res = lfs_format(&lfs, &cfg);
+    if(res >= 0) res = lfs_mount(&lfs, &cfg);
+    if(res >= 0) res = create_preexisting(&lfs);
+    if(res < 0) {
+        fprintf(stderr, "can't set up the filesystem: %d\n", res);
+        return 1;
+    }
+
+    memset(&replayed, 0, sizeof(replayed));
+    replay(&lfs, recs, n, NULL, NULL);
+    lfs_unmount(&lfs);
+
+    printf("%zu records; read %u prog %u block %u x %u cache %u lookahead %u\n", n,
+            cfg.read_size, cfg.prog_size, cfg.block_size, cfg.block_count,
+            cfg.cache_size, cfg.lookahead_size);
+    print_counts("recorded", &recorded);
+    print_counts("replayed", &replayed);
+
+    free(ram);
+    free(recs);
+    return 0;
+}
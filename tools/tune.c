@@ -0,0 +1,300 @@
+/**
+ * @file tune.c
+ * @brief Sweep littlefs cache and size settings over a workload and recommend some.
+ *
+ * Replays a trace recorded with esp_littlefs_trace_start(), or a small
+ * built-in mix of config rewrites, log appends and asset reads, once for
+ * every valid combination of read_size, prog_size, cache_size,
+ * lookahead_size and block_cycles on the partition's own geometry. Flash
+ * time is modeled from the replayed traffic (SPI NOR: a fixed cost per
+ * transaction plus a cost per byte or block), so results don't depend on
+ * the host. Build from the repository root with
+ *
+ *   cc -O2 -Iinclude -Isrc/littlefs tools/tune.c \
+ *      src/littlefs/lfs.c src/littlefs/lfs_util.c -o tune
+ *
+ * and run once per partition
+ *
+ *   ./tune trace.bin|--synthetic [--block-size N] [--block-count N] [--min-read N]
+ *          [--min-prog N] [--open-files N] [--target PCT] [--all]
+ *
+ * For each combination it reports throughput, p99 and worst per-call flash
+ * time, erases and the RAM littlefs needs: a read and a program cache, one
+ * cache per open file and the lookahead bitmap. It prints the combinations
+ * that no other beats on all of throughput, p99 and RAM, and recommends the
+ * smallest of those within --target percent (default 90) of the best
+ * throughput.
+ */
+
+#include "replay.h"
+
+/* SPI NOR at 40 MHz QIO through the ESP-IDF flash driver */
+#define READ_OP_US      20
+#define READ_NS_PER_B   50
+#define PROG_OP_US      20
+#define PROG_NS_PER_B   2700
+#define ERASE_US        45000
+
+#define MAX_IO          1024    /* Largest read and prog size tried */
+#define MAX_CACHE       4096
+#define MAX_CALLS       (1 << 20)
+
+typedef struct {
+    struct lfs_config cfg;
+    double kb_per_s;
+    uint32_t p99_us, max_us;
+    uint32_t erases;
+    uint32_t ram;
+    int pareto;
+} combo_t;
+
+/* Per-call flash time of the current run */
+static struct {
+    uint64_t last_us;
+    uint32_t *us;
+    size_t n;
+    uint64_t user_bytes;
+    int max_open;
+} run;
+
+static uint64_t flash_us(const flash_counts_t *c) {
+    return (uint64_t)c->reads * READ_OP_US + c->read_bytes * READ_NS_PER_B / 1000
+            + (uint64_t)c->progs * PROG_OP_US + c->prog_bytes * PROG_NS_PER_B / 1000
+            + (uint64_t)c->erases * ERASE_US;
+}
+
+static void on_call(const esp_littlefs_trace_rec_t *r, int open_files, void *arg) {
+    uint64_t now = flash_us(&replayed);
+
+    if(run.n < MAX_CALLS) run.us[run.n++] = now - run.last_us;
+    run.last_us = now;
+    if(r->op == ESP_LITTLEFS_OP_READ || r->op == ESP_LITTLEFS_OP_WRITE) run.user_bytes += r->arg2;
+    if(open_files > run.max_open) run.max_open = open_files;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*** Built-in workload ***/
+
+static esp_littlefs_trace_rec_t *synth;
+static size_t synth_n, synth_cap;
+
+static void synth_call(uint8_t op, uint32_t arg0, uint32_t arg1, uint32_t ret) {
+    if(synth_n == synth_cap) {
+        synth_cap = synth_cap ? synth_cap * 2 : 1024;
+        synth = realloc(synth, synth_cap * sizeof(*synth));
+    }
+    synth[synth_n++] = (esp_littlefs_trace_rec_t){
+        .type = ESP_LITTLEFS_TRACE_VFS, .op = op, .arg0 = arg0, .arg1 = arg1, .arg2 = ret,
+    };
+}
+
+/** Rewrite a small config, append to a log with an fsync every 8 records, read an asset */
+static void synthesize(void) {
+    const uint32_t config = 0xc0f1, log = 0x1095, assets[4] = {0xa551, 0xa552, 0xa553, 0xa554};
+    const uint32_t asset_sizes[4] = {512, 3000, 12000, 40000};
+
+    for(int i=0; i < 4; i++) {
+        synth_call(ESP_LITTLEFS_OP_OPEN, assets[i], LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, 0);
+        synth_call(ESP_LITTLEFS_OP_WRITE, 0, asset_sizes[i], asset_sizes[i]);
+        synth_call(ESP_LITTLEFS_OP_CLOSE, 0, 0, 0);
+    }
+    synth_call(ESP_LITTLEFS_OP_OPEN, log, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND, 1);
+    for(int i=0; i < 400; i++) {
+        synth_call(ESP_LITTLEFS_OP_WRITE, 1, 48, 48);
+        if(i % 8 == 7) synth_call(ESP_LITTLEFS_OP_FSYNC, 1, 0, 0);
+        if(i % 40 == 0) {
+            synth_call(ESP_LITTLEFS_OP_OPEN, config, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, 0);
+            synth_call(ESP_LITTLEFS_OP_WRITE, 0, 300, 300);
+            synth_call(ESP_LITTLEFS_OP_CLOSE, 0, 0, 0);
+        }
+        if(i % 20 == 0) {
+            int a = i / 20 % 4;
+            synth_call(ESP_LITTLEFS_OP_STAT, assets[a], 0, 0);
+            synth_call(ESP_LITTLEFS_OP_OPEN, assets[a], LFS_O_RDONLY, 0);
+            synth_call(ESP_LITTLEFS_OP_READ, 0, asset_sizes[a], asset_sizes[a]);
+            synth_call(ESP_LITTLEFS_OP_CLOSE, 0, 0, 0);
+        }
+    }
+    synth_call(ESP_LITTLEFS_OP_CLOSE, 1, 0, 0);
+}
+
+/*** Sweep ***/
+
+static int run_combo(combo_t *c, const esp_littlefs_trace_rec_t *recs, size_t n, int open_files) {
+    lfs_t lfs;
+    int res;
+
+    memset(ram, 0xff, (size_t)c->cfg.block_size * c->cfg.block_count);
+    res = lfs_format(&lfs, &c->cfg);
+    if(res >= 0) res = lfs_mount(&lfs, &c->cfg);
+    if(res >= 0) res = create_preexisting(&lfs);
+    if(res < 0) return res;
+
+    memset(&replayed, 0, sizeof(replayed));
+    run.last_us = 0;
+    run.n = 0;
+    run.user_bytes = 0;
+    run.max_open = 0;
+    replay(&lfs, recs, n, on_call, NULL);
+    lfs_unmount(&lfs);
+
+    uint64_t us = flash_us(&replayed);
+    qsort(run.us, run.n, sizeof(*run.us), cmp_u32);
+    c->kb_per_s = us ? run.user_bytes / 1024.0 * 1e6 / us : 0;
+    c->p99_us = run.n ? run.us[(run.n * 99 + 99) / 100 - 1] : 0;
+    c->max_us = run.n ? run.us[run.n - 1] : 0;
+    c->erases = replayed.erases;
+    if(open_files < 0) open_files = run.max_open;
+    c->ram = c->cfg.cache_size * (2 + open_files) + c->cfg.lookahead_size;
+    return 0;
+}
+
+/** a is at least as good as b everywhere and better somewhere */
+static int dominates(const combo_t *a, const combo_t *b) {
+    return a->kb_per_s >= b->kb_per_s && a->p99_us <= b->p99_us && a->ram <= b->ram
+            && (a->kb_per_s > b->kb_per_s || a->p99_us < b->p99_us || a->ram < b->ram);
+}
+
+static void print_combo(const combo_t *c) {
+    printf("%5u %5u %5u %9u %6d %10.1f %8u %8u %7u %7u\n",
+            c->cfg.read_size, c->cfg.prog_size, c->cfg.cache_size, c->cfg.lookahead_size,
+            (int)c->cfg.block_cycles, c->kb_per_s, c->p99_us, c->max_us, c->erases, c->ram);
+}
+
+int main(int argc, char **argv) {
+    static const int32_t cycles[] = {100, 500, 1000};
+    esp_littlefs_trace_hdr_t hdr = {0};
+    esp_littlefs_trace_rec_t *recs;
+    struct lfs_config geometry = {.block_size = 4096, .block_count = 256};
+    uint32_t min_read = 16, min_prog = 16, target = 90;
+    int open_files = -1, all = 0;
+    combo_t *combos = NULL, *best = NULL;
+    size_t n, count = 0, cap = 0;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s trace.bin|--synthetic [--block-size N] [--block-count N]\n"
+                        "       [--min-read N] [--min-prog N] [--open-files N] [--target PCT] [--all]\n", argv[0]);
+        return 2;
+    }
+    if(!strcmp(argv[1], "--synthetic")) {
+        synthesize();
+        recs = synth;
+        n = synth_n;
+    }
+    else {
+        recs = load_trace(argv[1], &hdr, &n);
+        if(recs == NULL) return 1;
+        geometry.block_size = hdr.block_size;
+        geometry.block_count = hdr.block_count;
+    }
+    for(int i=2; i < argc; i++) {
+        if(!strcmp(argv[i], "--all")) {
+            all = 1;
+            continue;
+        }
+        if(i + 1 == argc) {
+            fprintf(stderr, "%s needs a value\n", argv[i]);
+            return 2;
+        }
+        long v = strtol(argv[++i], NULL, 0);
+        if(!strcmp(argv[i - 1], "--block-size")) geometry.block_size = v;
+        else if(!strcmp(argv[i - 1], "--block-count")) geometry.block_count = v;
+        else if(!strcmp(argv[i - 1], "--min-read")) min_read = v;
+        else if(!strcmp(argv[i - 1], "--min-prog")) min_prog = v;
+        else if(!strcmp(argv[i - 1], "--open-files")) open_files = v;
+        else if(!strcmp(argv[i - 1], "--target")) target = v;
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i - 1]);
+            return 2;
+        }
+    }
+
+    ram = malloc((size_t)geometry.block_size * geometry.block_count);
+    run.us = malloc(MAX_CALLS * sizeof(*run.us));
+    if(ram == NULL || run.us == NULL) {
+        fprintf(stderr, "can't allocate %u blocks\n", geometry.block_count);
+        return 1;
+    }
+    find_preexisting(recs, n);
+
+    /* Everything littlefs accepts: caches hold whole reads and programs and divide the block */
+    for(uint32_t rd = min_read; rd <= MAX_IO && rd <= geometry.block_size; rd *= 2) {
+        for(uint32_t pg = min_prog; pg <= MAX_IO && pg <= geometry.block_size; pg *= 2) {
+            for(uint32_t cache = rd > pg ? rd : pg; cache <= MAX_CACHE && cache <= geometry.block_size; cache *= 2) {
+                if(geometry.block_size % cache) continue;
+                /* Lookahead beyond one bit per block buys nothing */
+                for(uint32_t la = 8; ; la *= 2) {
+                    for(size_t cy=0; cy < sizeof(cycles) / sizeof(cycles[0]); cy++) {
+                        if(count == cap) {
+                            cap = cap ? cap * 2 : 256;
+                            combos = realloc(combos, cap * sizeof(*combos));
+                        }
+                        combo_t *c = &combos[count];
+                        memset(c, 0, sizeof(*c));
+                        c->cfg = geometry;
+                        c->cfg.read = ram_read;
+                        c->cfg.prog = ram_prog;
+                        c->cfg.erase = ram_erase;
+                        c->cfg.sync = ram_sync;
+                        c->cfg.read_size = rd;
+                        c->cfg.prog_size = pg;
+                        c->cfg.cache_size = cache;
+                        c->cfg.lookahead_size = la;
+                        c->cfg.block_cycles = cycles[cy];
+                        if(run_combo(c, recs, n, open_files) < 0) {
+                            fprintf(stderr, "read %u prog %u cache %u lookahead %u: replay failed\n",
+                                    rd, pg, cache, la);
+                            continue;
+                        }
+                        count++;
+                    }
+                    if(la * 8 >= geometry.block_count) break;
+                }
+            }
+        }
+        fprintf(stderr, "read_size %u done, %zu combinations\n", rd, count);
+    }
+    if(count == 0) {
+        fprintf(stderr, "no combination could replay the workload\n");
+        return 1;
+    }
+
+    for(size_t i=0; i < count; i++) {
+        combos[i].pareto = 1;
+        for(size_t j=0; j < count && combos[i].pareto; j++) {
+            if(dominates(&combos[j], &combos[i])) combos[i].pareto = 0;
+        }
+    }
+    double best_kb_per_s = 0;
+    for(size_t i=0; i < count; i++) {
+        if(combos[i].kb_per_s > best_kb_per_s) best_kb_per_s = combos[i].kb_per_s;
+    }
+    for(size_t i=0; i < count; i++) {
+        combo_t *c = &combos[i];
+        if(!c->pareto || c->kb_per_s * 100 < best_kb_per_s * target) continue;
+        if(best == NULL || c->ram < best->ram || (c->ram == best->ram && c->p99_us < best->p99_us)) best = c;
+    }
+
+    printf("%zu calls on %u x %u blocks, %zu combinations\n\n", n, geometry.block_size,
+            geometry.block_count, count);
+    printf(" read  prog cache lookahead cycles       KB/s   p99 us   max us  erases     RAM\n");
+    for(size_t i=0; i < count; i++) {
+        if(all || combos[i].pareto) print_combo(&combos[i]);
+    }
+    printf("\nrecommended, the least RAM within %u%% of the best %.1f KB/s:\n", target, best_kb_per_s);
+    print_combo(best);
+    printf("\nCONFIG_LITTLEFS_READ_SIZE=%u\nCONFIG_LITTLEFS_WRITE_SIZE=%u\nCONFIG_LITTLEFS_CACHE_SIZE=%u\n"
+           "CONFIG_LITTLEFS_LOOKAHEAD_SIZE=%u\nCONFIG_LITTLEFS_BLOCK_CYCLES=%d\n",
+            best->cfg.read_size, best->cfg.prog_size, best->cfg.cache_size,
+            best->cfg.lookahead_size, (int)best->cfg.block_cycles);
+
+    free(combos);
+    free(recs);
+    free(run.us);
+    free(ram);
+    return 0;
+}